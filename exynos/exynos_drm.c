@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <sys/mman.h>
 #include <linux/stddef.h>
@@ -394,3 +395,79 @@ int exynos_vidi_connection(struct exynos_device *dev, uint32_t connect,
 
 	return 0;
 }
+
+/*
+ * Read the pending events from the drm device and dispatch them.
+ *
+ * @dev: a exynos device object.
+ * @ctx: a event context with the handlers to call.
+ *
+ * this interface is used in place of drmHandleEvent() to also receive
+ * the exynos specific events, such as fimg2d completion events, while
+ * vblank and page flip events go to the handlers in ctx->base.
+ *
+ * if true, return 0 else negative.
+ */
+int exynos_handle_event(struct exynos_device *dev,
+				struct exynos_event_context *ctx)
+{
+	char buffer[1024];
+	int len, i;
+	struct drm_event *e;
+	struct drm_event_vblank *vblank;
+	struct drm_exynos_g2d_event *g2d;
+	drmEventContextPtr evctx = &ctx->base;
+
+	/* The DRM read semantics guarantees that we always get only
+	 * complete events. */
+	len = read(dev->fd, buffer, sizeof buffer);
+	if (len == 0)
+		return 0;
+	if (len < (int)sizeof(*e))
+		return -1;
+
+	i = 0;
+	while (i < len) {
+		e = (struct drm_event *) &buffer[i];
+		switch (e->type) {
+		case DRM_EVENT_VBLANK:
+			if (evctx->version < 1 ||
+			    evctx->vblank_handler == NULL)
+				break;
+			vblank = (struct drm_event_vblank *) e;
+			evctx->vblank_handler(dev->fd,
+					vblank->sequence,
+					vblank->tv_sec,
+					vblank->tv_usec,
+					(void *)(unsigned long)vblank->user_data);
+			break;
+		case DRM_EVENT_FLIP_COMPLETE:
+			if (evctx->version < 2 ||
+			    evctx->page_flip_handler == NULL)
+				break;
+			vblank = (struct drm_event_vblank *) e;
+			evctx->page_flip_handler(dev->fd,
+					vblank->sequence,
+					vblank->tv_sec,
+					vblank->tv_usec,
+					(void *)(unsigned long)vblank->user_data);
+			break;
+		case DRM_EXYNOS_G2D_EVENT:
+			if (ctx->version < 1 ||
+			    ctx->g2d_event_handler == NULL)
+				break;
+			g2d = (struct drm_exynos_g2d_event *) e;
+			ctx->g2d_event_handler(dev->fd,
+					g2d->cmdlist_no,
+					g2d->tv_sec,
+					g2d->tv_usec,
+					(void *)(unsigned long)g2d->user_data);
+			break;
+		default:
+			break;
+		}
+		i += e->length;
+	}
+
+	return 0;
+}
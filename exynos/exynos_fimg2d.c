@@ -101,6 +101,10 @@ static int g2d_add_cmd(struct g2d_context *ctx, unsigned long cmd,
 			return -EINVAL;
 		}
 
+		if (cmd & G2D_BUF_USERPTR)
+			ctx->cmd_userptr[ctx->cmd_buf_nr] =
+				*(struct drm_exynos_g2d_userptr *)value;
+
 		ctx->cmd_buf[ctx->cmd_buf_nr].offset = cmd;
 		ctx->cmd_buf[ctx->cmd_buf_nr].data = value;
 		ctx->cmd_buf_nr++;
@@ -134,6 +138,132 @@ static void g2d_reset(struct g2d_context *ctx)
 	g2d_add_cmd(ctx, SOFT_RESET_REG, 0x01);
 }
 
+/*
+ * g2d_set_cmdlist - summit one command list to command queue aware of
+ *		fimg2d dma.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @cmd: commands and values to registers.
+ * @cmd_nr: number of entries in cmd.
+ * @cmd_buf: commands and values to buffer address registers.
+ * @cmd_buf_nr: number of entries in cmd_buf.
+ * @event: nonzero to get a completion event once the list is done.
+ * @userdata: user data handed back with the completion event.
+ */
+static int g2d_set_cmdlist(struct g2d_context *ctx,
+			struct drm_exynos_g2d_cmd *cmd, unsigned int cmd_nr,
+			struct drm_exynos_g2d_cmd *cmd_buf,
+			unsigned int cmd_buf_nr, unsigned int event,
+			void *userdata)
+{
+	int ret;
+	struct drm_exynos_g2d_set_cmdlist cmdlist;
+
+	memset(&cmdlist, 0, sizeof(struct drm_exynos_g2d_set_cmdlist));
+
+	cmdlist.cmd = (unsigned long)cmd;
+	cmdlist.cmd_buf = (unsigned long)cmd_buf;
+	cmdlist.cmd_nr = cmd_nr;
+	cmdlist.cmd_buf_nr = cmd_buf_nr;
+	cmdlist.event_type = event ? G2D_EVENT_NONSTOP : G2D_EVENT_NOT;
+	cmdlist.user_data = (unsigned long)userdata;
+
+	ret = drmIoctl(ctx->fd, DRM_IOCTL_EXYNOS_G2D_SET_CMDLIST, &cmdlist);
+	if (ret < 0) {
+		fprintf(stderr, "failed to set cmdlist.\n");
+		return ret;
+	}
+
+	ctx->cmdlist_nr++;
+
+	return ret;
+}
+
+/*
+ * g2d_cmdlist_userptr - point the userptr buffer commands of a deferred
+ *		command list to the copies kept with it.
+ *
+ * @list: a pointer to g2d_cmdlist structure.
+ */
+static void g2d_cmdlist_userptr(struct g2d_cmdlist *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < list->cmd_buf_nr; i++) {
+		if (list->cmd_buf[i].offset & G2D_BUF_USERPTR)
+			list->cmd_buf[i].data =
+				(unsigned long)&list->userptr[i];
+	}
+}
+
+/*
+ * g2d_set_deferred - summit the command lists recorded in deferred mode.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @event: nonzero to get a completion event after the last command list.
+ * @userdata: user data handed back with the completion event.
+ *
+ * Nothing is summited, and -EBUSY returned, if the kernel doesn't have
+ * enough command lists left for all of them.  The lists that couldn't be
+ * summited stay recorded, in order, for the next try.
+ */
+static int g2d_set_deferred(struct g2d_context *ctx, unsigned int event,
+			void *userdata)
+{
+	struct g2d_cmdlist *list;
+	unsigned int i, last;
+	int ret;
+
+	if (ctx->deferred_nr >
+	    G2D_MAX_CMD_LIST_NR - ctx->async_nr - ctx->cmdlist_nr)
+		return -EBUSY;
+
+	for (i = 0; i < ctx->deferred_nr; i++) {
+		list = &ctx->deferred_list[i];
+		last = (i == ctx->deferred_nr - 1);
+		ret = g2d_set_cmdlist(ctx, list->cmd, list->cmd_nr,
+					list->cmd_buf, list->cmd_buf_nr,
+					event && last, userdata);
+		if (ret < 0)
+			goto keep;
+	}
+	ctx->deferred_nr = 0;
+
+	return 0;
+
+keep:
+	ctx->deferred_nr -= i;
+	memmove(ctx->deferred_list, &ctx->deferred_list[i],
+			ctx->deferred_nr * sizeof(*ctx->deferred_list));
+	for (i = 0; i < ctx->deferred_nr; i++)
+		g2d_cmdlist_userptr(&ctx->deferred_list[i]);
+
+	return ret;
+}
+
+/*
+ * g2d_record - copy the user side command buffer to a new deferred
+ *		command list.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ */
+static void g2d_record(struct g2d_context *ctx)
+{
+	struct g2d_cmdlist *list;
+
+	list = &ctx->deferred_list[ctx->deferred_nr++];
+	memcpy(list->cmd, ctx->cmd, ctx->cmd_nr * sizeof(ctx->cmd[0]));
+	memcpy(list->cmd_buf, ctx->cmd_buf,
+			ctx->cmd_buf_nr * sizeof(ctx->cmd_buf[0]));
+	list->cmd_nr = ctx->cmd_nr;
+	list->cmd_buf_nr = ctx->cmd_buf_nr;
+
+	/* the kernel only reads userptr buffers at SET_CMDLIST time. */
+	memcpy(list->userptr, ctx->cmd_userptr,
+			ctx->cmd_buf_nr * sizeof(ctx->cmd_userptr[0]));
+	g2d_cmdlist_userptr(list);
+}
+
 /*
  * g2d_flush - summit all commands and values in user side command buffer
  *		to command queue aware of fimg2d dma.
@@ -142,39 +272,53 @@ static void g2d_reset(struct g2d_context *ctx)
  *
  * This function should be called after all commands and values to user
  * side command buffer is set to summit that buffer to kernel side driver.
+ * In deferred mode the command buffer is only recorded, and summited by
+ * g2d_exec(), which is called here first if the command queue is full.
  */
 static int g2d_flush(struct g2d_context *ctx)
 {
 	int ret;
-	struct drm_exynos_g2d_set_cmdlist cmdlist;
 
 	if (ctx->cmd_nr  == 0 && ctx->cmd_buf_nr == 0)
 		return FALSE;
 
-	if (ctx->cmdlist_nr >= G2D_MAX_CMD_LIST_NR) {
-		fprintf(stderr, "Overflow cmdlist.\n");
-		return -EINVAL;
-	}
+	if (ctx->deferred) {
+		if (ctx->cmdlist_nr + ctx->deferred_nr >= G2D_MAX_CMD_LIST_NR) {
+			ret = g2d_exec(ctx);
+			if (ret < 0) {
+				ctx->cmd_nr = 0;
+				ctx->cmd_buf_nr = 0;
+				return ret;
+			}
+		}
 
-	memset(&cmdlist, 0, sizeof(struct drm_exynos_g2d_set_cmdlist));
+		g2d_record(ctx);
 
-	cmdlist.cmd = (unsigned int)&ctx->cmd[0];
-	cmdlist.cmd_buf = (unsigned int)&ctx->cmd_buf[0];
-	cmdlist.cmd_nr = ctx->cmd_nr;
-	cmdlist.cmd_buf_nr = ctx->cmd_buf_nr;
-	cmdlist.event_type = G2D_EVENT_NOT;
-	cmdlist.user_data = 0;
+		ctx->cmd_nr = 0;
+		ctx->cmd_buf_nr = 0;
 
-	ctx->cmd_nr = 0;
-	ctx->cmd_buf_nr = 0;
+		return 0;
+	}
 
-	ret = drmIoctl(ctx->fd, DRM_IOCTL_EXYNOS_G2D_SET_CMDLIST, &cmdlist);
+	if (ctx->async_nr + ctx->cmdlist_nr + ctx->deferred_nr >=
+	    G2D_MAX_CMD_LIST_NR) {
+		fprintf(stderr, "Overflow cmdlist.\n");
+		return -EINVAL;
+	}
+
+	/* lists still recorded from deferred mode go first. */
+	ret = g2d_set_deferred(ctx, 0, NULL);
 	if (ret < 0) {
-		fprintf(stderr, "failed to set cmdlist.\n");
+		ctx->cmd_nr = 0;
+		ctx->cmd_buf_nr = 0;
 		return ret;
 	}
 
-	ctx->cmdlist_nr++;
+	ret = g2d_set_cmdlist(ctx, ctx->cmd, ctx->cmd_nr, ctx->cmd_buf,
+				ctx->cmd_buf_nr, 0, NULL);
+
+	ctx->cmd_nr = 0;
+	ctx->cmd_buf_nr = 0;
 
 	return ret;
 }
@@ -214,24 +358,68 @@ struct g2d_context *g2d_init(int fd)
 
 void g2d_fini(struct g2d_context *ctx)
 {
-	if (ctx)
+	if (ctx) {
+		free(ctx->deferred_list);
 		free(ctx);
+	}
 }
 
 /**
- * g2d_exec - start the dma to process all commands summited by g2d_flush().
+ * g2d_config_deferred - enable or disable deferred mode.
  *
  * @ctx: a pointer to g2d_context structure.
+ * @enable: nonzero to only record operations, and summit them all from
+ *	g2d_exec().
+ *
+ * In deferred mode more operations than fit in the command queue can be
+ * done between two calls to g2d_exec(), the queue is executed whenever
+ * it fills up.  Disabling it summits what was recorded so far, so that
+ * it stays ahead of later operations.
  */
-int g2d_exec(struct g2d_context *ctx)
+int g2d_config_deferred(struct g2d_context *ctx, unsigned int enable)
+{
+	if (!enable) {
+		ctx->deferred = 0;
+		return g2d_set_deferred(ctx, 0, NULL);
+	}
+
+	if (enable && !ctx->deferred_list) {
+		ctx->deferred_list = calloc(G2D_MAX_CMD_LIST_NR,
+					sizeof(*ctx->deferred_list));
+		if (!ctx->deferred_list) {
+			fprintf(stderr, "failed to allocate cmdlists.\n");
+			return -ENOMEM;
+		}
+	}
+
+	ctx->deferred = enable;
+
+	return 0;
+}
+
+/*
+ * g2d_submit - summit the command lists recorded in deferred mode and start
+ *		the dma.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @async: nonzero to return without waiting for the dma to be done.
+ * @event: nonzero to get a completion event after the last command list.
+ * @userdata: user data handed back with the completion event.
+ */
+static int g2d_submit(struct g2d_context *ctx, unsigned int async,
+			unsigned int event, void *userdata)
 {
 	struct drm_exynos_g2d_exec exec;
 	int ret;
 
+	ret = g2d_set_deferred(ctx, event, userdata);
+	if (ret < 0)
+		return ret;
+
 	if (ctx->cmdlist_nr == 0)
 		return -EINVAL;
 
-	exec.async = 0;
+	exec.async = async;
 
 	ret = drmIoctl(ctx->fd, DRM_IOCTL_EXYNOS_G2D_EXEC, &exec);
 	if (ret < 0) {
@@ -239,11 +427,81 @@ int g2d_exec(struct g2d_context *ctx)
 		return ret;
 	}
 
+	if (async) {
+		ctx->async_batch[(ctx->async_first + ctx->async_batch_nr) %
+				G2D_MAX_CMD_LIST_NR] = ctx->cmdlist_nr;
+		ctx->async_batch_nr++;
+		ctx->async_nr += ctx->cmdlist_nr;
+	}
 	ctx->cmdlist_nr = 0;
 
 	return ret;
 }
 
+/**
+ * g2d_exec - start the dma to process all commands summited by g2d_flush().
+ *
+ * @ctx: a pointer to g2d_context structure.
+ */
+int g2d_exec(struct g2d_context *ctx)
+{
+	return g2d_submit(ctx, 0, 0, NULL);
+}
+
+/**
+ * g2d_exec_async - start the dma to process all commands summited by
+ *	g2d_flush() without waiting for it to be done.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @userdata: user data handed to the g2d event handler of
+ *	exynos_handle_event() once all the commands are done.
+ *
+ * The completion event is requested with the last command list, so this
+ * needs deferred mode, where that one is only summited here.
+ *
+ * The kernel holds on to the command lists of the batch until it is done,
+ * out of the G2D_MAX_CMD_LIST_NR it has, so they are counted until
+ * g2d_async_done() is called for the event.  A summit that needs more
+ * command lists than are left, by g2d_exec() or g2d_exec_async(), fails
+ * with -EBUSY and the recorded operations stay queued, to be summited
+ * once an event has been handled.
+ *
+ * Only the last G2D_MAX_CMD_LIST_NR operations are executed asynchronously:
+ * when more are recorded, the full command queue is executed by g2d_flush()
+ * with a blocking g2d_exec(), stalling the caller at that point.  With a
+ * batch still running that fails, and so does the operation that didn't
+ * fit.  Those earlier operations are done by the time the event arrives,
+ * but get no event of their own.
+ */
+int g2d_exec_async(struct g2d_context *ctx, void *userdata)
+{
+	if (ctx->deferred_nr == 0) {
+		fprintf(stderr, "no deferred cmdlist to signal completion.\n");
+		return -EINVAL;
+	}
+
+	return g2d_submit(ctx, 1, 1, userdata);
+}
+
+/**
+ * g2d_async_done - release the command lists of the oldest batch started
+ *	by g2d_exec_async() that is still counted as running.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ *
+ * To be called once for every completion event of g2d_exec_async(), from
+ * the g2d event handler of exynos_handle_event().
+ */
+void g2d_async_done(struct g2d_context *ctx)
+{
+	if (ctx->async_batch_nr == 0)
+		return;
+
+	ctx->async_nr -= ctx->async_batch[ctx->async_first];
+	ctx->async_first = (ctx->async_first + 1) % G2D_MAX_CMD_LIST_NR;
+	ctx->async_batch_nr--;
+}
+
 /**
  * g2d_solid_fill - fill given buffer with given color data.
  *
@@ -291,6 +291,16 @@ struct g2d_image {
 	void				*mapped_ptr[G2D_PLANE_MAX_NR];
 };
 
+struct g2d_cmdlist {
+	struct drm_exynos_g2d_cmd	cmd[G2D_MAX_CMD_NR];
+	struct drm_exynos_g2d_cmd	cmd_buf[G2D_MAX_GEM_CMD_NR];
+	unsigned int			cmd_nr;
+	unsigned int			cmd_buf_nr;
+	/* userptr buffers the cmd_buf entries point to, copied from the
+	 * images as those may change before the list is summited. */
+	struct drm_exynos_g2d_userptr	userptr[G2D_MAX_GEM_CMD_NR];
+};
+
 struct g2d_context {
 	int				fd;
 	unsigned int			major;
@@ -300,11 +310,26 @@ struct g2d_context {
 	unsigned int			cmd_nr;
 	unsigned int			cmd_buf_nr;
 	unsigned int			cmdlist_nr;
+	/* userptr buffers of the cmd_buf entries, for deferred mode. */
+	struct drm_exynos_g2d_userptr	cmd_userptr[G2D_MAX_GEM_CMD_NR];
+	/* command lists recorded in deferred mode, not yet summited. */
+	unsigned int			deferred;
+	struct g2d_cmdlist		*deferred_list;
+	unsigned int			deferred_nr;
+	/* command lists of the g2d_exec_async() batches still running,
+	 * oldest first, which the kernel holds on to until they are done. */
+	unsigned int			async_batch[G2D_MAX_CMD_LIST_NR];
+	unsigned int			async_first;
+	unsigned int			async_batch_nr;
+	unsigned int			async_nr;
 };
 
 struct g2d_context *g2d_init(int fd);
 void g2d_fini(struct g2d_context *ctx);
+int g2d_config_deferred(struct g2d_context *ctx, unsigned int enable);
 int g2d_exec(struct g2d_context *ctx);
+int g2d_exec_async(struct g2d_context *ctx, void *userdata);
+void g2d_async_done(struct g2d_context *ctx);
 int g2d_solid_fill(struct g2d_context *ctx, struct g2d_image *img,
 			unsigned int x, unsigned int y, unsigned int w,
 			unsigned int h);
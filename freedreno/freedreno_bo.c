@@ -31,6 +31,16 @@
 
 #include <linux/fb.h>
 
+/* lookup a buffer in the handle or name table, called w/ table_lock held: */
+static struct fd_bo * lookup_bo(void *table, uint32_t key)
+{
+	void *bo;
+	if (drmHashLookup(table, key, &bo))
+		return NULL;
+	return fd_bo_ref(bo);
+}
+
+/* allocate a new buffer object, called w/ table_lock held: */
 static struct fd_bo * bo_from_handle(struct fd_device *dev,
 		uint32_t size, uint32_t handle)
 {
@@ -44,6 +54,7 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 	atomic_set(&bo->refcnt, 1);
 	for (i = 0; i < ARRAY_SIZE(bo->list); i++)
 		list_inithead(&bo->list[i]);
+	drmHashInsert(dev->handle_table, handle, bo);
 	return bo;
 }
 
@@ -95,7 +106,9 @@ struct fd_bo * fd_bo_new(struct fd_device *dev,
 		return NULL;
 	}
 
+	pthread_mutex_lock(&dev->table_lock);
 	bo = bo_from_handle(dev, size, req.handle);
+	pthread_mutex_unlock(&dev->table_lock);
 	if (!bo) {
 		goto fail;
 	}
@@ -127,7 +140,9 @@ struct fd_bo * fd_bo_from_fbdev(struct fd_pipe *pipe,
 		return NULL;
 	}
 
+	pthread_mutex_lock(&pipe->dev->table_lock);
 	bo = bo_from_handle(pipe->dev, size, req.handle);
+	pthread_mutex_unlock(&pipe->dev->table_lock);
 
 	/* this is fugly, but works around a bug in the kernel..
 	 * priv->memdesc.size never gets set, so getbufinfo ioctl
@@ -167,13 +182,29 @@ struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	};
 	struct fd_bo *bo;
 
+	pthread_mutex_lock(&dev->table_lock);
+
+	/* re-importing a buffer we already have, hand back the same
+	 * fd_bo w/ its gpuaddr and mapping:
+	 */
+	bo = lookup_bo(dev->name_table, name);
+	if (bo)
+		goto out_unlock;
+
 	if (drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req)) {
-		return NULL;
+		goto out_unlock;
 	}
 
-	bo = bo_from_handle(dev, req.size, req.handle);
-	if (bo)
+	bo = lookup_bo(dev->handle_table, req.handle);
+	if (!bo)
+		bo = bo_from_handle(dev, req.size, req.handle);
+	if (bo && !bo->name) {
 		bo->name = name;
+		drmHashInsert(dev->name_table, name, bo);
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -186,8 +217,16 @@ struct fd_bo * fd_bo_ref(struct fd_bo *bo)
 
 void fd_bo_del(struct fd_bo *bo)
 {
-	if (!atomic_dec_and_test(&bo->refcnt))
+	struct fd_device *dev = bo->dev;
+
+	/* drop the last reference w/ table_lock held, so that an import
+	 * can't find the bo in the tables while it is being freed:
+	 */
+	pthread_mutex_lock(&dev->table_lock);
+	if (!atomic_dec_and_test(&bo->refcnt)) {
+		pthread_mutex_unlock(&dev->table_lock);
 		return;
+	}
 
 	if (bo->map)
 		munmap(bo->map, bo->size);
@@ -196,9 +235,14 @@ void fd_bo_del(struct fd_bo *bo)
 		struct drm_gem_close req = {
 				.handle = bo->handle,
 		};
-		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		drmHashDelete(dev->handle_table, bo->handle);
+		if (bo->name)
+			drmHashDelete(dev->name_table, bo->name);
+		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 	}
 
+	pthread_mutex_unlock(&dev->table_lock);
+
 	free(bo);
 }
 
@@ -215,7 +259,10 @@ int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 			return ret;
 		}
 
+		pthread_mutex_lock(&bo->dev->table_lock);
 		bo->name = req.name;
+		drmHashInsert(bo->dev->name_table, bo->name, bo);
+		pthread_mutex_unlock(&bo->dev->table_lock);
 	}
 
 	*name = bo->name;
@@ -278,6 +325,28 @@ uint32_t fd_bo_gpuaddr(struct fd_bo *bo, uint32_t offset)
 	return bo->gpuaddr + offset;
 }
 
+/* look up the gpuaddr and/or mmap a set of buffers up front, so that
+ * emitting relocs to them later doesn't have to:
+ */
+int fd_bo_prefetch(struct fd_bo **bos, uint32_t count, uint32_t flags)
+{
+	uint32_t i;
+	int ret = 0;
+
+	for (i = 0; i < count; i++) {
+		struct fd_bo *bo = bos[i];
+
+		if ((flags & FD_BO_PREFETCH_GPUADDR) && !bo->gpuaddr &&
+				!fd_bo_gpuaddr(bo, 0))
+			ret = -1;
+		if ((flags & FD_BO_PREFETCH_MAP) && !bo->map &&
+				!fd_bo_map(bo))
+			ret = -1;
+	}
+
+	return ret;
+}
+
 /*
  * Super-cheezy way to synchronization between mesa and ddx..  the
  * SET_ACTIVE ioctl gives us a way to stash a 32b # w/ a GEM bo, and
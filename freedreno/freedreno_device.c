@@ -35,11 +35,24 @@ struct fd_device * fd_device_new(int fd)
 	if (!dev)
 		return NULL;
 	dev->fd = fd;
+	pthread_mutex_init(&dev->table_lock, NULL);
+	dev->handle_table = drmHashCreate();
+	dev->name_table = drmHashCreate();
+	if (!dev->handle_table || !dev->name_table) {
+		ERROR_MSG("allocation failed");
+		fd_device_del(dev);
+		return NULL;
+	}
 	return dev;
 }
 
 void fd_device_del(struct fd_device *dev)
 {
+	if (dev->handle_table)
+		drmHashDestroy(dev->handle_table);
+	if (dev->name_table)
+		drmHashDestroy(dev->name_table);
+	pthread_mutex_destroy(&dev->table_lock);
 	free(dev);
 }
 
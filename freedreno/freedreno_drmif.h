@@ -51,6 +51,14 @@ enum fd_param_id {
 	FD_GPU_ID,
 };
 
+/* cross-pipe synchronization counters, see fd_pipe_get_stats(): */
+struct fd_pipe_stats {
+	uint64_t submits;      /* submits that had to sync against 3d */
+	uint64_t deps;         /* shared buffers with a 3d timestamp */
+	uint64_t waits;        /* blocking waits on the 3d pipe */
+	uint64_t waits_skipped;/* syncs the 3d pipe had already retired */
+};
+
 /* bo flags: */
 #define DRM_FREEDRENO_GEM_TYPE_SMI        0x00000001
 #define DRM_FREEDRENO_GEM_TYPE_KMEM       0x00000002
@@ -80,6 +88,8 @@ int fd_pipe_get_param(struct fd_pipe *pipe, enum fd_param_id param,
 		uint64_t *value);
 int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp);
 int fd_pipe_timestamp(struct fd_pipe *pipe, uint32_t *timestamp);
+void fd_pipe_get_stats(struct fd_pipe *pipe, struct fd_pipe_stats *stats);
+int fd_pipe_flush_queue(struct fd_pipe *pipe);
 
 
 /* buffer-object functions:
@@ -97,4 +107,9 @@ uint32_t fd_bo_handle(struct fd_bo *bo);
 uint32_t fd_bo_size(struct fd_bo *bo);
 void * fd_bo_map(struct fd_bo *bo);
 
+/* prefetch flags: */
+#define FD_BO_PREFETCH_GPUADDR    0x00000001
+#define FD_BO_PREFETCH_MAP        0x00000002
+int fd_bo_prefetch(struct fd_bo **bos, uint32_t count, uint32_t flags);
+
 #endif /* FREEDRENO_DRMIF_H_ */
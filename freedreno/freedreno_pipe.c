@@ -96,6 +96,11 @@ struct fd_pipe * fd_pipe_new(struct fd_device *dev, enum fd_pipe_id id)
 	GETPROP(fd, VERSION,     pipe->version);
 	GETPROP(fd, DEVICE_INFO, pipe->devinfo);
 
+	/* timestamps don't start from zero, so start out from the current
+	 * one for comparisons against retired to be meaningful:
+	 */
+	fd_pipe_timestamp(pipe, &pipe->retired);
+
 	INFO_MSG("Pipe Info:");
 	INFO_MSG(" Device:          %s", paths[id]);
 	INFO_MSG(" Chip-id:         %d.%d.%d.%d",
@@ -132,6 +137,8 @@ void fd_pipe_del(struct fd_pipe *pipe)
 	if (pipe->fd)
 		close(pipe->fd);
 
+	free(pipe->queue);
+	free(pipe->queue_ibs);
 	free(pipe);
 }
 
@@ -165,10 +172,13 @@ int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
 	do {
 		ret = ioctl(pipe->fd, IOCTL_KGSL_DEVICE_WAITTIMESTAMP, &req);
 	} while ((ret == -1) && ((errno == EINTR) || (errno == EAGAIN)));
-	if (ret)
+	if (ret) {
 		ERROR_MSG("waittimestamp failed! %d (%s)", ret, strerror(errno));
-	else
+	} else {
+		if (fd_timestamp_after(timestamp, pipe->retired))
+			pipe->retired = timestamp;
 		fd_pipe_process_pending(pipe, timestamp);
+	}
 	return ret;
 }
 
@@ -183,10 +193,17 @@ int fd_pipe_timestamp(struct fd_pipe *pipe, uint32_t *timestamp)
 				ret, strerror(errno));
 		return ret;
 	}
+	/* what was just read back is the latest retired timestamp: */
 	*timestamp = req.timestamp;
+	pipe->retired = req.timestamp;
 	return 0;
 }
 
+void fd_pipe_get_stats(struct fd_pipe *pipe, struct fd_pipe_stats *stats)
+{
+	*stats = pipe->stats;
+}
+
 /* add buffer to submit list when it is referenced in cmdstream: */
 void fd_pipe_add_submit(struct fd_pipe *pipe, struct fd_bo *bo)
 {
@@ -199,10 +216,16 @@ void fd_pipe_add_submit(struct fd_pipe *pipe, struct fd_bo *bo)
 	list_addtail(list, &pipe->submit_list);
 }
 
-/* prepare buffers on submit list before flush: */
+/* prepare buffers on submit list before flush.  Waiting for the
+ * latest 3d timestamp of any of the shared buffers covers all of
+ * them, and there's no need to wait at all if the 3d pipe has been
+ * seen past it already:
+ */
 void fd_pipe_pre_submit(struct fd_pipe *pipe)
 {
 	struct fd_bo *bo;
+	uint32_t timestamp = 0;
+	int deps = 0;
 
 	if (pipe->id == FD_PIPE_3D)
 		return;
@@ -211,10 +234,25 @@ void fd_pipe_pre_submit(struct fd_pipe *pipe)
 		pipe->p3d = fd_pipe_new(pipe->dev, FD_PIPE_3D);
 
 	LIST_FOR_EACH_ENTRY(bo, &pipe->submit_list, list[pipe->id]) {
-		uint32_t timestamp = fd_bo_get_timestamp(bo);
-		if (timestamp)
-			fd_pipe_wait(pipe->p3d, timestamp);
+		uint32_t bo_timestamp = fd_bo_get_timestamp(bo);
+		if (bo_timestamp) {
+			if (!deps++ || fd_timestamp_after(bo_timestamp, timestamp))
+				timestamp = bo_timestamp;
+		}
 	}
+
+	if (!deps)
+		return;
+
+	pipe->stats.deps += deps;
+	pipe->stats.submits++;
+	if (!fd_timestamp_after(timestamp, pipe->p3d->retired)) {
+		pipe->stats.waits_skipped++;
+		return;
+	}
+
+	pipe->stats.waits++;
+	fd_pipe_wait(pipe->p3d, timestamp);
 }
 
 /* process buffers on submit list after flush: */
@@ -35,6 +35,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
@@ -49,6 +50,18 @@
 
 struct fd_device {
 	int fd;
+
+	/* tables of bo's by gem handle and flink name, so importing a
+	 * buffer we already have returns the same fd_bo:
+	 */
+	void *handle_table, *name_table;
+	pthread_mutex_t table_lock;
+};
+
+/* ringbuffer a queued IB comes from, and its segment: */
+struct fd_queued_ib {
+	struct fd_ringbuffer *ring;
+	struct fd_rb_bo *bo;
 };
 
 struct fd_pipe {
@@ -75,6 +88,18 @@ struct fd_pipe {
 	 * from 3d, we need to also internally open the 3d pipe:
 	 */
 	struct fd_pipe *p3d;
+
+	/* last timestamp known to have retired, from waiting on
+	 * it or reading it back:
+	 */
+	uint32_t retired;
+
+	struct fd_pipe_stats stats;
+
+	/* ringmarker ranges queued for the next fd_pipe_flush_queue(): */
+	struct kgsl_ibdesc *queue;
+	struct fd_queued_ib *queue_ibs;
+	uint32_t nr_queued, max_queued;
 };
 
 void fd_pipe_add_submit(struct fd_pipe *pipe, struct fd_bo *bo);
@@ -82,6 +107,14 @@ void fd_pipe_pre_submit(struct fd_pipe *pipe);
 void fd_pipe_post_submit(struct fd_pipe *pipe, uint32_t timestamp);
 void fd_pipe_process_pending(struct fd_pipe *pipe, uint32_t timestamp);
 
+/* kgsl timestamps wrap, so compare them like the kernel's timestamp_cmp()
+ * does, true if timestamp a is later than b:
+ */
+static inline int fd_timestamp_after(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) > 0;
+}
+
 struct fd_bo {
 	struct fd_device *dev;
 	uint32_t size;
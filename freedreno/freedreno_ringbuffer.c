@@ -40,6 +40,11 @@ struct fd_rb_bo {
 	void    *hostptr;
 	uint32_t gpuaddr;
 	uint32_t size;
+	/* end of the cmds in the segment, once the ring has moved on: */
+	uint32_t *cur;
+	/* timestamp of the last submit of cmds in the segment: */
+	uint32_t timestamp;
+	struct fd_rb_bo *next;
 };
 
 struct fd_ringmarker {
@@ -97,6 +102,73 @@ fail:
 	return NULL;
 }
 
+static void fd_rb_bo_del_list(struct fd_rb_bo *bo)
+{
+	while (bo) {
+		struct fd_rb_bo *next = bo->next;
+		fd_rb_bo_del(bo);
+		bo = next;
+	}
+}
+
+static void ring_set_bo(struct fd_ringbuffer *ring, struct fd_rb_bo *bo)
+{
+	ring->bo = bo;
+	ring->start = bo->hostptr;
+	ring->end = &(ring->start[bo->size/4]);
+}
+
+/* find the segment that ptr points into.  The end of a segment the
+ * ring has moved on from is where the cmds continue in the next one:
+ */
+static struct fd_rb_bo * ring_find_bo(struct fd_ringbuffer *ring,
+		uint32_t **ptr)
+{
+	struct fd_rb_bo *bo;
+
+	for (bo = ring->first_bo; bo != ring->bo; bo = bo->next) {
+		uint32_t *start = bo->hostptr;
+		if ((start <= *ptr) && (*ptr < bo->cur))
+			return bo;
+		if (*ptr == bo->cur) {
+			*ptr = bo->next->hostptr;
+			return bo->next;
+		}
+	}
+
+	return ring->bo;
+}
+
+/* recycle the oldest segment that is big enough, if the gpu is done
+ * with it, otherwise allocate another one.  The free list is oldest
+ * first, so the search stops at the first segment still in use:
+ */
+static struct fd_rb_bo * ring_get_bo(struct fd_ringbuffer *ring,
+		uint32_t size)
+{
+	struct fd_pipe *pipe = ring->pipe;
+	struct fd_rb_bo *bo, **prev;
+	uint32_t timestamp;
+	int read = 0;
+
+	for (prev = &ring->free_bos; (bo = *prev); prev = &bo->next) {
+		if (fd_timestamp_after(bo->timestamp, pipe->retired)) {
+			if (read++ || fd_pipe_timestamp(pipe, &timestamp))
+				break;
+			if (fd_timestamp_after(bo->timestamp, pipe->retired))
+				break;
+		}
+
+		if (bo->size >= size) {
+			*prev = bo->next;
+			bo->next = NULL;
+			return bo;
+		}
+	}
+
+	return fd_rb_bo_new(pipe, size);
+}
+
 struct fd_ringbuffer * fd_ringbuffer_new(struct fd_pipe *pipe,
 		uint32_t size)
 {
@@ -116,8 +188,8 @@ struct fd_ringbuffer * fd_ringbuffer_new(struct fd_pipe *pipe,
 
 	ring->size = size;
 	ring->pipe = pipe;
-	ring->start = ring->bo->hostptr;
-	ring->end = &(ring->start[size/4]);
+	ring->first_bo = ring->bo;
+	ring_set_bo(ring, ring->bo);
 
 	ring->cur = ring->last_start = ring->start;
 
@@ -130,36 +202,125 @@ fail:
 
 void fd_ringbuffer_del(struct fd_ringbuffer *ring)
 {
-	if (ring->bo)
-		fd_rb_bo_del(ring->bo);
+	fd_rb_bo_del_list(ring->first_bo);
+	fd_rb_bo_del_list(ring->free_bos);
 	free(ring);
 }
 
 void fd_ringbuffer_reset(struct fd_ringbuffer *ring)
 {
-	uint32_t *start = ring->start;
+	struct fd_rb_bo *first = ring->first_bo;
+	uint32_t *start;
+
+	/* chained segments are recycled once their last submit retires,
+	 * oldest first:
+	 */
+	if (first->next) {
+		struct fd_rb_bo **tail = &ring->free_bos;
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = first->next;
+		first->next = NULL;
+		ring_set_bo(ring, first);
+	}
+
+	start = ring->start;
 	if (ring->pipe->id == FD_PIPE_2D)
 		start = &ring->start[0x140];
 	ring->cur = ring->last_start = start;
 }
 
-static int flush_impl(struct fd_ringbuffer *ring, uint32_t *last_start)
+int fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords)
+{
+	struct fd_rb_bo *bo;
+	uint32_t size = ring->size;
+
+	/* the 2d pipe always submits from the start of its one segment: */
+	if (ring->pipe->id == FD_PIPE_2D) {
+		ERROR_MSG("2d ringbuffer can't grow");
+		return -EINVAL;
+	}
+
+	if (size < ndwords * 4)
+		size = ndwords * 4;
+
+	bo = ring_get_bo(ring, size);
+	if (!bo) {
+		ERROR_MSG("ringbuffer allocation failed");
+		return -ENOMEM;
+	}
+
+	ring->bo->cur = ring->cur;
+	ring->bo->next = bo;
+	ring_set_bo(ring, bo);
+	ring->cur = ring->start;
+
+	return 0;
+}
+
+/* submit an IB list in one ioctl, *timestamp is in/out: */
+static int issue_ibs(struct fd_pipe *pipe, struct kgsl_ibdesc *ibdesc,
+		uint32_t numibs, uint32_t *timestamp)
 {
-	uint32_t offset = (uint8_t *)last_start - (uint8_t *)ring->start;
-	struct kgsl_ibdesc ibdesc = {
-			.gpuaddr     = ring->bo->gpuaddr + offset,
-			.hostptr     = last_start,
-			.sizedwords  = ring->cur - last_start,
-	};
 	struct kgsl_ringbuffer_issueibcmds req = {
-			.drawctxt_id = ring->pipe->drawctxt_id,
-			.ibdesc_addr = (unsigned long)&ibdesc,
-			.numibs      = 1,
+			.drawctxt_id = pipe->drawctxt_id,
+			.ibdesc_addr = (unsigned long)ibdesc,
+			.numibs      = numibs,
+			.timestamp   = *timestamp,
 			.flags       = KGSL_CONTEXT_SUBMIT_IB_LIST,
 	};
 	int ret;
 
-	fd_pipe_pre_submit(ring->pipe);
+	fd_pipe_pre_submit(pipe);
+
+	do {
+		ret = ioctl(pipe->fd, IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS, &req);
+	} while ((ret == -1) && ((errno == EINTR) || (errno == EAGAIN)));
+	if (ret)
+		ERROR_MSG("issueibcmds failed!  %d (%s)", ret, strerror(errno));
+
+	*timestamp = req.timestamp;
+
+	fd_pipe_post_submit(pipe, req.timestamp);
+
+	return ret;
+}
+
+static int flush_impl(struct fd_ringbuffer *ring, uint32_t *last_start)
+{
+	struct kgsl_ibdesc ibdesc_stack[4], *ibdesc = ibdesc_stack;
+	struct fd_rb_bo *first, *bo;
+	uint32_t timestamp = 0;
+	unsigned numibs = 0;
+	int ret;
+
+	/* one ib per segment written since last_start: */
+	first = ring_find_bo(ring, &last_start);
+	for (bo = first; bo; bo = bo->next)
+		numibs++;
+	if (numibs > ARRAY_SIZE(ibdesc_stack)) {
+		ibdesc = calloc(numibs, sizeof(*ibdesc));
+		if (!ibdesc) {
+			ERROR_MSG("allocation failed");
+			return -ENOMEM;
+		}
+	}
+
+	numibs = 0;
+	for (bo = first; bo; bo = bo->next) {
+		uint32_t *start = (bo == first) ? last_start : bo->hostptr;
+		uint32_t *end = (bo == ring->bo) ? ring->cur : bo->cur;
+
+		if ((start == end) && (bo != ring->bo))
+			continue;
+
+		ibdesc[numibs++] = (struct kgsl_ibdesc){
+				.gpuaddr     = bo->gpuaddr +
+						(uint8_t *)start - (uint8_t *)bo->hostptr,
+				.hostptr     = start,
+				.sizedwords  = end - start,
+		};
+	}
 
 	/* z180_cmdstream_issueibcmds() is made of fail: */
 	if (ring->pipe->id == FD_PIPE_2D) {
@@ -167,22 +328,22 @@ static int flush_impl(struct fd_ringbuffer *ring, uint32_t *last_start)
 		uint32_t last_size = (uint32_t)(ring->cur - last_start);
 		/* 5 is length of first packet, 2 for the two 7f000000's */
 		last_start[2] = last_size - (5 + 2);
-		ibdesc.gpuaddr = ring->bo->gpuaddr;
-		ibdesc.hostptr = ring->bo->hostptr;
-		ibdesc.sizedwords = 0x145;
-		req.timestamp = (uint32_t)ring->bo->hostptr;
+		ibdesc[0].gpuaddr = ring->bo->gpuaddr;
+		ibdesc[0].hostptr = ring->bo->hostptr;
+		ibdesc[0].sizedwords = 0x145;
+		timestamp = (uint32_t)ring->bo->hostptr;
 	}
 
-	do {
-		ret = ioctl(ring->pipe->fd, IOCTL_KGSL_RINGBUFFER_ISSUEIBCMDS, &req);
-	} while ((ret == -1) && ((errno == EINTR) || (errno == EAGAIN)));
-	if (ret)
-		ERROR_MSG("issueibcmds failed!  %d (%s)", ret, strerror(errno));
+	ret = issue_ibs(ring->pipe, ibdesc, numibs, &timestamp);
+
+	for (bo = first; bo; bo = bo->next)
+		bo->timestamp = timestamp;
 
-	ring->last_timestamp = req.timestamp;
+	ring->last_timestamp = timestamp;
 	ring->last_start = ring->cur;
 
-	fd_pipe_post_submit(ring->pipe, req.timestamp);
+	if (ibdesc != ibdesc_stack)
+		free(ibdesc);
 
 	return ret;
 }
@@ -220,8 +381,11 @@ void fd_ringbuffer_emit_reloc_shift(struct fd_ringbuffer *ring,
 void fd_ringbuffer_emit_reloc_ring(struct fd_ringbuffer *ring,
 		struct fd_ringmarker *target)
 {
-	(*ring->cur++) = target->ring->bo->gpuaddr +
-			(uint8_t *)target->cur - (uint8_t *)target->ring->start;
+	uint32_t *cur = target->cur;
+	struct fd_rb_bo *bo = ring_find_bo(target->ring, &cur);
+
+	(*ring->cur++) = bo->gpuaddr +
+			(uint8_t *)cur - (uint8_t *)bo->hostptr;
 }
 
 struct fd_ringmarker * fd_ringmarker_new(struct fd_ringbuffer *ring)
@@ -261,3 +425,87 @@ int fd_ringmarker_flush(struct fd_ringmarker *marker)
 {
 	return flush_impl(marker->ring, marker->cur);
 }
+
+int fd_ringmarker_queue(struct fd_ringmarker *start,
+		struct fd_ringmarker *end)
+{
+	struct fd_ringbuffer *ring = start->ring;
+	struct fd_pipe *pipe = ring->pipe;
+	uint32_t *cur = start->cur, *last;
+	struct fd_rb_bo *bo;
+
+	if ((end->ring != ring) || (pipe->id == FD_PIPE_2D)) {
+		ERROR_MSG("invalid ringmarker range");
+		return -EINVAL;
+	}
+
+	bo = ring_find_bo(ring, &cur);
+	last = (bo == ring->bo) ? ring->cur : bo->cur;
+	if ((end->cur < cur) || (end->cur > last)) {
+		ERROR_MSG("ringmarker range spans segments");
+		return -EINVAL;
+	}
+
+	if (pipe->nr_queued == pipe->max_queued) {
+		uint32_t max = pipe->max_queued ? pipe->max_queued * 2 : 16;
+		void *ptr;
+
+		ptr = realloc(pipe->queue, max * sizeof(*pipe->queue));
+		if (!ptr)
+			goto fail;
+		pipe->queue = ptr;
+
+		ptr = realloc(pipe->queue_ibs, max * sizeof(*pipe->queue_ibs));
+		if (!ptr)
+			goto fail;
+		pipe->queue_ibs = ptr;
+
+		pipe->max_queued = max;
+	}
+
+	pipe->queue[pipe->nr_queued] = (struct kgsl_ibdesc){
+			.gpuaddr     = bo->gpuaddr +
+					(uint8_t *)cur - (uint8_t *)bo->hostptr,
+			.hostptr     = cur,
+			.sizedwords  = end->cur - cur,
+	};
+	pipe->queue_ibs[pipe->nr_queued].ring = ring;
+	pipe->queue_ibs[pipe->nr_queued].bo = bo;
+	pipe->nr_queued++;
+
+	return 0;
+fail:
+	ERROR_MSG("allocation failed");
+	return -ENOMEM;
+}
+
+int fd_pipe_flush_queue(struct fd_pipe *pipe)
+{
+	uint32_t timestamp = 0, i;
+	int ret;
+
+	if (!pipe->nr_queued)
+		return 0;
+
+	ret = issue_ibs(pipe, pipe->queue, pipe->nr_queued, &timestamp);
+
+	for (i = 0; i < pipe->nr_queued; i++) {
+		struct fd_ringbuffer *ring = pipe->queue_ibs[i].ring;
+		uint32_t *start = pipe->queue[i].hostptr;
+		uint32_t *end = start + pipe->queue[i].sizedwords;
+		uint32_t *last = ring->last_start;
+
+		pipe->queue_ibs[i].bo->timestamp = timestamp;
+		ring->last_timestamp = timestamp;
+
+		/* don't let fd_ringbuffer_flush() submit the range again.
+		 * Contiguous ranges queued in ring order chain:
+		 */
+		if ((ring_find_bo(ring, &last) == pipe->queue_ibs[i].bo) &&
+				(start <= last) && (last < end))
+			ring->last_start = end;
+	}
+	pipe->nr_queued = 0;
+
+	return ret;
+}
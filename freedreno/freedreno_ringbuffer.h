@@ -46,6 +46,11 @@ struct fd_ringbuffer {
 	struct fd_pipe *pipe;
 	struct fd_rb_bo *bo;
 	uint32_t last_timestamp;
+	/* segments chained by fd_ringbuffer_grow() since the last reset,
+	 * starting with the one the ring was created with, and the ones
+	 * waiting to be recycled:
+	 */
+	struct fd_rb_bo *first_bo, *free_bos;
 };
 
 /* ringbuffer flush flags:
@@ -66,6 +71,19 @@ void fd_ringbuffer_reset(struct fd_ringbuffer *ring);
 int fd_ringbuffer_flush(struct fd_ringbuffer *ring);
 uint32_t fd_ringbuffer_timestamp(struct fd_ringbuffer *ring);
 
+/* continue the ring in a new segment with room for at least ndwords,
+ * when (ring->cur + ndwords > ring->end).  The segments are submitted
+ * together by the next flush.  Only the 3d pipe can chain segments,
+ * this fails on the 2d pipe, and a ringmarker range must not span
+ * a grow.
+ *
+ * The ring never grows by itself: fd_ringbuffer_emit() doesn't check
+ * for space, as a packet can't be split between two segments.  Callers
+ * need to check for room for each whole packet before emitting it, and
+ * grow the ring if there isn't.
+ */
+int fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords);
+
 static inline void fd_ringbuffer_emit(struct fd_ringbuffer *ring,
 		uint32_t data)
 {
@@ -86,4 +104,18 @@ uint32_t fd_ringmarker_dwords(struct fd_ringmarker *start,
 		struct fd_ringmarker *end);
 int fd_ringmarker_flush(struct fd_ringmarker *marker);
 
+/* queue the cmds between two markers of a ring, to be submitted along
+ * with all other ranges queued on the pipe, from any of its rings, as
+ * one IB list by fd_pipe_flush_queue().  The rings must not be reset
+ * or deleted before the queue is flushed.  Not supported on the 2d
+ * pipe.
+ *
+ * A flushed range that covers the point the ring was last flushed up
+ * to moves that point to its end, so a later fd_ringbuffer_flush()
+ * only submits what was written after it.  Cmds before a queued range
+ * that were never flushed are still submitted by the next flush.
+ */
+int fd_ringmarker_queue(struct fd_ringmarker *start,
+		struct fd_ringmarker *end);
+
 #endif /* FREEDRENO_RINGBUFFER_H_ */
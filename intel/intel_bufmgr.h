@@ -99,6 +99,86 @@ typedef struct _drm_intel_aub_annotation {
 	uint32_t ending_offset;
 } drm_intel_aub_annotation;
 
+enum drm_intel_decode_packet_type {
+	DRM_INTEL_PACKET_MI,
+	DRM_INTEL_PACKET_2D,
+	DRM_INTEL_PACKET_3D,
+	DRM_INTEL_PACKET_UNKNOWN,
+};
+
+/** A batchbuffer packet, as returned by drm_intel_decode_iter_next(). */
+struct drm_intel_decode_packet {
+	/** One of DRM_INTEL_PACKET_* */
+	int type;
+	/**
+	 * Opcode bits of the header: 28:23 for MI, 28:22 for 2D, 31:16 for
+	 * gen4+ 3D and 28:24 for older 3D packets.
+	 */
+	uint32_t opcode;
+	/** Name of the packet on this generation, or NULL if unknown. */
+	const char *name;
+	const uint32_t *data;
+	/** GPU address of the packet. */
+	uint32_t hw_offset;
+	/** Length in dwords, limited to the end of the batch. */
+	uint32_t len;
+	/** Set if the header claims more dwords than the batch has left. */
+	int truncated;
+};
+
+/** Iterator state, to be kept by the caller. */
+struct drm_intel_decode_iter {
+	struct drm_intel_decode *ctx;
+	const uint32_t *data;
+	uint32_t hw_offset;
+	uint32_t count;
+	int done;
+};
+
+typedef void (*drm_intel_decode_field_func)(void *closure,
+					    unsigned int index,
+					    uint32_t dword,
+					    const char *text);
+
+/**
+ * Totals gathered by drm_intel_decode() in summary mode, accumulated since
+ * drm_intel_decode_set_summary() or drm_intel_decode_reset_summary().
+ */
+struct drm_intel_decode_summary {
+	uint64_t batches;
+	uint64_t packets;
+	uint64_t dwords;
+	/** 3DPRIMITIVE packets, or PRIM3D before gen4. */
+	uint64_t primitive_packets;
+	uint64_t primitive_dwords;
+	/** 3D packets other than primitives and PIPE_CONTROL. */
+	uint64_t state_packets;
+	uint64_t state_dwords;
+	/**
+	 * State packets identical to the last packet with the same opcode
+	 * earlier in the same batch.
+	 */
+	uint64_t redundant_packets;
+	uint64_t redundant_dwords;
+};
+
+/**
+ * Eviction and upload counters of the fake bufmgr, accumulated since
+ * drm_intel_bufmgr_fake_init().
+ */
+typedef struct _drm_intel_bufmgr_fake_stats {
+	/** Buffers evicted from the aperture to make room for others. */
+	uint64_t evictions;
+	uint64_t evicted_bytes;
+	/** Buffers copied from backing store into the aperture. */
+	uint64_t uploads;
+	uint64_t upload_bytes;
+	/** Card-dirty contents copied back to backing store on eviction. */
+	uint64_t readback_bytes;
+	/** Waits for fences, including the idle waits before uploads. */
+	uint64_t fence_waits;
+} drm_intel_bufmgr_fake_stats;
+
 #define BO_ALLOC_FOR_RENDER (1<<0)
 
 drm_intel_bo *drm_intel_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
@@ -180,6 +260,8 @@ void
 drm_intel_bufmgr_gem_set_aub_annotations(drm_intel_bo *bo,
 					 drm_intel_aub_annotation *annotations,
 					 unsigned count);
+void drm_intel_bufmgr_gem_set_decode_context(drm_intel_bufmgr *bufmgr,
+					     struct drm_intel_decode *ctx);
 
 int drm_intel_get_pipe_from_crtc_id(drm_intel_bufmgr *bufmgr, int crtc_id);
 
@@ -228,6 +310,9 @@ void drm_intel_bo_fake_disable_backing_store(drm_intel_bo *bo,
 
 void drm_intel_bufmgr_fake_contended_lock_take(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr);
+void drm_intel_bufmgr_fake_get_stats(drm_intel_bufmgr *bufmgr,
+				     drm_intel_bufmgr_fake_stats *stats);
+uint64_t drm_intel_bo_fake_get_upload_bytes(drm_intel_bo *bo);
 
 struct drm_intel_decode *drm_intel_decode_context_alloc(uint32_t devid);
 void drm_intel_decode_context_free(struct drm_intel_decode *ctx);
@@ -240,6 +325,20 @@ void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
 void drm_intel_decode(struct drm_intel_decode *ctx);
+void drm_intel_decode_iter_init(struct drm_intel_decode *ctx,
+				struct drm_intel_decode_iter *iter);
+int drm_intel_decode_iter_next(struct drm_intel_decode_iter *iter,
+			       struct drm_intel_decode_packet *packet);
+void drm_intel_decode_packet_fields(struct drm_intel_decode *ctx,
+				    const struct drm_intel_decode_packet *packet,
+				    drm_intel_decode_field_func func,
+				    void *closure);
+void drm_intel_decode_set_summary(struct drm_intel_decode *ctx, int summary);
+void drm_intel_decode_reset_summary(struct drm_intel_decode *ctx);
+void drm_intel_decode_get_summary(struct drm_intel_decode *ctx,
+				  struct drm_intel_decode_summary *summary);
+void drm_intel_decode_print_summary(struct drm_intel_decode *ctx,
+				    int max_opcodes);
 
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
 		       uint32_t offset,
@@ -184,6 +184,9 @@ typedef struct _bufmgr_fake {
 	int debug;
 
 	int performed_rendering;
+
+	/** Eviction and upload counters, see drm_intel_bufmgr_fake_get_stats */
+	drm_intel_bufmgr_fake_stats stats;
 } drm_intel_bufmgr_fake;
 
 typedef struct _drm_intel_bo_fake {
@@ -226,6 +229,9 @@ typedef struct _drm_intel_bo_fake {
 	void *backing_store;
 	void (*invalidate_cb) (drm_intel_bo *bo, void *ptr);
 	void *invalidate_ptr;
+
+	/** Total bytes uploaded from backing store for this buffer */
+	uint64_t upload_bytes;
 } drm_intel_bo_fake;
 
 static int clear_fenced(drm_intel_bufmgr_fake *bufmgr_fake,
@@ -293,6 +299,8 @@ _fence_wait_internal(drm_intel_bufmgr_fake *bufmgr_fake, int seq)
 	int ret;
 	int kernel_lied;
 
+	bufmgr_fake->stats.fence_waits++;
+
 	if (bufmgr_fake->fence_wait != NULL) {
 		bufmgr_fake->fence_wait(seq, bufmgr_fake->fence_priv);
 		clear_fenced(bufmgr_fake, seq);
@@ -479,6 +487,7 @@ free_block(drm_intel_bufmgr_fake *bufmgr_fake, struct block *block,
 		memcpy(bo_fake->backing_store, block->virtual, block->bo->size);
 		bo_fake->card_dirty = 0;
 		bo_fake->dirty = 1;
+		bufmgr_fake->stats.readback_bytes += block->bo->size;
 	}
 
 	if (block->on_hardware) {
@@ -539,31 +548,85 @@ set_dirty(drm_intel_bo *bo)
 	bo_fake->dirty = 1;
 }
 
+/* Number of blocks at the cold end of the LRU considered for eviction. */
+#define EVICT_WINDOW 8
+
+static void
+evict_block(drm_intel_bufmgr_fake *bufmgr_fake, struct block *block)
+{
+	drm_intel_bo_fake *bo_fake = (drm_intel_bo_fake *) block->bo;
+
+	bufmgr_fake->stats.evictions++;
+	bufmgr_fake->stats.evicted_bytes += block->mem->size;
+
+	set_dirty(&bo_fake->bo);
+	bo_fake->block = NULL;
+
+	free_block(bufmgr_fake, block, 0);
+}
+
+/**
+ * Returns the number of bytes that have to be copied if the block is
+ * evicted: the buffer gets uploaded again the next time it is validated,
+ * and contents the card wrote to have to be copied back first.
+ */
+static unsigned int
+evict_cost(struct block *block)
+{
+	drm_intel_bo_fake *bo_fake = (drm_intel_bo_fake *) block->bo;
+	unsigned int cost = block->bo->size;
+
+	if (bo_fake->card_dirty &&
+	    !(bo_fake->flags & (BM_PINNED | BM_NO_BACKING_STORE)))
+		cost += block->bo->size;
+
+	return cost;
+}
+
+/**
+ * Evicts one block for an allocation of size bytes.
+ *
+ * Plain LRU eviction throws out the oldest buffer even if it is a tiny one
+ * that doesn't help, or a render target that has to be copied back.
+ * Instead, look at the EVICT_WINDOW least recently used blocks, and evict
+ * the cheapest one (see evict_cost()) that frees enough space on its own,
+ * or the cheapest one if none does.  Blocks with pending fences are never
+ * on the LRU list, so they are only reclaimed by waiting in
+ * evict_and_alloc_block().
+ */
 static int
-evict_lru(drm_intel_bufmgr_fake *bufmgr_fake, unsigned int max_fence)
+evict_cheapest(drm_intel_bufmgr_fake *bufmgr_fake, unsigned int size)
 {
-	struct block *block, *tmp;
+	struct block *block, *best = NULL;
+	unsigned int cost, best_cost = 0;
+	int fits, best_fits = 0, n = 0;
 
 	DBG("%s\n", __FUNCTION__);
 
-	DRMLISTFOREACHSAFE(block, tmp, &bufmgr_fake->lru) {
+	DRMLISTFOREACH(block, &bufmgr_fake->lru) {
 		drm_intel_bo_fake *bo_fake = (drm_intel_bo_fake *) block->bo;
 
 		if (bo_fake != NULL && (bo_fake->flags & BM_NO_FENCE_SUBDATA))
 			continue;
 
-		if (block->fence && max_fence && !FENCE_LTE(block->fence,
-							    max_fence))
-			return 0;
-
-		set_dirty(&bo_fake->bo);
-		bo_fake->block = NULL;
+		fits = (unsigned int)block->mem->size >= size;
+		cost = evict_cost(block);
+		if (best == NULL || fits > best_fits ||
+		    (fits == best_fits && cost < best_cost)) {
+			best = block;
+			best_fits = fits;
+			best_cost = cost;
+		}
 
-		free_block(bufmgr_fake, block, 0);
-		return 1;
+		if (++n == EVICT_WINDOW)
+			break;
 	}
 
-	return 0;
+	if (best == NULL)
+		return 0;
+
+	evict_block(bufmgr_fake, best);
+	return 1;
 }
 
 static int
@@ -579,10 +642,7 @@ evict_mru(drm_intel_bufmgr_fake *bufmgr_fake)
 		if (bo_fake && (bo_fake->flags & BM_NO_FENCE_SUBDATA))
 			continue;
 
-		set_dirty(&bo_fake->bo);
-		bo_fake->block = NULL;
-
-		free_block(bufmgr_fake, block, 0);
+		evict_block(bufmgr_fake, block);
 		return 1;
 	}
 
@@ -675,7 +735,7 @@ evict_and_alloc_block(drm_intel_bo *bo)
 	 * recently used textures.  We'll probably be thrashing soon:
 	 */
 	if (!bufmgr_fake->thrashing) {
-		while (evict_lru(bufmgr_fake, 0))
+		while (evict_cheapest(bufmgr_fake, bo->size))
 			if (alloc_block(bo))
 				return 1;
 	}
@@ -1218,6 +1278,9 @@ static int
 			memset(bo_fake->block->virtual, 0, bo->size);
 
 		bo_fake->dirty = 0;
+		bo_fake->upload_bytes += bo->size;
+		bufmgr_fake->stats.uploads++;
+		bufmgr_fake->stats.upload_bytes += bo->size;
 	}
 
 	bo_fake->block->fenced = 0;
@@ -1573,6 +1636,38 @@ void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr)
 	pthread_mutex_unlock(&bufmgr_fake->lock);
 }
 
+/**
+ * Returns the eviction and upload counters of the bufmgr, so that callers
+ * can measure how much aperture traffic a workload causes.
+ */
+void drm_intel_bufmgr_fake_get_stats(drm_intel_bufmgr *bufmgr,
+				     drm_intel_bufmgr_fake_stats *stats)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake = (drm_intel_bufmgr_fake *) bufmgr;
+
+	pthread_mutex_lock(&bufmgr_fake->lock);
+	*stats = bufmgr_fake->stats;
+	pthread_mutex_unlock(&bufmgr_fake->lock);
+}
+
+/**
+ * Returns the number of bytes uploaded from backing store for the buffer
+ * since it was allocated.
+ */
+uint64_t drm_intel_bo_fake_get_upload_bytes(drm_intel_bo *bo)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake =
+	    (drm_intel_bufmgr_fake *) bo->bufmgr;
+	drm_intel_bo_fake *bo_fake = (drm_intel_bo_fake *) bo;
+	uint64_t bytes;
+
+	pthread_mutex_lock(&bufmgr_fake->lock);
+	bytes = bo_fake->upload_bytes;
+	pthread_mutex_unlock(&bufmgr_fake->lock);
+
+	return bytes;
+}
+
 void drm_intel_bufmgr_fake_set_last_dispatch(drm_intel_bufmgr *bufmgr,
 					     volatile unsigned int
 					     *last_dispatch)
@@ -1606,7 +1701,7 @@ drm_intel_bufmgr *drm_intel_bufmgr_fake_init(int fd,
 	bufmgr_fake->low_offset = low_offset;
 	bufmgr_fake->virtual = low_virtual;
 	bufmgr_fake->size = size;
-	bufmgr_fake->heap = mmInit(low_offset, size);
+	bufmgr_fake->heap = mmInitMode(low_offset, size, MM_SEGREGATED_FIT);
 
 	/* Hook in methods */
 	bufmgr_fake->bufmgr.bo_alloc = drm_intel_fake_bo_alloc;
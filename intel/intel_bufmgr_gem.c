@@ -130,6 +130,8 @@ typedef struct _drm_intel_bufmgr_gem {
 
 	FILE *aub_file;
 	uint32_t aub_offset;
+
+	struct drm_intel_decode *decode_ctx;
 } drm_intel_bufmgr_gem;
 
 #define DRM_INTEL_RELOC_FENCE (1<<0)
@@ -2126,6 +2128,35 @@ aub_exec(drm_intel_bo *bo, int ring_flag, int used)
 	bufmgr_gem->aub_offset = 0x10000;
 }
 
+/**
+ * Passes the batch to the decoder set with
+ * drm_intel_bufmgr_gem_set_decode_context(), if any.
+ */
+static void
+decode_exec(drm_intel_bo *bo, int used)
+{
+	/* Called with bufmgr_gem->lock held, which serializes the execs of
+	 * all the contexts sharing the bufmgr, and so the uses of decode_ctx.
+	 */
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	void *data;
+
+	if (!bufmgr_gem->decode_ctx)
+		return;
+
+	data = malloc(used);
+	if (!data)
+		return;
+
+	if (drm_intel_bo_get_subdata(bo, 0, used, data) == 0) {
+		drm_intel_decode_set_batch_pointer(bufmgr_gem->decode_ctx, data,
+						   bo->offset, used / 4);
+		drm_intel_decode(bufmgr_gem->decode_ctx);
+	}
+
+	free(data);
+}
+
 static int
 drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		      drm_clip_rect_t * cliprects, int num_cliprects, int DR4)
@@ -2157,6 +2188,8 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 	execbuf.DR1 = 0;
 	execbuf.DR4 = DR4;
 
+	decode_exec(bo, used);
+
 	ret = drmIoctl(bufmgr_gem->fd,
 		       DRM_IOCTL_I915_GEM_EXECBUFFER,
 		       &execbuf);
@@ -2249,6 +2282,7 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	execbuf.rsvd2 = 0;
 
 	aub_exec(bo, flags, used);
+	decode_exec(bo, used);
 
 	if (bufmgr_gem->no_exec)
 		goto skip_execution;
@@ -2824,17 +2858,30 @@ drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
+static int
+drm_intel_gem_get_param(int fd, uint64_t param, uint64_t *value)
+{
+	drm_i915_getparam_t gp;
+	int tmp = 0;
+
+	VG_CLEAR(gp);
+	gp.param = param;
+	gp.value = &tmp;
+	if (drmIoctl(fd, DRM_IOCTL_I915_GETPARAM, &gp))
+		return -errno;
+
+	*value = tmp;
+	return 0;
+}
+
 /**
  * Get the PCI ID for the device.  This can be overridden by setting the
  * INTEL_DEVID_OVERRIDE environment variable to the desired ID.
  */
 static int
-get_pci_device_id(drm_intel_bufmgr_gem *bufmgr_gem)
+get_pci_device_id(drm_intel_bufmgr_gem *bufmgr_gem, const drmParam *gp)
 {
 	char *devid_override;
-	int devid;
-	int ret;
-	drm_i915_getparam_t gp;
 
 	if (geteuid() == getuid()) {
 		devid_override = getenv("INTEL_DEVID_OVERRIDE");
@@ -2844,16 +2891,12 @@ get_pci_device_id(drm_intel_bufmgr_gem *bufmgr_gem)
 		}
 	}
 
-	VG_CLEAR(devid);
-	VG_CLEAR(gp);
-	gp.param = I915_PARAM_CHIPSET_ID;
-	gp.value = &devid;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	if (ret) {
-		fprintf(stderr, "get chip id failed: %d [%d]\n", ret, errno);
-		fprintf(stderr, "param: %d, val: %d\n", gp.param, *gp.value);
+	if (gp->ret) {
+		fprintf(stderr, "get chip id failed: %d\n", gp->ret);
+		fprintf(stderr, "param: %d, val: %d\n", (int)gp->param,
+			(int)gp->value);
 	}
-	return devid;
+	return gp->value;
 }
 
 int
@@ -3026,6 +3069,32 @@ drm_intel_bufmgr_gem_set_aub_annotations(drm_intel_bo *bo,
 	bo_gem->aub_annotation_count = count;
 }
 
+/**
+ * Sets a decode context that every batch is run through before it is
+ * submitted, or NULL to stop.
+ *
+ * The context stays owned by the caller, which chooses how it decodes:
+ * put it in summary mode with drm_intel_decode_set_summary() to gather
+ * packet statistics over a run of the application, or leave it printing
+ * each batch to its output file.
+ *
+ * Batches are decoded under the bufmgr lock, so execs from several threads
+ * sharing the bufmgr are fine.  The context itself isn't locked though: it
+ * must not be set on another bufmgr as well, and the caller must only use
+ * it again after setting NULL here.
+ */
+void
+drm_intel_bufmgr_gem_set_decode_context(drm_intel_bufmgr *bufmgr,
+					struct drm_intel_decode *ctx)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+
+	/* Once this returns, no exec is still decoding with the old one. */
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->decode_ctx = ctx;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
 /**
  * Initializes the GEM buffer manager, which uses the kernel to allocate, map,
  * and manage map buffer objections.
@@ -3037,8 +3106,19 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem;
 	struct drm_i915_gem_get_aperture aperture;
-	drm_i915_getparam_t gp;
-	int ret, tmp;
+	enum {
+		PARAM_CHIPSET_ID,
+		PARAM_HAS_EXECBUF2,
+		PARAM_HAS_BSD,
+		PARAM_HAS_BLT,
+		PARAM_HAS_RELAXED_FENCING,
+		PARAM_HAS_WAIT_TIMEOUT,
+		PARAM_HAS_LLC,
+		PARAM_HAS_VEBOX,
+		PARAM_COUNT
+	};
+	drmParam gp[PARAM_COUNT];
+	int ret;
 	bool exec2 = false;
 
 	bufmgr_gem = calloc(1, sizeof(*bufmgr_gem));
@@ -3068,7 +3148,23 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 			(int)bufmgr_gem->gtt_size / 1024);
 	}
 
-	bufmgr_gem->pci_device = get_pci_device_id(bufmgr_gem);
+	/* Query everything we need up front in a single batch; if the fd
+	 * has cached device information (see drmGetFdInfo()) the results
+	 * are kept there for any other bufmgr created on it.
+	 */
+	gp[PARAM_CHIPSET_ID].param = I915_PARAM_CHIPSET_ID;
+	gp[PARAM_HAS_EXECBUF2].param = I915_PARAM_HAS_EXECBUF2;
+	gp[PARAM_HAS_BSD].param = I915_PARAM_HAS_BSD;
+	gp[PARAM_HAS_BLT].param = I915_PARAM_HAS_BLT;
+	gp[PARAM_HAS_RELAXED_FENCING].param = I915_PARAM_HAS_RELAXED_FENCING;
+	gp[PARAM_HAS_WAIT_TIMEOUT].param = I915_PARAM_HAS_WAIT_TIMEOUT;
+	gp[PARAM_HAS_LLC].param = I915_PARAM_HAS_LLC;
+	gp[PARAM_HAS_VEBOX].param = I915_PARAM_HAS_VEBOX;
+	drmGetParams(bufmgr_gem->fd, DRM_I915_GETPARAM,
+		     drm_intel_gem_get_param, gp, PARAM_COUNT);
+
+	bufmgr_gem->pci_device =
+		get_pci_device_id(bufmgr_gem, &gp[PARAM_CHIPSET_ID]);
 
 	if (IS_GEN2(bufmgr_gem->pci_device))
 		bufmgr_gem->gen = 2;
@@ -3096,54 +3192,39 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 		bufmgr_gem->gtt_size -= 256*1024*1024;
 	}
 
-	VG_CLEAR(gp);
-	gp.value = &tmp;
-
-	gp.param = I915_PARAM_HAS_EXECBUF2;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	if (!ret)
+	if (gp[PARAM_HAS_EXECBUF2].ret == 0)
 		exec2 = true;
 
-	gp.param = I915_PARAM_HAS_BSD;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	bufmgr_gem->has_bsd = ret == 0;
-
-	gp.param = I915_PARAM_HAS_BLT;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	bufmgr_gem->has_blt = ret == 0;
-
-	gp.param = I915_PARAM_HAS_RELAXED_FENCING;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	bufmgr_gem->has_relaxed_fencing = ret == 0;
+	bufmgr_gem->has_bsd = gp[PARAM_HAS_BSD].ret == 0;
+	bufmgr_gem->has_blt = gp[PARAM_HAS_BLT].ret == 0;
+	bufmgr_gem->has_relaxed_fencing =
+		gp[PARAM_HAS_RELAXED_FENCING].ret == 0;
+	bufmgr_gem->has_wait_timeout = gp[PARAM_HAS_WAIT_TIMEOUT].ret == 0;
 
-	gp.param = I915_PARAM_HAS_WAIT_TIMEOUT;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	bufmgr_gem->has_wait_timeout = ret == 0;
-
-	gp.param = I915_PARAM_HAS_LLC;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	if (ret != 0) {
+	if (gp[PARAM_HAS_LLC].ret != 0) {
 		/* Kernel does not supports HAS_LLC query, fallback to GPU
 		 * generation detection and assume that we have LLC on GEN6/7
 		 */
 		bufmgr_gem->has_llc = (IS_GEN6(bufmgr_gem->pci_device) |
 				IS_GEN7(bufmgr_gem->pci_device));
 	} else
-		bufmgr_gem->has_llc = *gp.value;
+		bufmgr_gem->has_llc = gp[PARAM_HAS_LLC].value;
 
-	gp.param = I915_PARAM_HAS_VEBOX;
-	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
-	bufmgr_gem->has_vebox = (ret == 0) & (*gp.value > 0);
+	bufmgr_gem->has_vebox = (gp[PARAM_HAS_VEBOX].ret == 0) &
+		((int)gp[PARAM_HAS_VEBOX].value > 0);
 
 	if (bufmgr_gem->gen < 4) {
-		gp.param = I915_PARAM_NUM_FENCES_AVAIL;
-		gp.value = &bufmgr_gem->available_fences;
-		ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+		drmParam fences = { I915_PARAM_NUM_FENCES_AVAIL };
+
+		drmGetParams(bufmgr_gem->fd, DRM_I915_GETPARAM,
+			     drm_intel_gem_get_param, &fences, 1);
+		ret = fences.ret;
+		bufmgr_gem->available_fences = fences.value;
 		if (ret) {
-			fprintf(stderr, "get fences failed: %d [%d]\n", ret,
-				errno);
-			fprintf(stderr, "param: %d, val: %d\n", gp.param,
-				*gp.value);
+			fprintf(stderr, "get fences failed: %d\n", ret);
+			fprintf(stderr, "param: %d, val: %d\n",
+				(int)fences.param,
+				bufmgr_gem->available_fences);
 			bufmgr_gem->available_fences = 0;
 		} else {
 			/* XXX The kernel reports the total number of fences,
@@ -75,24 +75,197 @@ struct drm_intel_decode {
 	bool dump_past_end;
 
 	bool overflowed;
+
+	/** @{
+	 * i915 vertex format state from the last 3DSTATE_LOAD_STATE_IMMEDIATE_1,
+	 * used to decode inline vertices in 3DPRIMITIVE.
+	 */
+	uint32_t saved_s2, saved_s4;
+	bool saved_s2_set, saved_s4_set;
+	/** @} */
+
+	/**
+	 * Output buffer, written to out when full and at the end of each
+	 * drm_intel_decode() call rather than after every packet.
+	 */
+	char *buf;
+	size_t buf_size, buf_len;
+
+	/**
+	 * Receives the output of instr_out() instead of the buffer while
+	 * drm_intel_decode_packet_fields() runs.
+	 */
+	drm_intel_decode_field_func field_func;
+	void *field_closure;
+
+	/** @{
+	 * Opcode dispatch tables for this generation, indexed by the opcode
+	 * bits of the packet header.  They hold the index of the entry in
+	 * opcodes_mi, opcodes_2d or opcodes_3d_965 plus one, or 0 for
+	 * unknown opcodes.
+	 */
+	uint8_t dispatch_mi[64];
+	uint8_t dispatch_2d[128];
+	uint8_t dispatch_3d_965[8192];
+	/** @} */
+
+	/** Discards all output, while counting packets in summary mode. */
+	bool quiet;
+
+	/** @{
+	 * Summary mode: drm_intel_decode() counts packets into an open
+	 * addressed hash of per-opcode counters instead of printing them.
+	 */
+	bool summary;
+	struct drm_intel_decode_summary totals;
+	struct decode_opcode_stats *stats;
+	unsigned int stats_size, stats_count;
+	/** @} */
 };
 
-static FILE *out;
-static uint32_t saved_s2 = 0, saved_s4 = 0;
-static char saved_s2_set = 0, saved_s4_set = 0;
-static uint32_t head_offset = 0xffffffff;	/* undefined */
-static uint32_t tail_offset = 0xffffffff;	/* undefined */
+/** Per-opcode counters for summary mode. */
+struct decode_opcode_stats {
+	/** Packet type << 16 | opcode, or ~0 for an empty hash slot. */
+	uint32_t key;
+	const char *name;
+	/** Name for packets the tables don't know. */
+	char unknown_name[16];
+
+	uint64_t count;
+	uint64_t dwords;
+	uint64_t redundant;
+	uint64_t redundant_dwords;
+
+	/**
+	 * Copy of the last state packet with this opcode, valid if last_batch
+	 * is the number of the current batch.
+	 */
+	uint32_t *last;
+	uint32_t last_len, last_size;
+	uint64_t last_batch;
+};
+
+#define DECODE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * Packets are followed by a scratch page of 0xd0 bytes, which lets the
+ * decoders of statically sized packets skip length checks.
+ */
+#define DECODE_SCRATCH_SIZE 4096
+
+/**
+ * drm_intel_decode() reads the batch in place up to this many dwords from
+ * its end, which is far enough that nothing read for a packet before that
+ * can be past the end, and decodes the rest from a padded copy.
+ */
+#define DECODE_TAIL_DWORDS (2 * DECODE_SCRATCH_SIZE / 4)
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(A[0]))
 #endif
 
 #define BUFFER_FAIL(_count, _len, _name) do {			\
-    fprintf(out, "Buffer size too small in %s (%d < %d)\n",	\
+    decode_printf(ctx, "Buffer size too small in %s (%d < %d)\n",	\
 	    (_name), (_count), (_len));				\
     return _count;						\
 } while (0)
 
+static void
+decode_flush(struct drm_intel_decode *ctx)
+{
+	if (ctx->buf_len == 0)
+		return;
+
+	fwrite(ctx->buf, 1, ctx->buf_len, ctx->out);
+	ctx->buf_len = 0;
+}
+
+static void
+decode_vprintf(struct drm_intel_decode *ctx, const char *fmt, va_list va)
+	__attribute__((format(__printf__, 2, 0)));
+
+static void
+decode_vprintf(struct drm_intel_decode *ctx, const char *fmt, va_list va)
+{
+	va_list va_retry;
+	int len;
+
+	/* Only the per-dword output goes to the field callback. */
+	if (ctx->field_func || ctx->quiet)
+		return;
+
+	va_copy(va_retry, va);
+	len = vsnprintf(ctx->buf + ctx->buf_len, ctx->buf_size - ctx->buf_len,
+			fmt, va);
+	if (len >= 0 && ctx->buf_len + len >= ctx->buf_size) {
+		decode_flush(ctx);
+
+		if ((size_t)len < ctx->buf_size) {
+			len = vsnprintf(ctx->buf, ctx->buf_size, fmt,
+					va_retry);
+		} else {
+			/* Too long for the buffer, which is empty now. */
+			vfprintf(ctx->out, fmt, va_retry);
+			len = -1;
+		}
+	}
+	va_end(va_retry);
+
+	if (len > 0)
+		ctx->buf_len += len;
+}
+
+static void
+decode_printf(struct drm_intel_decode *ctx, const char *fmt, ...)
+	__attribute__((format(__printf__, 2, 3)));
+
+static void
+decode_printf(struct drm_intel_decode *ctx, const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	decode_vprintf(ctx, fmt, va);
+	va_end(va);
+}
+
+/* Opcode table entry, shared by the decoder and the packet iterator. */
+struct opcode_info {
+	uint32_t opcode;
+	uint32_t len_mask;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+	/** Generation the entry applies to, or 0 for all of them. */
+	int gen;
+	int (*func)(struct drm_intel_decode *ctx);
+};
+
+/**
+ * Fills in a dispatch table from an opcode table, using the first entry for
+ * each opcode that applies to the generation.
+ */
+static void
+build_dispatch(uint8_t *dispatch, uint32_t mask,
+	       const struct opcode_info *table, unsigned int count, int gen)
+{
+	unsigned int i;
+
+	assert(count < 256);
+
+	for (i = 0; i < count; i++) {
+		/* If it's marked as not our gen, skip. */
+		if (table[i].gen && table[i].gen != gen)
+			continue;
+
+		if (!dispatch[table[i].opcode & mask])
+			dispatch[table[i].opcode & mask] = i + 1;
+	}
+}
+
+#define LOOKUP_OPCODE(dispatch, table, opcode)				\
+	((dispatch)[opcode] ? &(table)[(dispatch)[opcode] - 1] : NULL)
+
 static float int_as_float(uint32_t intval)
 {
 	union intfloat {
@@ -116,25 +289,44 @@ instr_out(struct drm_intel_decode *ctx, unsigned int index,
 	const char *parseinfo;
 	uint32_t offset = ctx->hw_offset + index * 4;
 
+	if (ctx->quiet)
+		return;
+
 	if (index > ctx->count) {
 		if (!ctx->overflowed) {
-			fprintf(out, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
+			decode_printf(ctx, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
 			ctx->overflowed = true;
 		}
 		return;
 	}
 
-	if (offset == head_offset)
+	if (ctx->field_func) {
+		char text[256];
+		size_t len;
+
+		va_start(va, fmt);
+		vsnprintf(text, sizeof(text), fmt, va);
+		va_end(va);
+
+		len = strlen(text);
+		if (len > 0 && text[len - 1] == '\n')
+			text[len - 1] = '\0';
+		ctx->field_func(ctx->field_closure, index, ctx->data[index],
+				text);
+		return;
+	}
+
+	if (offset == ctx->head)
 		parseinfo = "HEAD";
-	else if (offset == tail_offset)
+	else if (offset == ctx->tail)
 		parseinfo = "TAIL";
 	else
 		parseinfo = "    ";
 
-	fprintf(out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
-		ctx->data[index], index == 0 ? "" : "   ");
+	decode_printf(ctx, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
+		      ctx->data[index], index == 0 ? "" : "   ");
 	va_start(va, fmt);
-	vfprintf(out, fmt, va);
+	decode_vprintf(ctx, fmt, va);
 	va_end(va);
 }
 
@@ -222,70 +414,61 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+static const struct opcode_info opcodes_mi[] = {
+	{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
+	{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
+	{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
+	{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
+	{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
+	{ 0x04, 0, 1, 1, "MI_FLUSH" },
+	{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
+	{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
+	{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
+	{ 0x00, 0, 1, 1, "MI_NOOP" },
+	{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
+	{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
+	{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", 0, decode_MI_SET_CONTEXT },
+	{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
+	{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
+	{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
+	{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
+	{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", 0, decode_MI_WAIT_FOR_EVENT },
+	{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
+	{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
+	{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
+};
+
 static int
 decode_mi(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len = -1;
 	const char *post_sync_op = "";
 	uint32_t *data = ctx->data;
+	const struct opcode_info *opcode_mi = NULL;
 
-	struct {
-		uint32_t opcode;
-		int len_mask;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_mi[] = {
-		{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
-		{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
-		{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
-		{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
-		{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
-		{ 0x04, 0, 1, 1, "MI_FLUSH" },
-		{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
-		{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
-		{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
-		{ 0x00, 0, 1, 1, "MI_NOOP" },
-		{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
-		{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
-		{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
-		{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
-		{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
-		{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
-		{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
-		{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
-		{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
-		{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
-		{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
-	}, *opcode_mi = NULL;
+	opcode = (data[0] & 0x1f800000) >> 23;
+	opcode_mi = LOOKUP_OPCODE(ctx->dispatch_mi, opcodes_mi, opcode);
 
 	/* check instruction length */
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			len = 1;
-			if (opcodes_mi[opcode].max_len > 1) {
-				len =
-				    (data[0] & opcodes_mi[opcode].len_mask) + 2;
-				if (len < opcodes_mi[opcode].min_len
-				    || len > opcodes_mi[opcode].max_len) {
-					fprintf(out,
-						"Bad length (%d) in %s, [%d, %d]\n",
-						len, opcodes_mi[opcode].name,
-						opcodes_mi[opcode].min_len,
-						opcodes_mi[opcode].max_len);
-				}
+	if (opcode_mi) {
+		len = 1;
+		if (opcode_mi->max_len > 1) {
+			len = (data[0] & opcode_mi->len_mask) + 2;
+			if (len < opcode_mi->min_len ||
+			    len > opcode_mi->max_len) {
+				decode_printf(ctx,
+					"Bad length (%d) in %s, [%d, %d]\n",
+					len, opcode_mi->name,
+					opcode_mi->min_len,
+					opcode_mi->max_len);
 			}
-			opcode_mi = &opcodes_mi[opcode];
-			break;
 		}
 	}
 
 	if (opcode_mi && opcode_mi->func)
 		return opcode_mi->func(ctx);
 
-	switch ((data[0] & 0x1f800000) >> 23) {
+	switch (opcode) {
 	case 0x0a:
 		instr_out(ctx, 0, "MI_BATCH_BUFFER_END\n");
 		return -1;
@@ -351,19 +534,15 @@ decode_mi(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			unsigned int i;
-
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_mi[opcode].name);
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
+	if (opcode_mi) {
+		unsigned int i;
 
-			return len;
+		instr_out(ctx, 0, "%s\n", opcode_mi->name);
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "MI UNKNOWN\n");
@@ -414,46 +593,44 @@ decode_2d_br01(struct drm_intel_decode *ctx)
 
 }
 
+static const struct opcode_info opcodes_2d[] = {
+	{ 0x40, 0xff, 5, 5, "COLOR_BLT" },
+	{ 0x43, 0xff, 6, 6, "SRC_COPY_BLT" },
+	{ 0x01, 0xff, 8, 8, "XY_SETUP_BLT" },
+	{ 0x11, 0xff, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
+	{ 0x03, 0xff, 3, 3, "XY_SETUP_CLIP_BLT" },
+	{ 0x24, 0xff, 2, 2, "XY_PIXEL_BLT" },
+	{ 0x25, 0xff, 3, 3, "XY_SCANLINES_BLT" },
+	{ 0x26, 0xff, 4, 4, "Y_TEXT_BLT" },
+	{ 0x31, 0xff, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
+	{ 0x50, 0xff, 6, 6, "XY_COLOR_BLT" },
+	{ 0x51, 0xff, 6, 6, "XY_PAT_BLT" },
+	{ 0x76, 0xff, 8, 8, "XY_PAT_CHROMA_BLT" },
+	{ 0x72, 0xff, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
+	{ 0x77, 0xff, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
+	{ 0x52, 0xff, 9, 9, "XY_MONO_PAT_BLT" },
+	{ 0x59, 0xff, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
+	{ 0x53, 0xff, 8, 8, "XY_SRC_COPY_BLT" },
+	{ 0x54, 0xff, 8, 8, "XY_MONO_SRC_COPY_BLT" },
+	{ 0x71, 0xff, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
+	{ 0x55, 0xff, 9, 9, "XY_FULL_BLT" },
+	{ 0x55, 0xff, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
+	{ 0x56, 0xff, 9, 9, "XY_FULL_MONO_SRC_BLT" },
+	{ 0x75, 0xff, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
+	{ 0x57, 0xff, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
+	{ 0x58, 0xff, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
+};
+
 static int
 decode_2d(struct drm_intel_decode *ctx)
 {
 	unsigned int opcode, len;
 	uint32_t *data = ctx->data;
+	const struct opcode_info *opcode_2d;
 
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_2d[] = {
-		{ 0x40, 5, 5, "COLOR_BLT" },
-		{ 0x43, 6, 6, "SRC_COPY_BLT" },
-		{ 0x01, 8, 8, "XY_SETUP_BLT" },
-		{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
-		{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
-		{ 0x24, 2, 2, "XY_PIXEL_BLT" },
-		{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
-		{ 0x26, 4, 4, "Y_TEXT_BLT" },
-		{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
-		{ 0x50, 6, 6, "XY_COLOR_BLT" },
-		{ 0x51, 6, 6, "XY_PAT_BLT" },
-		{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
-		{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
-		{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
-		{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
-		{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
-		{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
-		{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
-		{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
-		{ 0x55, 9, 9, "XY_FULL_BLT" },
-		{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
-		{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
-		{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
-		{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
-		{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
-	};
-
-	switch ((data[0] & 0x1fc00000) >> 22) {
+	opcode = (data[0] & 0x1fc00000) >> 22;
+
+	switch (opcode) {
 	case 0x25:
 		instr_out(ctx, 0,
 			  "XY_SCANLINES_BLT (pattern seed (%d, %d), dst tile %d)\n",
@@ -462,7 +639,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SCANLINES_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SCANLINES_BLT\n");
 
 		instr_out(ctx, 1, "dest (%d,%d)\n",
 			  data[1] & 0xffff, data[1] >> 16);
@@ -474,7 +651,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SETUP_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SETUP_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "cliprect (%d,%d)\n",
@@ -492,7 +669,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SETUP_CLIP_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SETUP_CLIP_BLT\n");
 
 		instr_out(ctx, 1, "cliprect (%d,%d)\n",
 			  data[1] & 0xffff, data[2] >> 16);
@@ -504,7 +681,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 9)
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
 
 		decode_2d_br01(ctx);
@@ -524,7 +701,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 6)
-			fprintf(out, "Bad count in XY_COLOR_BLT\n");
+			decode_printf(ctx, "Bad count in XY_COLOR_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "(%d,%d)\n",
@@ -539,7 +716,7 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SRC_COPY_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SRC_COPY_BLT\n");
 
 		decode_2d_br01(ctx);
 		instr_out(ctx, 2, "dst (%d,%d)\n",
@@ -555,29 +732,26 @@ decode_2d(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_2d) / sizeof(opcodes_2d[0]);
-	     opcode++) {
-		if ((data[0] & 0x1fc00000) >> 22 == opcodes_2d[opcode].opcode) {
-			unsigned int i;
-
-			len = 1;
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_2d[opcode].name);
-			if (opcodes_2d[opcode].max_len > 1) {
-				len = (data[0] & 0x000000ff) + 2;
-				if (len < opcodes_2d[opcode].min_len ||
-				    len > opcodes_2d[opcode].max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcodes_2d[opcode].name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	opcode_2d = LOOKUP_OPCODE(ctx->dispatch_2d, opcodes_2d, opcode);
+	if (opcode_2d) {
+		unsigned int i;
+
+		len = 1;
+		instr_out(ctx, 0, "%s\n", opcode_2d->name);
+		if (opcode_2d->max_len > 1) {
+			len = (data[0] & 0x000000ff) + 2;
+			if (len < opcode_2d->min_len ||
+			    len > opcode_2d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					opcode_2d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
 	instr_out(ctx, 0, "2D UNKNOWN\n");
@@ -619,9 +793,10 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 /** Sets the string dstname to describe the destination of the PS instruction */
 static void
-i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
+i915_get_instruction_dst(struct drm_intel_decode *ctx, int i, char *dstname,
+			 int do_mask)
 {
-	uint32_t a0 = data[i];
+	uint32_t a0 = ctx->data[i];
 	int dst_nr = (a0 >> 14) & 0xf;
 	char dstmask[8];
 	const char *sat;
@@ -656,22 +831,22 @@ i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
 	switch ((a0 >> 19) & 0x7) {
 	case 0:
 		if (dst_nr > 15)
-			fprintf(out, "bad destination reg R%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg R%d\n", dst_nr);
 		sprintf(dstname, "R%d%s%s", dst_nr, dstmask, sat);
 		break;
 	case 4:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oC%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg oC%d\n", dst_nr);
 		sprintf(dstname, "oC%s%s", dstmask, sat);
 		break;
 	case 5:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oD%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg oD%d\n", dst_nr);
 		sprintf(dstname, "oD%s%s", dstmask, sat);
 		break;
 	case 6:
 		if (dst_nr > 3)
-			fprintf(out, "bad destination reg U%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg U%d\n", dst_nr);
 		sprintf(dstname, "U%d%s%s", dst_nr, dstmask, sat);
 		break;
 	default:
@@ -702,13 +877,14 @@ i915_get_channel_swizzle(uint32_t select)
 }
 
 static void
-i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_src_name(struct drm_intel_decode *ctx,
+			      uint32_t src_type, uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -720,41 +896,42 @@ i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			decode_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 2:
 		sprintf(name, "C%d", src_nr);
 		if (src_nr > 31)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	case 6:
 		sprintf(name, "U%d", src_nr);
 		if (src_nr > 3)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		decode_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
 }
 
-static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src0(struct drm_intel_decode *ctx,
+				      int i, char *srcname)
 {
-	uint32_t a0 = data[i];
-	uint32_t a1 = data[i + 1];
+	uint32_t a0 = ctx->data[i];
+	uint32_t a1 = ctx->data[i + 1];
 	int src_nr = (a0 >> 2) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a1 >> 28) & 0xf);
 	const char *swizzle_y = i915_get_channel_swizzle((a1 >> 24) & 0xf);
@@ -762,17 +939,18 @@ static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a1 >> 16) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a0 >> 7) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a0 >> 7) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src1(struct drm_intel_decode *ctx,
+				      int i, char *srcname)
 {
-	uint32_t a1 = data[i + 1];
-	uint32_t a2 = data[i + 2];
+	uint32_t a1 = ctx->data[i + 1];
+	uint32_t a2 = ctx->data[i + 2];
 	int src_nr = (a1 >> 8) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a1 >> 4) & 0xf);
 	const char *swizzle_y = i915_get_channel_swizzle((a1 >> 0) & 0xf);
@@ -780,16 +958,17 @@ static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 24) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a1 >> 13) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a1 >> 13) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src2(struct drm_intel_decode *ctx,
+				      int i, char *srcname)
 {
-	uint32_t a2 = data[i + 2];
+	uint32_t a2 = ctx->data[i + 2];
 	int src_nr = (a2 >> 16) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a2 >> 12) & 0xf);
 	const char *swizzle_y = i915_get_channel_swizzle((a2 >> 8) & 0xf);
@@ -797,7 +976,7 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 0) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a2 >> 21) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a2 >> 21) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
@@ -805,13 +984,14 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 }
 
 static void
-i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_addr(struct drm_intel_decode *ctx,
+			  uint32_t src_type, uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -823,22 +1003,22 @@ i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			decode_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		decode_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
@@ -850,8 +1030,8 @@ i915_decode_alu1(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
 
 	instr_out(ctx, i++, "%s: %s %s, %s\n", instr_prefix,
 		  op_name, dst, src0);
@@ -865,9 +1045,9 @@ i915_decode_alu2(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1);
@@ -881,10 +1061,10 @@ i915_decode_alu3(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100], src2[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
-	i915_get_instruction_src2(ctx->data, i, src2);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
+	i915_get_instruction_src2(ctx, i, src2);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1, src2);
@@ -902,8 +1082,8 @@ i915_decode_tex(struct drm_intel_decode *ctx, int i,
 	char addr_name[100];
 	int sampler_nr;
 
-	i915_get_instruction_dst(ctx->data, i, dst_name, 0);
-	i915_get_instruction_addr((t1 >> 24) & 0x7,
+	i915_get_instruction_dst(ctx, i, dst_name, 0);
+	i915_get_instruction_addr(ctx, (t1 >> 24) & 0x7,
 				  (t1 >> 17) & 0xf, addr_name);
 	sampler_nr = t0 & 0xf;
 
@@ -929,30 +1109,30 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 	case 1:
 		sprintf(dcl_mask, ".%s%s%s%s", dcl_x, dcl_y, dcl_z, dcl_w);
 		if (strcmp(dcl_mask, ".") == 0)
-			fprintf(out, "bad (empty) dcl mask\n");
+			decode_printf(ctx, "bad (empty) dcl mask\n");
 
 		if (dcl_nr > 10)
-			fprintf(out, "bad T%d dcl register number\n", dcl_nr);
+			decode_printf(ctx, "bad T%d dcl register number\n", dcl_nr);
 		if (dcl_nr < 8) {
 			if (strcmp(dcl_mask, ".x") != 0 &&
 			    strcmp(dcl_mask, ".xy") != 0 &&
 			    strcmp(dcl_mask, ".xz") != 0 &&
 			    strcmp(dcl_mask, ".w") != 0 &&
 			    strcmp(dcl_mask, ".xyzw") != 0) {
-				fprintf(out, "bad T%d.%s dcl mask\n", dcl_nr,
+				decode_printf(ctx, "bad T%d.%s dcl mask\n", dcl_nr,
 					dcl_mask);
 			}
 			instr_out(ctx, i++, "%s: DCL T%d%s\n",
 				  instr_prefix, dcl_nr, dcl_mask);
 		} else {
 			if (strcmp(dcl_mask, ".xz") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 			else if (strcmp(dcl_mask, ".xw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 			else if (strcmp(dcl_mask, ".xzw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
 					dcl_mask);
 
 			if (dcl_nr == 8) {
@@ -988,7 +1168,7 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 			break;
 		}
 		if (dcl_nr > 15)
-			fprintf(out, "bad S%d dcl register number\n", dcl_nr);
+			decode_printf(ctx, "bad S%d dcl register number\n", dcl_nr);
 		instr_out(ctx, i++, "%s: DCL S%d %s\n",
 			  instr_prefix, dcl_nr, sampletype);
 		instr_out(ctx, i++, "%s\n", instr_prefix);
@@ -1269,7 +1449,6 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 	const char *format, *zformat, *type;
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
-	uint32_t devid = ctx->devid;
 
 	struct {
 		uint32_t opcode;
@@ -1333,7 +1512,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			instr_out(ctx, i++, "PSC.1\n");
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
 			return len;
 		}
 		return len;
@@ -1345,16 +1524,16 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		for (word = 0; word <= 8; word++) {
 			if (data[0] & (1 << (4 + word))) {
 				/* save vertex state for decode */
-				if (!IS_GEN2(devid)) {
+				if (ctx->gen != 2) {
 					int tex_num;
 
 					if (word == 2) {
-						saved_s2_set = 1;
-						saved_s2 = data[i];
+						ctx->saved_s2_set = 1;
+						ctx->saved_s2 = data[i];
 					}
 					if (word == 4) {
-						saved_s4_set = 1;
-						saved_s4 = data[i];
+						ctx->saved_s4_set = 1;
+						ctx->saved_s4 = data[i];
 					}
 
 					switch (word) {
@@ -1383,43 +1562,43 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 								 tex_num *
 								 4) & 0xf) {
 							case 0:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=2D ",
 									tex_num);
 								break;
 							case 1:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=3D ",
 									tex_num);
 								break;
 							case 2:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=4D ",
 									tex_num);
 								break;
 							case 3:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=1D ",
 									tex_num);
 								break;
 							case 4:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=2D_16 ",
 									tex_num);
 								break;
 							case 5:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=4D_16 ",
 									tex_num);
 								break;
 							case 0xf:
-								fprintf(out,
+								decode_printf(ctx,
 									"%i=NP ",
 									tex_num);
 								break;
 							}
 						}
-						fprintf(out, "\n");
+						decode_printf(ctx, "\n");
 
 						break;
 					case 3:
@@ -1720,7 +1899,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		}
 		return len;
@@ -1770,7 +1949,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		}
 		return len;
@@ -1972,7 +2151,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_MAP_STATE\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_MAP_STATE\n");
 			return len;
 		}
 		return len;
@@ -1999,7 +2178,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		}
 		return len;
@@ -2007,7 +2186,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		instr_out(ctx, 0, "3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		len = (data[0] & 0x000000ff) + 2;
 		if ((len - 1) % 3 != 0 || len > 370) {
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		}
 		i = 1;
@@ -2021,7 +2200,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		}
 		return len;
 	case 0x01:
-		if (IS_GEN2(devid))
+		if (ctx->gen == 2)
 			break;
 		instr_out(ctx, 0, "3DSTATE_SAMPLER_STATE\n");
 		instr_out(ctx, 1, "mask\n");
@@ -2085,14 +2264,14 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_SAMPLER_STATE\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_SAMPLER_STATE\n");
 		}
 		return len;
 	case 0x85:
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 2)
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
 
 		instr_out(ctx, 0,
@@ -2162,7 +2341,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 			len = (data[0] & 0x0000000f) + 2;
 			if (len != 3)
-				fprintf(out,
+				decode_printf(ctx,
 					"Bad count in 3DSTATE_BUFFER_INFO\n");
 
 			switch ((data[1] >> 24) & 0x7) {
@@ -2195,7 +2374,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 3)
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
 
 		instr_out(ctx, 0, "3DSTATE_SCISSOR_RECTANGLE\n");
@@ -2209,7 +2388,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 5)
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
 
 		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
@@ -2227,7 +2406,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 7)
-			fprintf(out, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
 
 		instr_out(ctx, 0, "3DSTATE_CLEAR_PARAMETERS\n");
 		instr_out(ctx, 1, "prim_type=%s, clear=%s%s%s\n",
@@ -2246,7 +2425,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d_1d); idx++) {
 		opcode_3d_1d = &opcodes_3d_1d[idx];
-		if (opcode_3d_1d->i830_only && !IS_GEN2(devid))
+		if (opcode_3d_1d->i830_only && ctx->gen != 2)
 			continue;
 
 		if (((data[0] & 0x00ff0000) >> 16) == opcode_3d_1d->opcode) {
@@ -2258,7 +2437,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 				len = (data[0] & 0x0000ffff) + 2;
 				if (len < opcode_3d_1d->min_len ||
 				    len > opcode_3d_1d->max_len) {
-					fprintf(out, "Bad count in %s\n",
+					decode_printf(ctx, "Bad count in %s\n",
 						opcode_3d_1d->name);
 				}
 			}
@@ -2284,8 +2463,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	char immediate = (data[0] & (1 << 23)) == 0;
 	unsigned int len, i, j, ret;
 	const char *primtype;
-	int original_s2 = saved_s2;
-	int original_s4 = saved_s4;
+	int original_s2 = ctx->saved_s2;
+	int original_s4 = ctx->saved_s4;
 
 	switch ((data[0] >> 18) & 0xf) {
 	case 0x0:
@@ -2320,8 +2499,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 		break;
 	case 0xa:
 		primtype = "CLEAR_RECT";
-		saved_s4 = 3 << 6;
-		saved_s2 = ~0;
+		ctx->saved_s4 = 3 << 6;
+		ctx->saved_s2 = ~0;
 		break;
 	default:
 		primtype = "unknown";
@@ -2335,8 +2514,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 			  primtype);
 		if (count < len)
 			BUFFER_FAIL(count, len, "3DPRIMITIVE inline");
-		if (!saved_s2_set || !saved_s4_set) {
-			fprintf(out, "unknown vertex format\n");
+		if (!ctx->saved_s2_set || !ctx->saved_s4_set) {
+			decode_printf(ctx, "unknown vertex format\n");
 			for (i = 1; i < len; i++) {
 				instr_out(ctx, i,
 					  "           vertex data (%f float)\n",
@@ -2351,13 +2530,13 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
     if (i < len)							\
 	instr_out(ctx, i, " V%d."fmt"\n", vertex, __VA_ARGS__); \
     else								\
-	fprintf(out, " missing data in V%d\n", vertex);			\
+	decode_printf(ctx, " missing data in V%d\n", vertex);			\
     i++;								\
 } while (0)
 
 				VERTEX_OUT("X = %f", int_as_float(data[i]));
 				VERTEX_OUT("Y = %f", int_as_float(data[i]));
-				switch (saved_s4 >> 6 & 0x7) {
+				switch (ctx->saved_s4 >> 6 & 0x7) {
 				case 0x1:
 					VERTEX_OUT("Z = %f",
 						   int_as_float(data[i]));
@@ -2375,10 +2554,10 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 						   int_as_float(data[i]));
 					break;
 				default:
-					fprintf(out, "bad S4 position mask\n");
+					decode_printf(ctx, "bad S4 position mask\n");
 				}
 
-				if (saved_s4 & (1 << 10)) {
+				if (ctx->saved_s4 & (1 << 10)) {
 					VERTEX_OUT
 					    ("color = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2386,7 +2565,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 11)) {
+				if (ctx->saved_s4 & (1 << 11)) {
 					VERTEX_OUT
 					    ("spec = (A=0x%02x, R=0x%02x, G=0x%02x, "
 					     "B=0x%02x)", data[i] >> 24,
@@ -2394,11 +2573,11 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					     (data[i] >> 8) & 0xff,
 					     data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 12))
+				if (ctx->saved_s4 & (1 << 12))
 					VERTEX_OUT("width = 0x%08x)", data[i]);
 
 				for (tc = 0; tc <= 7; tc++) {
-					switch ((saved_s2 >> (tc * 4)) & 0xf) {
+					switch ((ctx->saved_s2 >> (tc * 4)) & 0xf) {
 					case 0x0:
 						VERTEX_OUT("T%d.X = %f", tc,
 							   int_as_float(data
@@ -2453,7 +2632,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 					case 0xf:
 						break;
 					default:
-						fprintf(out,
+						decode_printf(ctx,
 							"bad S2.T%d format\n",
 							tc);
 					}
@@ -2498,7 +2677,7 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 							  data[i] >> 16);
 					}
 				}
-				fprintf(out,
+				decode_printf(ctx,
 					"3DPRIMITIVE: no terminator found in index buffer\n");
 				ret = count;
 				goto out;
@@ -2531,8 +2710,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	}
 
 out:
-	saved_s2 = original_s2;
-	saved_s4 = original_s4;
+	ctx->saved_s2 = original_s2;
+	ctx->saved_s4 = original_s4;
 	return ret;
 }
 
@@ -2581,7 +2760,7 @@ decode_3d(struct drm_intel_decode *ctx)
 				len = (data[0] & 0xff) + 2;
 				if (len < opcode_3d->min_len ||
 				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
+					decode_printf(ctx, "Bad count in %s\n",
 						opcode_3d->name);
 				}
 			}
@@ -2723,7 +2902,7 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	uint32_t *data = ctx->data;
 
 	if (len != 3)
-		fprintf(out, "Bad count in URB_FENCE\n");
+		decode_printf(ctx, "Bad count in URB_FENCE\n");
 
 	vs_fence = data[1] & 0x3ff;
 	gs_fence = (data[1] >> 10) & 0x3ff;
@@ -2746,13 +2925,13 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 		  "sf fence: %d, vfe_fence: %d, cs_fence: %d\n",
 		  sf_fence, vfe_fence, cs_fence);
 	if (gs_fence < vs_fence)
-		fprintf(out, "gs fence < vs fence!\n");
+		decode_printf(ctx, "gs fence < vs fence!\n");
 	if (clip_fence < gs_fence)
-		fprintf(out, "clip fence < gs fence!\n");
+		decode_printf(ctx, "clip fence < gs fence!\n");
 	if (sf_fence < clip_fence)
-		fprintf(out, "sf fence < clip fence!\n");
+		decode_printf(ctx, "sf fence < clip fence!\n");
 	if (cs_fence < sf_fence)
-		fprintf(out, "cs fence < sf fence!\n");
+		decode_printf(ctx, "cs fence < sf fence!\n");
 
 	return len;
 }
@@ -3128,6 +3307,97 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 	return 7;
 }
 
+static const struct opcode_info opcodes_3d_965[] = {
+	{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
+	{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
+	{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
+	{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
+	{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
+	{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
+	{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
+	{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
+	{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
+	{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
+	{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
+	{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
+	{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
+	{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
+	{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
+	{ 0x780e, 0xffff, 4, 4, "3DSTATE_CC_STATE_POINTERS", 6, gen6_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780e, 0x00ff, 2, 2, "3DSTATE_CC_STATE_POINTERS", 7, gen7_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
+	{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
+	{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
+	{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
+	{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
+	{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
+	{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
+	{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
+	{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
+	{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
+	{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
+	{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
+	{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
+	{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
+	{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
+	{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
+	{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
+	{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
+	{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
+	{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
+	{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
+	{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
+	{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
+	{ 0x7821, 0x00ff, 2, 2, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP", 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
+	{ 0x7823, 0x00ff, 2, 2, "3DSTATE_VIEWPORT_STATE_POINTERS_CC", 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
+	{ 0x7824, 0x00ff, 2, 2, "3DSTATE_BLEND_STATE_POINTERS", 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
+	{ 0x7825, 0x00ff, 2, 2, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS", 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
+	{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
+	{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
+	{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
+	{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
+	{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
+	{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
+	{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
+	{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
+	{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
+	{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
+	{ 0x7830, 0x00ff, 2, 2, "3DSTATE_URB_VS", 7, gen7_3DSTATE_URB_VS },
+	{ 0x7831, 0x00ff, 2, 2, "3DSTATE_URB_HS", 7, gen7_3DSTATE_URB_HS },
+	{ 0x7832, 0x00ff, 2, 2, "3DSTATE_URB_DS", 7, gen7_3DSTATE_URB_DS },
+	{ 0x7833, 0x00ff, 2, 2, "3DSTATE_URB_GS", 7, gen7_3DSTATE_URB_GS },
+	{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
+	{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
+	{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
+	{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
+	{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
+	{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
+	{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
+	{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
+	{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
+	{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
+	{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
+	{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
+	{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
+	{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
+	{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
+	{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
+	{ 0x7b00, 0x00ff, 7, 7, "3DPRIMITIVE", 7, gen7_3DPRIMITIVE },
+	{ 0x7b00, 0x00ff, 6, 6, "3DPRIMITIVE", 0, gen4_3DPRIMITIVE },
+};
+
 static int
 decode_3d_965(struct drm_intel_decode *ctx)
 {
@@ -3136,120 +3406,12 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	unsigned int i, j, sba_len;
 	const char *desc1 = NULL;
 	uint32_t *data = ctx->data;
-	uint32_t devid = ctx->devid;
-
-	struct {
-		uint32_t opcode;
-		uint32_t len_mask;
-		int unsigned min_len;
-		int unsigned max_len;
-		const char *name;
-		int gen;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_3d[] = {
-		{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
-		{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
-		{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
-		{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
-		{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
-		{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
-		{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
-		{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
-		{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
-		{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
-		{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
-		{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
-		{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
-		{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
-		{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
-		{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
-		{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
-		{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
-		{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
-		{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
-		{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
-		{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
-		{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
-		{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
-		{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
-		{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
-		{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
-		{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
-		{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
-		{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
-		{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
-		{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
-		{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
-		{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
-		{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
-		{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
-		{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
-		{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
-		{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
-		{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
-		{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
-		{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
-		{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
-		{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
-		{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
-		{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
-		{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
-		{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
-		{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
-		{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
-		{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
-		{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
-		{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
-		{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
-		{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
-		{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
-		{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
-		{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
-		{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
-		{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
-		{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
-		{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
-		{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
-		{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
-		{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
-		{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
-		{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
-		{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
-		{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
-		{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
-		{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
-		{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
-		{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
-		{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
-		{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
-		{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
-		{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
-	}, *opcode_3d = NULL;
+	const struct opcode_info *opcode_3d = NULL;
 
 	opcode = (data[0] & 0xffff0000) >> 16;
 
-	for (i = 0; i < ARRAY_SIZE(opcodes_3d); i++) {
-		if (opcode != opcodes_3d[i].opcode)
-			continue;
-
-		/* If it's marked as not our gen, skip. */
-		if (opcodes_3d[i].gen && opcodes_3d[i].gen != ctx->gen)
-			continue;
-
-		opcode_3d = &opcodes_3d[i];
-		break;
-	}
+	opcode_3d = LOOKUP_OPCODE(ctx->dispatch_3d_965, opcodes_3d_965,
+				  opcode & 0x1fff);
 
 	if (opcode_3d) {
 		if (opcode_3d->max_len == 1)
@@ -3259,7 +3421,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		if (len < opcode_3d->min_len ||
 		    len > opcode_3d->max_len) {
-			fprintf(out, "Bad length %d in %s, expected %d-%d\n",
+			decode_printf(ctx, "Bad length %d in %s, expected %d-%d\n",
 				len, opcode_3d->name,
 				opcode_3d->min_len, opcode_3d->max_len);
 		}
@@ -3289,28 +3451,28 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		instr_out(ctx, 0, "STATE_BASE_ADDRESS\n");
 		i++;
 
-		if (IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 6)
 			sba_len = 10;
-		else if (IS_GEN5(devid))
+		else if (ctx->gen == 5)
 			sba_len = 8;
 		else
 			sba_len = 6;
 		if (len != sba_len)
-			fprintf(out, "Bad count in STATE_BASE_ADDRESS\n");
+			decode_printf(ctx, "Bad count in STATE_BASE_ADDRESS\n");
 
 		state_base_out(ctx, i++, "general");
 		state_base_out(ctx, i++, "surface");
-		if (IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 6)
 			state_base_out(ctx, i++, "dynamic");
 		state_base_out(ctx, i++, "indirect");
-		if (IS_GEN5(devid) || IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 5)
 			state_base_out(ctx, i++, "instruction");
 
 		state_max_out(ctx, i++, "general");
-		if (IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 6)
 			state_max_out(ctx, i++, "dynamic");
 		state_max_out(ctx, i++, "indirect");
-		if (IS_GEN5(devid) || IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 5)
 			state_max_out(ctx, i++, "instruction");
 
 		return len;
@@ -3325,7 +3487,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 	case 0x7801:
 		if (len != 6 && len != 4)
-			fprintf(out,
+			decode_printf(ctx,
 				"Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
 		if (len == 6) {
 			instr_out(ctx, 0,
@@ -3374,12 +3536,12 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7808:
 		if ((len - 1) % 4 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_BUFFERS\n");
 
 		for (i = 1; i < len;) {
 			int idx, access;
-			if (IS_GEN6(devid)) {
+			if (ctx->gen == 6) {
 				idx = 26;
 				access = 20;
 			} else {
@@ -3399,15 +3561,15 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7809:
 		if ((len + 1) % 2 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
 		instr_out(ctx, 0, "3DSTATE_VERTEX_ELEMENTS\n");
 
 		for (i = 1; i < len;) {
 			instr_out(ctx, i,
 				  "buffer %d: %svalid, type 0x%04x, "
 				  "src offset 0x%04x bytes\n",
-				  data[i] >> ((IS_GEN6(devid) || IS_GEN7(devid)) ? 26 : 27),
-				  data[i] & (1 << ((IS_GEN6(devid) || IS_GEN7(devid)) ? 25 : 26)) ?
+				  data[i] >> ((ctx->gen >= 6) ? 26 : 27),
+				  data[i] & (1 << ((ctx->gen >= 6) ? 25 : 26)) ?
 				  "" : "in", (data[i] >> 16) & 0x1ff,
 				  data[i] & 0x07ff);
 			i++;
@@ -3591,7 +3753,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7905:
 		instr_out(ctx, 0, "3DSTATE_DEPTH_BUFFER\n");
-		if (IS_GEN5(devid) || IS_GEN6(devid))
+		if (ctx->gen == 5 || ctx->gen == 6)
 			instr_out(ctx, 1,
 				  "%s, %s, pitch = %d bytes, %stiled, HiZ %d, Seperate Stencil %d\n",
 				  get_965_surfacetype(data[1] >> 29),
@@ -3615,7 +3777,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		if (len >= 6)
 			instr_out(ctx, 5, "\n");
 		if (len >= 7) {
-			if (IS_GEN6(devid))
+			if (ctx->gen == 6)
 				instr_out(ctx, 6, "\n");
 			else
 				instr_out(ctx, 6,
@@ -3625,10 +3787,10 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7a00:
-		if (IS_GEN6(devid) || IS_GEN7(devid)) {
+		if (ctx->gen >= 6) {
 			unsigned int i;
 			if (len != 4 && len != 5)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				decode_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[1] >> 14) & 0x3) {
 			case 0:
@@ -3694,7 +3856,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			return len;
 		} else {
 			if (len != 4)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				decode_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[0] >> 14) & 0x3) {
 			case 0:
@@ -3796,7 +3958,7 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 				len = (data[0] & 0xff) + 2;
 				if (len < opcode_3d->min_len ||
 				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
+					decode_printf(ctx, "Bad count in %s\n",
 						opcode_3d->name);
 				}
 			}
@@ -3813,6 +3975,32 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 	return 1;
 }
 
+/**
+ * Decodes the packet at ctx->data, returning its length in dwords, or -1
+ * for MI_BATCH_BUFFER_END.
+ */
+static int
+decode_packet(struct drm_intel_decode *ctx)
+{
+
+	switch ((ctx->data[0] & 0xe0000000) >> 29) {
+	case 0x0:
+		return decode_mi(ctx);
+	case 0x2:
+		return decode_2d(ctx);
+	case 0x3:
+		if (ctx->gen >= 4)
+			return decode_3d_965(ctx);
+		else if (ctx->gen == 3)
+			return decode_3d(ctx);
+		else
+			return decode_3d_i830(ctx);
+	default:
+		instr_out(ctx, 0, "UNKNOWN\n");
+		return 1;
+	}
+}
+
 struct drm_intel_decode *
 drm_intel_decode_context_alloc(uint32_t devid)
 {
@@ -3822,6 +4010,13 @@ drm_intel_decode_context_alloc(uint32_t devid)
 	if (!ctx)
 		return NULL;
 
+	ctx->buf = malloc(DECODE_BUFFER_SIZE);
+	if (!ctx->buf) {
+		free(ctx);
+		return NULL;
+	}
+	ctx->buf_size = DECODE_BUFFER_SIZE;
+
 	ctx->devid = devid;
 	ctx->out = stdout;
 
@@ -3840,12 +4035,22 @@ drm_intel_decode_context_alloc(uint32_t devid)
 		ctx->gen = 2;
 	}
 
+	build_dispatch(ctx->dispatch_mi, 0x3f,
+		       opcodes_mi, ARRAY_SIZE(opcodes_mi), ctx->gen);
+	build_dispatch(ctx->dispatch_2d, 0x7f,
+		       opcodes_2d, ARRAY_SIZE(opcodes_2d), ctx->gen);
+	build_dispatch(ctx->dispatch_3d_965, 0x1fff,
+		       opcodes_3d_965, ARRAY_SIZE(opcodes_3d_965), ctx->gen);
+
 	return ctx;
 }
 
 void
 drm_intel_decode_context_free(struct drm_intel_decode *ctx)
 {
+	drm_intel_decode_reset_summary(ctx);
+	free(ctx->stats);
+	free(ctx->buf);
 	free(ctx);
 }
 
@@ -3880,6 +4085,279 @@ drm_intel_decode_set_output_file(struct drm_intel_decode *ctx,
 	ctx->out = out;
 }
 
+static uint32_t
+packet_info(struct drm_intel_decode *ctx, const uint32_t *data,
+	    struct drm_intel_decode_packet *packet);
+
+static struct decode_opcode_stats *
+summary_lookup(struct drm_intel_decode *ctx, uint32_t key)
+{
+	unsigned int mask = ctx->stats_size - 1;
+	unsigned int i = (key ^ (key >> 16)) * 0x9e3779b1u;
+
+	for (i &= mask; ctx->stats[i].key != ~0u; i = (i + 1) & mask) {
+		if (ctx->stats[i].key == key)
+			return &ctx->stats[i];
+	}
+
+	return &ctx->stats[i];
+}
+
+static int
+summary_grow(struct drm_intel_decode *ctx)
+{
+	struct decode_opcode_stats *old = ctx->stats;
+	unsigned int old_size = ctx->stats_size;
+	unsigned int i;
+
+	ctx->stats_size = old_size ? old_size * 2 : 64;
+	ctx->stats = malloc(ctx->stats_size * sizeof(*ctx->stats));
+	if (!ctx->stats) {
+		ctx->stats = old;
+		ctx->stats_size = old_size;
+		return -1;
+	}
+	for (i = 0; i < ctx->stats_size; i++)
+		ctx->stats[i].key = ~0u;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].key != ~0u)
+			*summary_lookup(ctx, old[i].key) = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+/**
+ * Returns whether the packet sets state, which makes re-emitting it with
+ * the same contents redundant.
+ */
+static bool
+summary_is_state(struct drm_intel_decode *ctx,
+		 const struct drm_intel_decode_packet *packet)
+{
+	if (packet->type != DRM_INTEL_PACKET_3D)
+		return false;
+
+	if (ctx->gen >= 4)
+		return packet->opcode != 0x7b00 && packet->opcode != 0x7a00;
+
+	return packet->opcode != 0x1f;
+}
+
+static bool
+summary_is_primitive(struct drm_intel_decode *ctx,
+		     const struct drm_intel_decode_packet *packet)
+{
+	if (packet->type != DRM_INTEL_PACKET_3D)
+		return false;
+
+	return packet->opcode == (ctx->gen >= 4 ? 0x7b00 : 0x1f);
+}
+
+static void
+summary_check_redundant(struct drm_intel_decode *ctx,
+			struct decode_opcode_stats *stats,
+			const uint32_t *data, uint32_t len)
+{
+	if (stats->last_batch == ctx->totals.batches &&
+	    stats->last_len == len &&
+	    memcmp(stats->last, data, len * 4) == 0) {
+		stats->redundant++;
+		stats->redundant_dwords += len;
+		ctx->totals.redundant_packets++;
+		ctx->totals.redundant_dwords += len;
+		return;
+	}
+
+	if (len > stats->last_size) {
+		uint32_t *last = realloc(stats->last, len * 4);
+
+		if (!last) {
+			stats->last_batch = 0;
+			return;
+		}
+		stats->last = last;
+		stats->last_size = len;
+	}
+	memcpy(stats->last, data, len * 4);
+	stats->last_len = len;
+	stats->last_batch = ctx->totals.batches;
+}
+
+/**
+ * Counts the packet at ctx->data in summary mode, returning its length
+ * like decode_packet().
+ */
+static int
+summary_packet(struct drm_intel_decode *ctx)
+{
+	static const char *type_names[] = { "MI", "2D", "3D", "unknown" };
+	struct drm_intel_decode_packet packet;
+	struct decode_opcode_stats *stats;
+	uint32_t key, len;
+
+	len = packet_info(ctx, ctx->data, &packet);
+	if (len == 0) {
+		/* Let the decoder work out the length of old 3D packets,
+		 * with the output discarded.
+		 */
+		len = decode_packet(ctx);
+	}
+	if (len > ctx->count)
+		len = ctx->count;
+
+	if (ctx->stats_count >= ctx->stats_size * 3 / 4 &&
+	    summary_grow(ctx) != 0)
+		goto done;
+
+	key = packet.type << 16 | packet.opcode;
+	stats = summary_lookup(ctx, key);
+	if (stats->key == ~0u) {
+		memset(stats, 0, sizeof(*stats));
+		stats->key = key;
+		stats->name = packet.name;
+		if (!stats->name) {
+			snprintf(stats->unknown_name,
+				 sizeof(stats->unknown_name), "%s 0x%02x",
+				 type_names[packet.type], packet.opcode);
+			stats->name = stats->unknown_name;
+		}
+		ctx->stats_count++;
+	}
+
+	stats->count++;
+	stats->dwords += len;
+
+	if (summary_is_primitive(ctx, &packet)) {
+		ctx->totals.primitive_packets++;
+		ctx->totals.primitive_dwords += len;
+	} else if (summary_is_state(ctx, &packet)) {
+		ctx->totals.state_packets++;
+		ctx->totals.state_dwords += len;
+		summary_check_redundant(ctx, stats, ctx->data, len);
+	}
+
+done:
+	ctx->totals.packets++;
+	ctx->totals.dwords += len;
+
+	if (packet.type == DRM_INTEL_PACKET_MI && packet.opcode == 0x0a)
+		return -1;
+	return len;
+}
+
+/**
+ * Switches drm_intel_decode() between printing the batch and only counting
+ * its packets for drm_intel_decode_print_summary().
+ */
+void
+drm_intel_decode_set_summary(struct drm_intel_decode *ctx, int summary)
+{
+	ctx->summary = !!summary;
+	drm_intel_decode_reset_summary(ctx);
+}
+
+void
+drm_intel_decode_reset_summary(struct drm_intel_decode *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->stats_size; i++) {
+		if (ctx->stats[i].key != ~0u)
+			free(ctx->stats[i].last);
+		ctx->stats[i].key = ~0u;
+	}
+	ctx->stats_count = 0;
+	memset(&ctx->totals, 0, sizeof(ctx->totals));
+}
+
+void
+drm_intel_decode_get_summary(struct drm_intel_decode *ctx,
+			     struct drm_intel_decode_summary *summary)
+{
+	*summary = ctx->totals;
+}
+
+static int
+compare_stats_dwords(const void *a, const void *b)
+{
+	const struct decode_opcode_stats *sa =
+		*(const struct decode_opcode_stats * const *)a;
+	const struct decode_opcode_stats *sb =
+		*(const struct decode_opcode_stats * const *)b;
+
+	if (sa->dwords != sb->dwords)
+		return sa->dwords < sb->dwords ? 1 : -1;
+	if (sa->key != sb->key)
+		return sa->key < sb->key ? -1 : 1;
+	return 0;
+}
+
+static double
+percent(uint64_t part, uint64_t total)
+{
+	return total ? 100.0 * part / total : 0;
+}
+
+/**
+ * Prints the totals and the max_opcodes packet types taking the most
+ * dwords, or all of them if max_opcodes is 0, to the output file.
+ */
+void
+drm_intel_decode_print_summary(struct drm_intel_decode *ctx, int max_opcodes)
+{
+	const struct drm_intel_decode_summary *t = &ctx->totals;
+	struct decode_opcode_stats **sorted;
+	unsigned int i, n = 0;
+
+	decode_printf(ctx, "%llu batches, %llu packets, %llu dwords\n",
+		      (unsigned long long)t->batches,
+		      (unsigned long long)t->packets,
+		      (unsigned long long)t->dwords);
+	decode_printf(ctx, "primitives: %llu packets, %llu dwords (%.1f%%)\n",
+		      (unsigned long long)t->primitive_packets,
+		      (unsigned long long)t->primitive_dwords,
+		      percent(t->primitive_dwords, t->dwords));
+	decode_printf(ctx, "state:      %llu packets, %llu dwords (%.1f%%)\n",
+		      (unsigned long long)t->state_packets,
+		      (unsigned long long)t->state_dwords,
+		      percent(t->state_dwords, t->dwords));
+	decode_printf(ctx, "redundant:  %llu packets, %llu dwords "
+		      "(%.1f%% of state)\n",
+		      (unsigned long long)t->redundant_packets,
+		      (unsigned long long)t->redundant_dwords,
+		      percent(t->redundant_dwords, t->state_dwords));
+
+	sorted = malloc(ctx->stats_count * sizeof(*sorted));
+	if (!sorted)
+		goto out;
+	for (i = 0; i < ctx->stats_size; i++) {
+		if (ctx->stats[i].key != ~0u)
+			sorted[n++] = &ctx->stats[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), compare_stats_dwords);
+	if (max_opcodes > 0 && (unsigned int)max_opcodes < n)
+		n = max_opcodes;
+
+	decode_printf(ctx, "\n%-40s %8s %10s %6s %10s\n",
+		      "packet", "count", "dwords", "%", "redundant");
+	for (i = 0; i < n; i++) {
+		decode_printf(ctx, "%-40s %8llu %10llu %5.1f%% %10llu\n",
+			      sorted[i]->name,
+			      (unsigned long long)sorted[i]->count,
+			      (unsigned long long)sorted[i]->dwords,
+			      percent(sorted[i]->dwords, t->dwords),
+			      (unsigned long long)sorted[i]->redundant);
+	}
+	free(sorted);
+
+out:
+	decode_flush(ctx);
+	fflush(ctx->out);
+}
+
 /**
  * Decodes an i830-i915 batch buffer, writing the output to stdout.
  *
@@ -3892,78 +4370,58 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 {
 	int ret;
 	unsigned int index = 0;
-	uint32_t devid;
-	int size = ctx->base_count * 4;
-	void *temp;
+	uint32_t *tail = NULL;
 
 	if (!ctx)
 		return;
 
-	/* Put a scratch page full of obviously undefined data after
-	 * the batchbuffer.  This lets us avoid a bunch of length
-	 * checking in statically sized packets.
-	 */
-	temp = malloc(size + 4096);
-	memcpy(temp, ctx->base_data, size);
-	memset((char *)temp + size, 0xd0, 4096);
-	ctx->data = temp;
-
+	ctx->data = ctx->base_data;
 	ctx->hw_offset = ctx->base_hw_offset;
 	ctx->count = ctx->base_count;
 
-	devid = ctx->devid;
-	head_offset = ctx->head;
-	tail_offset = ctx->tail;
-	out = ctx->out;
+	ctx->saved_s2_set = false;
+	ctx->saved_s4_set = true;
 
-	saved_s2_set = 0;
-	saved_s4_set = 1;
+	if (ctx->summary)
+		ctx->totals.batches++;
+	ctx->quiet = ctx->summary;
 
 	while (ctx->count > 0) {
 		index = 0;
 
-		switch ((ctx->data[index] & 0xe0000000) >> 29) {
-		case 0x0:
-			ret = decode_mi(ctx);
+		/* Put a scratch page full of obviously undefined data after
+		 * the batchbuffer.  Only the end of the batch needs it, so
+		 * copy just that instead of the whole batch.
+		 */
+		if (!tail && ctx->count <= DECODE_TAIL_DWORDS) {
+			tail = malloc(ctx->count * 4 + DECODE_SCRATCH_SIZE);
+			if (!tail)
+				break;
+			memcpy(tail, ctx->data, ctx->count * 4);
+			memset(tail + ctx->count, 0xd0, DECODE_SCRATCH_SIZE);
+			ctx->data = tail;
+		}
 
-			/* If MI_BATCHBUFFER_END happened, then dump
-			 * the rest of the output in case we some day
-			 * want it in debugging, but don't decode it
-			 * since it'll just confuse in the common
-			 * case.
-			 */
-			if (ret == -1) {
-				if (ctx->dump_past_end) {
-					index++;
-				} else {
-					for (index = index + 1; index < ctx->count;
-					     index++) {
-						instr_out(ctx, index, "\n");
-					}
-				}
-			} else
-				index += ret;
-			break;
-		case 0x2:
-			index += decode_2d(ctx);
-			break;
-		case 0x3:
-			if (IS_9XX(devid) && !IS_GEN3(devid)) {
-				index +=
-				    decode_3d_965(ctx);
-			} else if (IS_GEN3(devid)) {
-				index += decode_3d(ctx);
+		if (ctx->summary)
+			ret = summary_packet(ctx);
+		else
+			ret = decode_packet(ctx);
+
+		/* If MI_BATCHBUFFER_END happened, then dump the rest of the
+		 * output in case we some day want it in debugging, but don't
+		 * decode it since it'll just confuse in the common case.
+		 */
+		if (ret == -1) {
+			if (ctx->dump_past_end) {
+				index++;
 			} else {
-				index +=
-				    decode_3d_i830(ctx);
+				for (index = index + 1; index < ctx->count;
+				     index++) {
+					instr_out(ctx, index, "\n");
+				}
 			}
-			break;
-		default:
-			instr_out(ctx, index, "UNKNOWN\n");
-			index++;
-			break;
-		}
-		fflush(out);
+		} else
+			index += ret;
 
 		if (ctx->count < index)
 			break;
@@ -3973,5 +4431,167 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 		ctx->hw_offset += 4 * index;
 	}
 
-	free(temp);
+	ctx->quiet = false;
+	decode_flush(ctx);
+	fflush(ctx->out);
+
+	free(tail);
+}
+
+/**
+ * Looks up the packet at data, filling in its type, opcode and name, and
+ * returns its length in dwords, or 0 if it can't be determined without
+ * decoding it.
+ */
+static uint32_t
+packet_info(struct drm_intel_decode *ctx, const uint32_t *data,
+	    struct drm_intel_decode_packet *packet)
+{
+	const struct opcode_info *info;
+
+	packet->name = NULL;
+
+	switch ((data[0] & 0xe0000000) >> 29) {
+	case 0x0:
+		packet->type = DRM_INTEL_PACKET_MI;
+		packet->opcode = (data[0] & 0x1f800000) >> 23;
+		info = LOOKUP_OPCODE(ctx->dispatch_mi, opcodes_mi,
+				     packet->opcode);
+		if (!info)
+			return 1;
+		break;
+	case 0x2:
+		packet->type = DRM_INTEL_PACKET_2D;
+		packet->opcode = (data[0] & 0x1fc00000) >> 22;
+		info = LOOKUP_OPCODE(ctx->dispatch_2d, opcodes_2d,
+				     packet->opcode);
+		if (!info)
+			return 1;
+		break;
+	case 0x3:
+		packet->type = DRM_INTEL_PACKET_3D;
+		if (ctx->gen < 4) {
+			/* The i830 and i915 3D packets don't have a common
+			 * length encoding.
+			 */
+			packet->opcode = (data[0] & 0x1f000000) >> 24;
+			return 0;
+		}
+		packet->opcode = (data[0] & 0xffff0000) >> 16;
+		info = LOOKUP_OPCODE(ctx->dispatch_3d_965, opcodes_3d_965,
+				     packet->opcode & 0x1fff);
+		if (!info)
+			return (data[0] & 0x0000ffff) + 2;
+		break;
+	default:
+		packet->type = DRM_INTEL_PACKET_UNKNOWN;
+		packet->opcode = (data[0] & 0xe0000000) >> 29;
+		return 1;
+	}
+
+	packet->name = info->name;
+	if (info->max_len == 1)
+		return 1;
+	return (data[0] & info->len_mask) + 2;
+}
+
+/**
+ * Starts walking the batch set with drm_intel_decode_set_batch_pointer()
+ * packet by packet, without formatting or copying anything.
+ */
+void
+drm_intel_decode_iter_init(struct drm_intel_decode *ctx,
+			   struct drm_intel_decode_iter *iter)
+{
+	iter->ctx = ctx;
+	iter->data = ctx->base_data;
+	iter->hw_offset = ctx->base_hw_offset;
+	iter->count = ctx->base_count;
+	iter->done = 0;
+}
+
+/**
+ * Fills in the next packet of the batch.
+ *
+ * Returns 1 for a packet, or 0 at the end of the batch, which is also
+ * after MI_BATCH_BUFFER_END unless dump_past_end is set.  Returns -1 if
+ * the length of the packet can't be told from its header (3D packets
+ * before gen4), in which case the packet is filled in but iteration can't
+ * go on.
+ */
+int
+drm_intel_decode_iter_next(struct drm_intel_decode_iter *iter,
+			   struct drm_intel_decode_packet *packet)
+{
+	uint32_t len;
+
+	if (iter->done || iter->count == 0)
+		return 0;
+
+	len = packet_info(iter->ctx, iter->data, packet);
+	packet->data = iter->data;
+	packet->hw_offset = iter->hw_offset;
+	if (len == 0) {
+		packet->len = 1;
+		packet->truncated = 0;
+		iter->done = 1;
+		return -1;
+	}
+
+	packet->truncated = len > iter->count;
+	if (packet->truncated)
+		len = iter->count;
+	packet->len = len;
+
+	iter->data += len;
+	iter->hw_offset += 4 * len;
+	iter->count -= len;
+
+	if (packet->type == DRM_INTEL_PACKET_MI && packet->opcode == 0x0a &&
+	    !iter->ctx->dump_past_end)
+		iter->done = 1;
+
+	return 1;
+}
+
+/**
+ * Decodes the fields of a packet returned by drm_intel_decode_iter_next(),
+ * calling func with the description of each dword instead of printing it.
+ */
+void
+drm_intel_decode_packet_fields(struct drm_intel_decode *ctx,
+			       const struct drm_intel_decode_packet *packet,
+			       drm_intel_decode_field_func func,
+			       void *closure)
+{
+	uint32_t stack_data[64 + DECODE_SCRATCH_SIZE / 4];
+	uint32_t *data = stack_data;
+	uint32_t padded = packet->len + DECODE_SCRATCH_SIZE / 4;
+	bool overflowed = ctx->overflowed;
+
+	/* Like drm_intel_decode(), follow the packet with a scratch page so
+	 * that decoders of fixed size packets don't read past the end.
+	 */
+	if (padded > ARRAY_SIZE(stack_data)) {
+		data = malloc(padded * 4);
+		if (!data)
+			return;
+	}
+	memcpy(data, packet->data, packet->len * 4);
+	memset(data + packet->len, 0xd0, DECODE_SCRATCH_SIZE);
+
+	ctx->data = data;
+	ctx->hw_offset = packet->hw_offset;
+	ctx->count = packet->len;
+	ctx->field_func = func;
+	ctx->field_closure = closure;
+
+	decode_packet(ctx);
+
+	ctx->field_func = NULL;
+	ctx->field_closure = NULL;
+	ctx->overflowed = overflowed;
+
+	if (data != stack_data)
+		free(data);
 }
@@ -23,18 +23,133 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <assert.h>
 
 #include "xf86drm.h"
 #include "mm.h"
 
+#define MM_NUM_BINS		32
+#define MM_CHUNK_BLOCKS		64
+
+struct mem_chunk {
+	struct mem_chunk *next;
+	struct mem_block blocks[MM_CHUNK_BLOCKS];
+};
+
+/* The heap pointer handed out by mmInit() is the sentinel block embedded
+ * at the start of this structure.
+ */
+struct mem_heap {
+	struct mem_block sentinel;
+	int mode;
+
+	/* Segregated free lists, bin n holds blocks of [2^n, 2^(n+1)) bytes */
+	struct mem_block bins[MM_NUM_BINS];
+	unsigned int bin_mask;
+
+	/* Pool of spare mem_block nodes */
+	struct mem_block *spare;
+	struct mem_chunk *chunks;
+};
+
+static struct mem_heap *GetHeap(const struct mem_block *p)
+{
+	return (struct mem_heap *)p->heap;
+}
+
+static int SizeClass(int size)
+{
+	int c = 0;
+
+	while (size >>= 1)
+		c++;
+	return c;
+}
+
+static struct mem_block *AllocBlock(struct mem_heap *heap)
+{
+	struct mem_block *p;
+	int i;
+
+	if (!heap->spare) {
+		struct mem_chunk *chunk = malloc(sizeof(*chunk));
+		if (!chunk)
+			return NULL;
+
+		chunk->next = heap->chunks;
+		heap->chunks = chunk;
+		for (i = 0; i < MM_CHUNK_BLOCKS; i++) {
+			chunk->blocks[i].next = heap->spare;
+			heap->spare = &chunk->blocks[i];
+		}
+	}
+
+	p = heap->spare;
+	heap->spare = p->next;
+	memset(p, 0, sizeof(*p));
+	p->heap = &heap->sentinel;
+	return p;
+}
+
+static void FreeBlock(struct mem_block *p)
+{
+	struct mem_heap *heap = GetHeap(p);
+
+	p->next = heap->spare;
+	heap->spare = p;
+}
+
+/* Insert p into the free list after 'after'. */
+static void LinkFree(struct mem_block *after, struct mem_block *p)
+{
+	p->next_free = after->next_free;
+	p->prev_free = after;
+	after->next_free->prev_free = p;
+	after->next_free = p;
+}
+
+static void UnlinkFree(struct mem_block *p)
+{
+	p->next_free->prev_free = p->prev_free;
+	p->prev_free->next_free = p->next_free;
+
+	p->next_free = 0;
+	p->prev_free = 0;
+}
+
+/* Returns the free list that a free block of p's size belongs to in a
+ * segregated heap.
+ */
+static struct mem_block *SizeClassList(struct mem_block *p)
+{
+	struct mem_heap *heap = GetHeap(p);
+	int c = SizeClass(p->size);
+
+	heap->bin_mask |= 1u << c;
+	return &heap->bins[c];
+}
+
+/* Moves a free block whose size changed to the right size class. */
+static void Rebin(struct mem_block *p)
+{
+	if (GetHeap(p)->mode != MM_SEGREGATED_FIT)
+		return;
+
+	UnlinkFree(p);
+	LinkFree(SizeClassList(p), p);
+}
+
 void mmDumpMemInfo(const struct mem_block *heap)
 {
 	drmMsg("Memory heap %p:\n", (void *)heap);
 	if (heap == 0) {
 		drmMsg("  heap == 0\n");
 	} else {
-		const struct mem_block *p;
+		const struct mem_heap *h = (const struct mem_heap *)heap;
+		const struct mem_block *p, *list;
+		int c;
 
 		for (p = heap->next; p != heap; p = p->next) {
 			drmMsg("  Offset:%08x, Size:%08x, %c%c\n", p->ofs,
@@ -44,102 +159,127 @@ void mmDumpMemInfo(const struct mem_block *heap)
 
 		drmMsg("\nFree list:\n");
 
-		for (p = heap->next_free; p != heap; p = p->next_free) {
-			drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
-			       p->reserved ? 'R' : '.');
+		for (c = 0; c < MM_NUM_BINS; c++) {
+			if (h->mode == MM_SEGREGATED_FIT)
+				list = &h->bins[c];
+			else if (c == 0)
+				list = heap;
+			else
+				break;
+
+			for (p = list->next_free; p != list; p = p->next_free) {
+				drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n",
+				       p->ofs, p->size, p->free ? 'F' : '.',
+				       p->reserved ? 'R' : '.');
+			}
 		}
 
 	}
 	drmMsg("End of memory blocks\n");
 }
 
-struct mem_block *mmInit(int ofs, int size)
+struct mem_block *mmInitMode(int ofs, int size, int mode)
 {
-	struct mem_block *heap, *block;
+	struct mem_heap *heap;
+	struct mem_block *block;
+	int c;
 
 	if (size <= 0)
 		return NULL;
 
-	heap = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+	heap = (struct mem_heap *)calloc(1, sizeof(struct mem_heap));
 	if (!heap)
 		return NULL;
 
-	block = (struct mem_block *)calloc(1, sizeof(struct mem_block));
+	heap->mode = mode;
+	heap->sentinel.heap = &heap->sentinel;
+	heap->sentinel.next = &heap->sentinel;
+	heap->sentinel.prev = &heap->sentinel;
+	heap->sentinel.next_free = &heap->sentinel;
+	heap->sentinel.prev_free = &heap->sentinel;
+	for (c = 0; c < MM_NUM_BINS; c++) {
+		heap->bins[c].next_free = &heap->bins[c];
+		heap->bins[c].prev_free = &heap->bins[c];
+	}
+
+	block = AllocBlock(heap);
 	if (!block) {
 		free(heap);
 		return NULL;
 	}
 
-	heap->next = block;
-	heap->prev = block;
-	heap->next_free = block;
-	heap->prev_free = block;
-
-	block->heap = heap;
-	block->next = heap;
-	block->prev = heap;
-	block->next_free = heap;
-	block->prev_free = heap;
+	block->next = &heap->sentinel;
+	block->prev = &heap->sentinel;
+	heap->sentinel.next = block;
+	heap->sentinel.prev = block;
 
 	block->ofs = ofs;
 	block->size = size;
 	block->free = 1;
 
-	return heap;
+	if (mode == MM_SEGREGATED_FIT)
+		LinkFree(SizeClassList(block), block);
+	else
+		LinkFree(&heap->sentinel, block);
+
+	return &heap->sentinel;
+}
+
+struct mem_block *mmInit(int ofs, int size)
+{
+	return mmInitMode(ofs, size, MM_FIRST_FIT);
 }
 
 static struct mem_block *SliceBlock(struct mem_block *p,
 				    int startofs, int size,
 				    int reserved, int alignment)
 {
+	struct mem_heap *heap = GetHeap(p);
 	struct mem_block *newblock;
 
 	/* break left  [p, newblock, p->next], then p = newblock */
 	if (startofs > p->ofs) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
+		newblock = AllocBlock(heap);
 		if (!newblock)
 			return NULL;
 		newblock->ofs = startofs;
 		newblock->size = p->size - (startofs - p->ofs);
 		newblock->free = 1;
-		newblock->heap = p->heap;
 
 		newblock->next = p->next;
 		newblock->prev = p;
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
+		LinkFree(p, newblock);
 
 		p->size -= newblock->size;
+		Rebin(p);
 		p = newblock;
 	}
 
 	/* break right, also [p, newblock, p->next] */
 	if (size < p->size) {
-		newblock =
-		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		newblock = AllocBlock(heap);
+		if (!newblock) {
+			/* p may be what was split off on the left, still in
+			 * the size class of the block it came from */
+			Rebin(p);
 			return NULL;
+		}
 		newblock->ofs = startofs + size;
 		newblock->size = p->size - size;
 		newblock->free = 1;
-		newblock->heap = p->heap;
 
 		newblock->next = p->next;
 		newblock->prev = p;
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
+		if (heap->mode == MM_SEGREGATED_FIT)
+			LinkFree(SizeClassList(newblock), newblock);
+		else
+			LinkFree(p, newblock);
 
 		p->size = size;
 	}
@@ -149,41 +289,97 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 
 	/* Remove p from the free list: 
 	 */
-	p->next_free->prev_free = p->prev_free;
-	p->prev_free->next_free = p->next_free;
-
-	p->next_free = 0;
-	p->prev_free = 0;
+	UnlinkFree(p);
 
 	p->reserved = reserved;
 	return p;
 }
 
+/* Returns the aligned start offset of an allocation of 'size' bytes in p,
+ * or -1 if it doesn't fit.
+ */
+static int FitBlock(const struct mem_block *p, int size, int mask,
+		    int startSearch)
+{
+	int startofs = (p->ofs + mask) & ~mask;
+
+	if (startofs < startSearch)
+		startofs = startSearch;
+	if (startofs + size > p->ofs + p->size)
+		return -1;
+	return startofs;
+}
+
+/* Best fit within the smallest size class that can hold the request, then
+ * the first fitting block of the next non-empty larger class, so at most
+ * one list is searched exhaustively.
+ */
+static struct mem_block *FindSegregated(struct mem_heap *heap, int size,
+					int mask, int startSearch,
+					int *startofs)
+{
+	struct mem_block *p, *list, *best;
+	unsigned int bins;
+	int c, ofs;
+
+	bins = heap->bin_mask & ~((1u << SizeClass(size)) - 1);
+	while (bins) {
+		c = ffs(bins) - 1;
+		bins &= ~(1u << c);
+
+		list = &heap->bins[c];
+		if (list->next_free == list) {
+			heap->bin_mask &= ~(1u << c);
+			continue;
+		}
+
+		best = NULL;
+		for (p = list->next_free; p != list; p = p->next_free) {
+			assert(p->free);
+
+			ofs = FitBlock(p, size, mask, startSearch);
+			if (ofs < 0 || (best && p->size >= best->size))
+				continue;
+
+			best = p;
+			*startofs = ofs;
+			if (p->size == size || c != SizeClass(size))
+				break;
+		}
+		if (best)
+			return best;
+	}
+
+	return NULL;
+}
+
 struct mem_block *mmAllocMem(struct mem_block *heap, int size, int align2,
 			     int startSearch)
 {
 	struct mem_block *p;
 	const int mask = (1 << align2) - 1;
 	int startofs = 0;
-	int endofs;
 
 	if (!heap || align2 < 0 || size <= 0)
 		return NULL;
 
-	for (p = heap->next_free; p != heap; p = p->next_free) {
-		assert(p->free);
+	if (GetHeap(heap)->mode == MM_SEGREGATED_FIT) {
+		p = FindSegregated(GetHeap(heap), size, mask, startSearch,
+				   &startofs);
+		if (!p)
+			return NULL;
+	} else {
+		for (p = heap->next_free; p != heap; p = p->next_free) {
+			assert(p->free);
 
-		startofs = (p->ofs + mask) & ~mask;
-		if (startofs < startSearch) {
-			startofs = startSearch;
+			startofs = FitBlock(p, size, mask, startSearch);
+			if (startofs >= 0)
+				break;
 		}
-		endofs = startofs + size;
-		if (endofs <= (p->ofs + p->size))
-			break;
-	}
 
-	if (p == heap)
-		return NULL;
+		if (p == heap)
+			return NULL;
+	}
 
 	assert(p->free);
 	p = SliceBlock(p, startofs, size, 0, mask + 1);
@@ -218,10 +414,10 @@ static int Join2Blocks(struct mem_block *p)
 		p->next = q->next;
 		q->next->prev = p;
 
-		q->next_free->prev_free = q->prev_free;
-		q->prev_free->next_free = q->next_free;
+		UnlinkFree(q);
+		FreeBlock(q);
 
-		free(q);
+		Rebin(p);
 		return 1;
 	}
 	return 0;
@@ -242,10 +438,10 @@ int mmFreeMem(struct mem_block *b)
 	}
 
 	b->free = 1;
-	b->next_free = b->heap->next_free;
-	b->prev_free = b->heap;
-	b->next_free->prev_free = b;
-	b->prev_free->next_free = b;
+	if (GetHeap(b)->mode == MM_SEGREGATED_FIT)
+		LinkFree(SizeClassList(b), b);
+	else
+		LinkFree(b->heap, b);
 
 	Join2Blocks(b);
 	if (b->prev != b->heap)
@@ -254,17 +450,37 @@ int mmFreeMem(struct mem_block *b)
 	return 0;
 }
 
+void mmGetStats(const struct mem_block *heap, struct mem_stats *stats)
+{
+	const struct mem_block *p;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!heap)
+		return;
+
+	for (p = heap->next; p != heap; p = p->next) {
+		if (p->free) {
+			stats->free_blocks++;
+			stats->free_size += p->size;
+			if (p->size > stats->largest_free)
+				stats->largest_free = p->size;
+		} else {
+			stats->used_blocks++;
+			stats->used_size += p->size;
+		}
+	}
+}
+
 void mmDestroy(struct mem_block *heap)
 {
-	struct mem_block *p;
+	struct mem_chunk *chunk, *next;
 
 	if (!heap)
 		return;
 
-	for (p = heap->next; p != heap;) {
-		struct mem_block *next = p->next;
-		free(p);
-		p = next;
+	for (chunk = GetHeap(heap)->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
 	}
 
 	free(heap);
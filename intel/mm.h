@@ -38,15 +38,29 @@ struct mem_block {
 	unsigned int reserved:1;
 };
 
+/* Allocation policies for mmInitMode() */
+#define MM_FIRST_FIT		0 /* address-unordered first fit */
+#define MM_SEGREGATED_FIT	1 /* best fit over power-of-two size classes */
+
+struct mem_stats {
+	int free_size;		/* total bytes in free blocks */
+	int free_blocks;
+	int largest_free;	/* size of the largest free block */
+	int used_size;
+	int used_blocks;
+};
+
 /* Rename the variables in the drm copy of this code so that it doesn't
  * conflict with mesa or whoever else has copied it around.
  */
 #define mmInit drm_mmInit
+#define mmInitMode drm_mmInitMode
 #define mmAllocMem drm_mmAllocMem
 #define mmFreeMem drm_mmFreeMem
 #define mmFindBlock drm_mmFindBlock
 #define mmDestroy drm_mmDestroy
 #define mmDumpMemInfo drm_mmDumpMemInfo
+#define mmGetStats drm_mmGetStats
 
 /** 
  * input: total size in bytes
@@ -54,6 +68,13 @@ struct mem_block {
  */
 extern struct mem_block *mmInit(int ofs, int size);
 
+/**
+ * Like mmInit(), but selects the allocation policy.
+ * input:	mode = MM_FIRST_FIT or MM_SEGREGATED_FIT
+ * return: a heap pointer if OK, NULL if error
+ */
+extern struct mem_block *mmInitMode(int ofs, int size, int mode);
+
 /**
  * Allocate 'size' bytes with 2^align2 bytes alignment,
  * restrict the search to free memory after 'startSearch'
@@ -91,4 +112,9 @@ extern void mmDestroy(struct mem_block *mmInit);
  */
 extern void mmDumpMemInfo(const struct mem_block *mmInit);
 
+/**
+ * Fragmentation statistics, walks the whole heap.
+ */
+extern void mmGetStats(const struct mem_block *heap, struct mem_stats *stats);
+
 #endif
@@ -0,0 +1,206 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Runs texture churn through the fake bufmgr, using the fence and exec
+ * callbacks in place of the hardware.  Checks that a working set which
+ * fits the aperture is not uploaded again, that buffer contents survive
+ * eviction, and reports the eviction and upload counters:
+ *
+ *   test_bufmgr_fake [frames]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "config.h"
+#include "intel_bufmgr.h"
+#include "i915_drm.h"
+
+#define LOW_OFFSET	0x100000
+#define APERTURE_SIZE	(4 * 1024 * 1024)
+#define TEX_SIZE	(256 * 1024)
+#define NUM_TEX		24
+#define TEX_PER_FRAME	8
+
+struct fake_hw {
+	unsigned char *aperture;
+	unsigned int seq;
+	drm_intel_bo *target;
+	unsigned char frame;
+};
+
+static unsigned int
+fence_emit(void *priv)
+{
+	struct fake_hw *hw = priv;
+
+	return ++hw->seq;
+}
+
+static void
+fence_wait(unsigned int fence, void *priv)
+{
+}
+
+/* "Render" the frame number into the render target. */
+static int
+exec(drm_intel_bo *bo, unsigned int used, void *priv)
+{
+	struct fake_hw *hw = priv;
+
+	memset(hw->aperture + hw->target->offset - LOW_OFFSET, hw->frame,
+	       hw->target->size);
+	return 0;
+}
+
+static void
+fill(drm_intel_bo *bo, unsigned char value)
+{
+	if (drm_intel_bo_map(bo, 1))
+		errx(1, "map failed");
+	memset(bo->virtual, value, bo->size);
+	drm_intel_bo_unmap(bo);
+}
+
+static void
+check(drm_intel_bo *bo, unsigned char value, const char *what)
+{
+	const unsigned char *p;
+
+	if (drm_intel_bo_map(bo, 0))
+		errx(1, "map failed");
+	p = bo->virtual;
+	if (p[0] != value || p[bo->size - 1] != value)
+		errx(1, "%s: found %d, expected %d", what, p[0], value);
+	drm_intel_bo_unmap(bo);
+}
+
+static void
+draw(drm_intel_bufmgr *bufmgr, struct fake_hw *hw, drm_intel_bo **tex,
+     int first)
+{
+	drm_intel_bo *batch;
+	int i;
+
+	batch = drm_intel_bo_alloc(bufmgr, "batch", 4096, 4096);
+	for (i = 0; i < TEX_PER_FRAME; i++)
+		drm_intel_bo_emit_reloc(batch, i * 4,
+					tex[(first + i) % NUM_TEX], 0,
+					I915_GEM_DOMAIN_SAMPLER, 0);
+	drm_intel_bo_emit_reloc(batch, i * 4, hw->target, 0,
+				I915_GEM_DOMAIN_RENDER,
+				I915_GEM_DOMAIN_RENDER);
+
+	if (drm_intel_bo_exec(batch, 4096, NULL, 0, 0))
+		errx(1, "exec failed");
+	drm_intel_bo_unreference(batch);
+
+	check(hw->target, hw->frame, "render target");
+	hw->frame++;
+}
+
+int
+main(int argc, char **argv)
+{
+	static volatile unsigned int last_dispatch;
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bufmgr_fake_stats stats;
+	drm_intel_bo *tex[NUM_TEX];
+	struct fake_hw hw;
+	uint64_t uploaded[NUM_TEX], total;
+	int frames = 200;
+	int i;
+
+	if (argc > 1)
+		frames = atoi(argv[1]);
+
+	memset(&hw, 0, sizeof(hw));
+	hw.aperture = malloc(APERTURE_SIZE);
+	if (!hw.aperture)
+		errx(1, "out of memory");
+
+	bufmgr = drm_intel_bufmgr_fake_init(-1, LOW_OFFSET, hw.aperture,
+					    APERTURE_SIZE, &last_dispatch);
+	if (!bufmgr)
+		errx(1, "drm_intel_bufmgr_fake_init failed");
+	drm_intel_bufmgr_fake_set_fence_callback(bufmgr, fence_emit,
+						 fence_wait, &hw);
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, exec, &hw);
+
+	hw.target = drm_intel_bo_alloc(bufmgr, "target", TEX_SIZE, 4096);
+	for (i = 0; i < NUM_TEX; i++) {
+		tex[i] = drm_intel_bo_alloc(bufmgr, "texture", TEX_SIZE, 4096);
+		fill(tex[i], i);
+	}
+
+	/* A working set that fits is uploaded once and stays resident. */
+	draw(bufmgr, &hw, tex, 0);
+	for (i = 0; i < NUM_TEX; i++)
+		uploaded[i] = drm_intel_bo_fake_get_upload_bytes(tex[i]);
+	for (i = 0; i < 50; i++)
+		draw(bufmgr, &hw, tex, 0);
+	for (i = 0; i < NUM_TEX; i++) {
+		if (drm_intel_bo_fake_get_upload_bytes(tex[i]) != uploaded[i])
+			errx(1, "texture %d uploaded again", i);
+	}
+	drm_intel_bufmgr_fake_get_stats(bufmgr, &stats);
+	if (stats.evictions != 0)
+		errx(1, "%llu evictions with a fitting working set",
+		     (unsigned long long)stats.evictions);
+
+	/* Now slide the working set over more textures than fit. */
+	for (i = 0; i < frames; i++)
+		draw(bufmgr, &hw, tex, i * 3);
+
+	drm_intel_bufmgr_fake_get_stats(bufmgr, &stats);
+	if (stats.evictions == 0)
+		errx(1, "no evictions under churn");
+
+	total = drm_intel_bo_fake_get_upload_bytes(hw.target);
+	for (i = 0; i < NUM_TEX; i++) {
+		check(tex[i], i, "texture");
+		total += drm_intel_bo_fake_get_upload_bytes(tex[i]);
+	}
+	if (total > stats.upload_bytes)
+		errx(1, "per-buffer upload bytes exceed the total");
+
+	printf("%d frames: %llu evictions (%llu kB), %llu uploads (%llu kB), "
+	       "%llu kB read back, %llu fence waits\n", frames,
+	       (unsigned long long)stats.evictions,
+	       (unsigned long long)stats.evicted_bytes / 1024,
+	       (unsigned long long)stats.uploads,
+	       (unsigned long long)stats.upload_bytes / 1024,
+	       (unsigned long long)stats.readback_bytes / 1024,
+	       (unsigned long long)stats.fence_waits);
+
+	for (i = 0; i < NUM_TEX; i++)
+		drm_intel_bo_unreference(tex[i]);
+	drm_intel_bo_unreference(hw.target);
+	drm_intel_bufmgr_destroy(bufmgr);
+	free(hw.aperture);
+
+	return 0;
+}
@@ -32,6 +32,8 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <err.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "config.h"
 #include "intel_bufmgr.h"
@@ -39,12 +41,44 @@
 
 #define HW_OFFSET 0x12300000
 
+/* One batch file for the parallel and benchmark modes. */
+struct job {
+	const char *filename;
+	uint16_t devid;
+	void *data;
+	size_t size;
+	/* Number of packets in the batch, for benchmarking. */
+	int packets;
+
+	/* Decoded output, valid once done is set. */
+	char *output;
+	size_t output_size;
+	int done;
+};
+
+struct job_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct job *jobs;
+	int num_jobs;
+	/* Number of times each job is decoded, for benchmarking. */
+	int iterations;
+	/* Next job to hand out, counting through all iterations. */
+	int next;
+	/* Whether to keep the output or throw it away. */
+	int keep_output;
+};
+
 static void
 usage(void)
 {
 	fprintf(stderr, "usage:\n");
 	fprintf(stderr, "  test_decode <batch>\n");
 	fprintf(stderr, "  test_decode <batch> -dump\n");
+	fprintf(stderr, "  test_decode -j <threads> <batch>...\n");
+	fprintf(stderr, "  test_decode -bench <iterations> [-j <threads>] "
+		"<batch>...\n");
+	fprintf(stderr, "  test_decode -summary [-top <count>] <batch>...\n");
 	exit(1);
 }
 
@@ -85,6 +119,93 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	drm_intel_decode(ctx);
 }
 
+struct field_output {
+	FILE *out;
+	const struct drm_intel_decode_packet *packet;
+};
+
+static void
+print_field(void *closure, unsigned int index, uint32_t dword,
+	    const char *text)
+{
+	struct field_output *f = closure;
+
+	fprintf(f->out, "0x%08x:      0x%08x: %s%s\n",
+		f->packet->hw_offset + index * 4, dword,
+		index == 0 ? "" : "   ", text);
+}
+
+/* Returns the next dword line of the reference dump, or NULL. */
+static const char *
+next_dword_line(const char *line)
+{
+	while (line && *line) {
+		if (strncmp(line, "0x", 2) == 0)
+			return line;
+		line = strchr(line, '\n');
+		if (line)
+			line++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Walks the batch with the packet iterator, and checks that decoding the
+ * fields of each known packet gives the same dword lines as the reference.
+ * Unknown packets are skipped using their header length, which the text
+ * decoder doesn't trust.
+ */
+static void
+compare_iterator(struct drm_intel_decode *ctx, const char *ref,
+		 const char *ref_filename)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	struct drm_intel_decode_iter iter;
+	struct drm_intel_decode_packet packet;
+	struct field_output f;
+	char *fields, *expected;
+	size_t fields_size, expected_size;
+	FILE *ref_out;
+	const char *line = ref;
+	int ret;
+
+	f.out = open_memstream(&fields, &fields_size);
+	f.packet = &packet;
+	ref_out = open_memstream(&expected, &expected_size);
+
+	drm_intel_decode_iter_init(ctx, &iter);
+	while ((ret = drm_intel_decode_iter_next(&iter, &packet)) == 1) {
+		uint32_t end = packet.hw_offset + packet.len * 4;
+
+		if (packet.name)
+			drm_intel_decode_packet_fields(ctx, &packet,
+						       print_field, &f);
+
+		while ((line = next_dword_line(line)) != NULL &&
+		       strtoul(line, NULL, 16) < end) {
+			const char *eol = strchr(line, '\n');
+
+			if (packet.name)
+				fwrite(line, 1, eol - line + 1, ref_out);
+			line = eol + 1;
+		}
+	}
+	fclose(f.out);
+	fclose(ref_out);
+
+	/* Pre-gen4 3D packets can't be iterated over. */
+	if (ret == 0 && strcmp(expected, fields) != 0) {
+		fprintf(stderr, "Packet iterator mismatch with reference `%s'.\n",
+			ref_filename);
+		exit(1);
+	}
+
+	free(fields);
+	free(expected);
+#endif
+}
+
 static void
 compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 {
@@ -126,6 +247,8 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 		exit(1);
 	}
 
+	compare_iterator(ctx, ref_ptr, ref_filename);
+
 	fclose(out);
 	free(ref_filename);
 	free(ptr);
@@ -164,6 +287,283 @@ infer_devid(const char *batch_filename)
 	exit(1);
 }
 
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+decode_thread(void *arg)
+{
+	struct job_queue *queue = arg;
+	FILE *null_out;
+
+	null_out = fopen("/dev/null", "w");
+	if (!null_out)
+		err(1, "couldn't open /dev/null");
+
+	for (;;) {
+		struct drm_intel_decode *ctx;
+		struct job *job;
+		FILE *out;
+		int n;
+
+		pthread_mutex_lock(&queue->lock);
+		n = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+		if (n >= queue->num_jobs * queue->iterations)
+			break;
+		job = &queue->jobs[n % queue->num_jobs];
+
+		/* Each thread decodes with its own context. */
+		ctx = drm_intel_decode_context_alloc(job->devid);
+		if (!ctx)
+			errx(1, "couldn't allocate decode context");
+
+		if (queue->keep_output) {
+#ifdef HAVE_OPEN_MEMSTREAM
+			out = open_memstream(&job->output, &job->output_size);
+#else
+			errx(1, "platform lacks open_memstream");
+#endif
+		} else {
+			out = null_out;
+		}
+
+		drm_intel_decode_set_batch_pointer(ctx, job->data, HW_OFFSET,
+						   job->size / 4);
+		drm_intel_decode_set_output_file(ctx, out);
+		drm_intel_decode(ctx);
+		drm_intel_decode_context_free(ctx);
+
+		if (queue->keep_output) {
+			fclose(out);
+
+			pthread_mutex_lock(&queue->lock);
+			job->done = 1;
+			pthread_cond_broadcast(&queue->cond);
+			pthread_mutex_unlock(&queue->lock);
+		}
+	}
+
+	fclose(null_out);
+	return NULL;
+}
+
+/**
+ * Decodes the batches on num_threads threads, either printing the output
+ * in the order of the batches, or discarding it and reporting throughput.
+ */
+static void
+decode_parallel(struct job *jobs, int num_jobs, int num_threads,
+		int iterations)
+{
+	struct job_queue queue;
+	pthread_t *threads;
+	size_t total = 0;
+	long packets = 0;
+	double start;
+	int i;
+
+	memset(&queue, 0, sizeof(queue));
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	queue.jobs = jobs;
+	queue.num_jobs = num_jobs;
+	queue.iterations = iterations ? iterations : 1;
+	queue.keep_output = iterations == 0;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads)
+		errx(1, "out of memory");
+
+	start = get_time();
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, decode_thread, &queue))
+			errx(1, "couldn't create decode thread");
+	}
+
+	/* Print each batch as soon as it and all before it are done. */
+	for (i = 0; queue.keep_output && i < num_jobs; i++) {
+		pthread_mutex_lock(&queue.lock);
+		while (!jobs[i].done)
+			pthread_cond_wait(&queue.cond, &queue.lock);
+		pthread_mutex_unlock(&queue.lock);
+
+		fwrite(jobs[i].output, 1, jobs[i].output_size, stdout);
+		free(jobs[i].output);
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (iterations) {
+		double elapsed = get_time() - start;
+
+		for (i = 0; i < num_jobs; i++) {
+			total += jobs[i].size;
+			packets += jobs[i].packets;
+		}
+		total *= iterations;
+		packets *= iterations;
+
+		printf("%d threads: %d batches in %.3f s, %.0f batches/s, "
+		       "%.0f packets/s, %.1f MB/s\n", num_threads,
+		       num_jobs * iterations, elapsed,
+		       num_jobs * iterations / elapsed, packets / elapsed,
+		       total / elapsed / (1024 * 1024));
+	}
+
+	free(threads);
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.lock);
+}
+
+/**
+ * Counts the packets the decoder will walk over in the batch.  Pre-gen4
+ * batches can't be iterated over, so those count as one packet a dword.
+ */
+static int
+count_packets(const struct job *job)
+{
+	struct drm_intel_decode *ctx;
+	struct drm_intel_decode_iter iter;
+	struct drm_intel_decode_packet packet;
+	int ret, packets = 0;
+
+	ctx = drm_intel_decode_context_alloc(job->devid);
+	if (!ctx)
+		errx(1, "couldn't allocate decode context");
+	drm_intel_decode_set_batch_pointer(ctx, job->data, HW_OFFSET,
+					   job->size / 4);
+
+	drm_intel_decode_iter_init(ctx, &iter);
+	while ((ret = drm_intel_decode_iter_next(&iter, &packet)) > 0)
+		packets++;
+	if (ret < 0)
+		packets = job->size / 4;
+
+	drm_intel_decode_context_free(ctx);
+	return packets;
+}
+
+static int
+parallel_main(int argc, char **argv)
+{
+	struct job *jobs;
+	int num_threads = 0, iterations = 0;
+	int i, num_jobs;
+
+	for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+		if (strcmp(argv[i], "-j") == 0)
+			num_threads = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-bench") == 0)
+			iterations = atoi(argv[i + 1]);
+		else
+			usage();
+	}
+	if (i == argc || (iterations == 0 && num_threads <= 0))
+		usage();
+
+	num_jobs = argc - i;
+	jobs = calloc(num_jobs, sizeof(*jobs));
+	if (!jobs)
+		errx(1, "out of memory");
+
+	for (i = 0; i < num_jobs; i++) {
+		jobs[i].filename = argv[argc - num_jobs + i];
+		jobs[i].devid = infer_devid(jobs[i].filename);
+		read_file(jobs[i].filename, &jobs[i].data, &jobs[i].size);
+		jobs[i].packets = count_packets(&jobs[i]);
+	}
+
+	if (iterations == 0) {
+		decode_parallel(jobs, num_jobs, num_threads, 0);
+	} else if (num_threads > 0) {
+		decode_parallel(jobs, num_jobs, num_threads, iterations);
+	} else {
+		/* Compare a single thread against one per CPU. */
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		decode_parallel(jobs, num_jobs, 1, iterations);
+		if (num_threads > 1)
+			decode_parallel(jobs, num_jobs, num_threads,
+					iterations);
+	}
+
+	for (i = 0; i < num_jobs; i++)
+		munmap(jobs[i].data, jobs[i].size);
+	free(jobs);
+
+	return 0;
+}
+
+/**
+ * Prints packet statistics for the batches, aggregated over all the
+ * batches for each device.
+ */
+static int
+summary_main(int argc, char **argv)
+{
+	struct {
+		uint16_t devid;
+		struct drm_intel_decode *ctx;
+	} *devices;
+	int num_devices = 0, top = 20;
+	int i, j;
+
+	for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-top") == 0)
+			top = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-summary") != 0)
+			usage();
+	}
+	if (i == argc)
+		usage();
+
+	devices = calloc(argc - i, sizeof(*devices));
+	if (!devices)
+		errx(1, "out of memory");
+
+	for (; i < argc; i++) {
+		uint16_t devid = infer_devid(argv[i]);
+		void *data;
+		size_t size;
+
+		for (j = 0; j < num_devices; j++) {
+			if (devices[j].devid == devid)
+				break;
+		}
+		if (j == num_devices) {
+			devices[j].devid = devid;
+			devices[j].ctx = drm_intel_decode_context_alloc(devid);
+			if (!devices[j].ctx)
+				errx(1, "couldn't allocate decode context");
+			drm_intel_decode_set_summary(devices[j].ctx, 1);
+			num_devices++;
+		}
+
+		read_file(argv[i], &data, &size);
+		drm_intel_decode_set_batch_pointer(devices[j].ctx, data,
+						   HW_OFFSET, size / 4);
+		drm_intel_decode(devices[j].ctx);
+		munmap(data, size);
+	}
+
+	for (j = 0; j < num_devices; j++) {
+		printf("%sdevice 0x%04x: ", j ? "\n" : "", devices[j].devid);
+		fflush(stdout);
+		drm_intel_decode_print_summary(devices[j].ctx, top);
+		drm_intel_decode_context_free(devices[j].ctx);
+	}
+	free(devices);
+
+	return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -173,6 +573,11 @@ main(int argc, char **argv)
 	if (argc < 2)
 		usage();
 
+	if (strcmp(argv[1], "-summary") == 0)
+		return summary_main(argc, argv);
+	if (argv[1][0] == '-')
+		return parallel_main(argc, argv);
+
 
 	devid = infer_devid(argv[1]);
 
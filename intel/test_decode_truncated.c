@@ -0,0 +1,226 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Decodes batches that end in the middle of a packet, placed right before
+ * an inaccessible page, so that the decoder crashes if it reads past the
+ * end of the batch it was given.  Each truncated packet is tried at the
+ * end of a short batch and of one long enough to be decoded in place.
+ *
+ * The decoder reads a batch in place up to TAIL_DWORDS from its end, and
+ * the rest from a padded copy.  Batch lengths within a packet's length of
+ * that boundary are tried with the packet ending one dword short, and
+ * with the packet starting TAIL_DWORDS + 1 dwords from the end, the last
+ * one read in place, where the longest packets claim dwords past the end.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "intel_bufmgr.h"
+
+#define HW_OFFSET	0x12300000
+#define MAX_DWORDS	4096
+/* DECODE_TAIL_DWORDS in intel_decode.c */
+#define TAIL_DWORDS	2048
+
+static const uint16_t devids[] = {
+	0x3577,		/* i830 */
+	0x2582,		/* i915G */
+	0x2a42,		/* GM45 */
+	0x0046,		/* Ironlake */
+	0x0126,		/* Sandybridge */
+	0x0162,		/* Ivybridge */
+};
+
+/* Packet headers, most of them claiming more dwords than follow. */
+static const uint32_t headers[] = {
+	0x00000000,	/* MI_NOOP */
+	0x05000000,	/* MI_BATCH_BUFFER_END */
+	0x11000001,	/* MI_LOAD_REGISTER_IMM */
+	0x54c00006,	/* XY_SRC_COPY_BLT */
+	0x50400003,	/* XY_COLOR_BLT */
+	0x78000005,	/* 3DSTATE_PIPELINED_POINTERS */
+	0x780800ff,	/* 3DSTATE_VERTEX_BUFFERS */
+	0x780900ff,	/* 3DSTATE_VERTEX_ELEMENTS */
+	0x79050005,	/* 3DSTATE_DEPTH_BUFFER */
+	0x7a000002,	/* PIPE_CONTROL */
+	0x7b000004,	/* 3DPRIMITIVE */
+	0x7d0400ff,	/* i915 3DSTATE_LOAD_STATE_IMMEDIATE_1 */
+	0x7d0500ff,	/* i915 3DSTATE_PIXEL_SHADER_PROGRAM */
+	0x7f00ffff,	/* i915 PRIM3D */
+	0x7fffffff,	/* unknown 3D */
+};
+
+/* The dwords each of the headers claims, on the gens that know it. */
+static const int claims[] = {
+	1, 1, 3, 8, 5, 7, 257, 257, 7, 4, 6, 257, 257, 65537, 257,
+};
+
+static uint32_t *
+alloc_guarded(size_t *size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	char *map;
+
+	*size = (MAX_DWORDS * 4 + page - 1) / page * page;
+	map = mmap(NULL, *size + page, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		err(1, "mmap");
+	if (mprotect(map + *size, page, PROT_NONE))
+		err(1, "mprotect");
+
+	return (uint32_t *)map;
+}
+
+/* MI_NOOPs up to the packet, then its header at \p start and 0xff dwords. */
+static uint32_t *
+fill(uint32_t *map, size_t size, int count, int start, uint32_t header)
+{
+	uint32_t *batch = map + size / 4 - count;
+
+	memset(batch, 0, start * 4);
+	batch[start] = header;
+	memset(batch + start + 1, 0xff, (count - start - 1) * 4);
+
+	return batch;
+}
+
+static void
+decode(uint16_t devid, uint32_t *batch, int count, FILE *out)
+{
+	struct drm_intel_decode *ctx;
+	struct drm_intel_decode_iter iter;
+	struct drm_intel_decode_packet packet;
+	int ret;
+
+	ctx = drm_intel_decode_context_alloc(devid);
+	if (!ctx)
+		errx(1, "couldn't allocate decode context");
+	drm_intel_decode_set_batch_pointer(ctx, batch, HW_OFFSET, count);
+	drm_intel_decode_set_output_file(ctx, out);
+
+	drm_intel_decode(ctx);
+
+	drm_intel_decode_set_dump_past_end(ctx, 1);
+	drm_intel_decode(ctx);
+
+	drm_intel_decode_set_summary(ctx, 1);
+	drm_intel_decode(ctx);
+
+	drm_intel_decode_iter_init(ctx, &iter);
+	while ((ret = drm_intel_decode_iter_next(&iter, &packet)) > 0) {
+		if (packet.data + packet.len > batch + count)
+			errx(1, "0x%04x: packet at 0x%08x runs past the end",
+			     devid, packet.hw_offset);
+		if (packet.truncated &&
+		    packet.data + packet.len != batch + count)
+			errx(1, "0x%04x: truncated packet at 0x%08x "
+			     "isn't the last one", devid, packet.hw_offset);
+	}
+
+	drm_intel_decode_context_free(ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int lengths[] = { 1, 2, 3, 8, MAX_DWORDS };
+	uint32_t *map, *batch;
+	size_t size;
+	unsigned int d, h, l, tail;
+	int count, deltas[8], n, start, runs = 0;
+	FILE *out;
+
+	out = fopen("/dev/null", "w");
+	if (!out)
+		err(1, "couldn't open /dev/null");
+	map = alloc_guarded(&size);
+
+	for (d = 0; d < sizeof(devids) / sizeof(devids[0]); d++) {
+		for (h = 0; h < sizeof(headers) / sizeof(headers[0]); h++) {
+			for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]);
+			     l++) {
+				for (tail = 0; tail < 4; tail++) {
+					count = lengths[l];
+					if (count < (int)tail + 1)
+						continue;
+
+					batch = fill(map, size, count,
+						     count - tail - 1,
+						     headers[h]);
+					decode(devids[d], batch, count, out);
+					runs++;
+				}
+			}
+
+			/* around where the decoder stops reading in place */
+			n = claims[h];
+			deltas[0] = -n - 1;
+			deltas[1] = -n;
+			deltas[2] = -1;
+			deltas[3] = 0;
+			deltas[4] = 1;
+			deltas[5] = n - 1;
+			deltas[6] = n;
+			deltas[7] = n + 1;
+			for (l = 0; l < 8; l++) {
+				count = TAIL_DWORDS + deltas[l];
+				if (count < 1 || count > MAX_DWORDS)
+					continue;
+
+				/* one dword short, unless it's just one */
+				start = count - n + 1;
+				if (start < 0)
+					start = 0;
+				if (start == count)
+					start--;
+				batch = fill(map, size, count, start,
+					     headers[h]);
+				decode(devids[d], batch, count, out);
+				runs++;
+
+				if (count < TAIL_DWORDS + 1)
+					continue;
+				batch = fill(map, size, count,
+					     count - TAIL_DWORDS - 1,
+					     headers[h]);
+				decode(devids[d], batch, count, out);
+				runs++;
+			}
+		}
+	}
+
+	printf("%d truncated batches decoded\n", runs);
+
+	munmap(map, size + sysconf(_SC_PAGESIZE));
+	fclose(out);
+
+	return 0;
+}
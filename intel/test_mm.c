@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2013 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Randomized alloc/free workload over the mm.c heap, resembling fake
+ * bufmgr aperture traffic.  Checks the heap invariants for every policy
+ * and reports throughput and fragmentation, so the policies can be
+ * compared:
+ *
+ *   test_mm [iterations]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <err.h>
+
+#include "config.h"
+#include "xf86drm.h"
+#include "mm.h"
+
+#define HEAP_OFFSET	0x10000
+#define HEAP_SIZE	(64 * 1024 * 1024)
+#define MAX_LIVE	1024
+#define CHECK_INTERVAL	1024
+
+struct result {
+	double seconds;
+	int allocs;
+	int failed;
+	double avg_frag;
+};
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Mostly small buffers, with the occasional large texture. */
+static int
+random_size(void *rand)
+{
+	unsigned long r = drmRandom(rand);
+
+	if (r % 16 == 0)
+		return (1 + r / 16 % 256) * 4096;
+	return (1 + r / 16 % 16) * 4096 - (r / 256 % 2) * 2048;
+}
+
+static void
+check_heap(struct mem_block *heap, const char *name)
+{
+	const struct mem_block *p;
+	struct mem_stats stats;
+	int ofs = HEAP_OFFSET;
+
+	for (p = heap->next; p != heap; p = p->next) {
+		if (p->ofs != ofs)
+			errx(1, "%s: block at %08x, expected %08x",
+			     name, p->ofs, ofs);
+		if (p->free && p->next != heap && p->next->free)
+			errx(1, "%s: adjacent free blocks at %08x",
+			     name, p->ofs);
+		ofs += p->size;
+	}
+	if (ofs != HEAP_OFFSET + HEAP_SIZE)
+		errx(1, "%s: heap ends at %08x", name, ofs);
+
+	mmGetStats(heap, &stats);
+	if (stats.free_size + stats.used_size != HEAP_SIZE)
+		errx(1, "%s: stats don't add up", name);
+}
+
+static void
+run(int mode, const char *name, int iterations, struct result *res)
+{
+	struct mem_block *heap, *live[MAX_LIVE];
+	struct mem_stats stats;
+	void *rand;
+	double start, frag = 0;
+	int i, n = 0, samples = 0, idx;
+
+	heap = mmInitMode(HEAP_OFFSET, HEAP_SIZE, mode);
+	if (!heap)
+		errx(1, "%s: mmInitMode failed", name);
+	rand = drmRandomCreate(1);
+
+	res->allocs = 0;
+	res->failed = 0;
+	res->seconds = 0;
+
+	start = get_time();
+	for (i = 0; i < iterations; i++) {
+		if (n < MAX_LIVE && (n == 0 || drmRandom(rand) % 8 < 5)) {
+			int align = drmRandom(rand) % 4 ? 12 : 16;
+			struct mem_block *b;
+
+			b = mmAllocMem(heap, random_size(rand), align, 0);
+			res->allocs++;
+			if (b)
+				live[n++] = b;
+			else
+				res->failed++;
+		} else {
+			idx = drmRandom(rand) % n;
+			mmFreeMem(live[idx]);
+			live[idx] = live[--n];
+		}
+
+		/* Keep the checks out of the timed part. */
+		if (i % CHECK_INTERVAL == 0) {
+			res->seconds += get_time() - start;
+			check_heap(heap, name);
+			mmGetStats(heap, &stats);
+			if (stats.free_size)
+				frag += 1.0 - (double)stats.largest_free /
+					stats.free_size;
+			samples++;
+			start = get_time();
+		}
+	}
+	res->seconds += get_time() - start;
+
+	while (n)
+		mmFreeMem(live[--n]);
+	check_heap(heap, name);
+	mmGetStats(heap, &stats);
+	if (stats.free_blocks != 1 || stats.used_blocks != 0)
+		errx(1, "%s: heap not empty after freeing everything", name);
+
+	res->avg_frag = samples ? frag / samples : 0;
+
+	drmRandomDestroy(rand);
+	mmDestroy(heap);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct {
+		int mode;
+		const char *name;
+	} modes[] = {
+		{ MM_FIRST_FIT, "first-fit" },
+		{ MM_SEGREGATED_FIT, "segregated-fit" },
+	};
+	struct result res;
+	int iterations = 200000;
+	unsigned int i;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		run(modes[i].mode, modes[i].name, iterations, &res);
+		printf("%-16s %8.0f ops/s, %d/%d allocations failed, "
+		       "%.1f%% average fragmentation\n",
+		       modes[i].name, iterations / res.seconds,
+		       res.failed, res.allocs, res.avg_frag * 100);
+	}
+
+	return 0;
+}
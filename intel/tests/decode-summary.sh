@@ -0,0 +1,22 @@
+#!/bin/sh
+
+# Checks the packet statistics of the summary mode against the reference.
+
+TEST_DIR=`dirname "$0"`
+REF_FILENAME="$TEST_DIR/decode-summary-ref.txt"
+NEW_FILENAME="$TEST_DIR/decode-summary-new.txt"
+
+./test_decode -summary -top 10 $TEST_DIR/gm45-3d.batch \
+	$TEST_DIR/gen7-3d.batch $TEST_DIR/gen7-2d-copy.batch > $NEW_FILENAME
+
+ret=$?
+if test $ret = 0; then
+    diff -u $REF_FILENAME $NEW_FILENAME
+    ret=$?
+fi
+
+if test $ret = 0; then
+    rm -f $NEW_FILENAME
+fi
+
+exit $ret
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# Decodes all the test batches on several threads at once, and checks that
+# the output matches the references, in order.
+
+TEST_DIR=`dirname "$0"`
+REF_FILENAME="$TEST_DIR/parallel-decode-ref-new.txt"
+NEW_FILENAME="$TEST_DIR/parallel-decode-new.txt"
+
+cat $TEST_DIR/*.batch-ref.txt > $REF_FILENAME
+./test_decode -j 4 $TEST_DIR/*.batch > $NEW_FILENAME
+
+ret=$?
+if test $ret = 0; then
+    diff -u $REF_FILENAME $NEW_FILENAME
+    ret=$?
+fi
+
+if test $ret = 0; then
+    rm -f $REF_FILENAME $NEW_FILENAME
+fi
+
+exit $ret
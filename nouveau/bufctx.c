@@ -42,6 +42,7 @@ struct nouveau_bufref_priv {
 	struct nouveau_bufref base;
 	struct nouveau_bufref_priv *next;
 	struct nouveau_bufctx *bufctx;
+	uint32_t gen;
 };
 
 static inline struct nouveau_bufref_priv *
@@ -50,14 +51,26 @@ nouveau_bufref(struct nouveau_bufref *bctx)
 	return (struct nouveau_bufref_priv *)bctx;
 }
 
+/* References validated since the last flush move from pending to
+ * current and get the bufctx's generation, which the flush bumps.
+ * Resetting a bin keeps those as its stale list, in the order they were
+ * added, so that adding the same buffers again puts them straight back
+ * on the current list instead of validating them again.  The pushbuf
+ * holds on to their buffers until the flush, after which the stale list
+ * is useless and dropped.  Method references aren't kept, since their
+ * methods are emitted when they are validated.
+ */
 struct nouveau_bufbin_priv {
 	struct nouveau_bufref_priv *list;
+	struct nouveau_bufref_priv *stale;
+	uint32_t stale_gen;
 	int relocs;
 };
 
 struct nouveau_bufctx_priv {
 	struct nouveau_bufctx base;
 	struct nouveau_bufref_priv *free;
+	uint32_t gen;
 	int nr_bins;
 	struct nouveau_bufbin_priv bins[];
 };
@@ -80,6 +93,7 @@ nouveau_bufctx_new(struct nouveau_client *client, int bins,
 		DRMINITLISTHEAD(&priv->base.pending);
 		DRMINITLISTHEAD(&priv->base.current);
 		priv->base.client = client;
+		priv->gen = 1;
 		priv->nr_bins = bins;
 		*pbctx = &priv->base;
 		return 0;
@@ -88,14 +102,29 @@ nouveau_bufctx_new(struct nouveau_client *client, int bins,
 	return -ENOMEM;
 }
 
+static void
+bufctx_free_stale(struct nouveau_bufctx_priv *pctx,
+		  struct nouveau_bufbin_priv *pbin)
+{
+	struct nouveau_bufref_priv *pref;
+
+	while ((pref = pbin->stale)) {
+		pbin->stale = pref->next;
+		pref->next = pctx->free;
+		pctx->free = pref;
+	}
+}
+
 void
 nouveau_bufctx_del(struct nouveau_bufctx **pbctx)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(*pbctx);
 	struct nouveau_bufref_priv *pref;
 	if (pctx) {
-		while (pctx->nr_bins--)
+		while (pctx->nr_bins--) {
 			nouveau_bufctx_reset(&pctx->base, pctx->nr_bins);
+			bufctx_free_stale(pctx, &pctx->bins[pctx->nr_bins]);
+		}
 		while ((pref = pctx->free)) {
 			pctx->free = pref->next;
 			free(pref);
@@ -112,20 +141,53 @@ nouveau_bufctx_reset(struct nouveau_bufctx *bctx, int bin)
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
 	struct nouveau_bufref_priv *pref;
 
+	bufctx_free_stale(pctx, pbin);
+	pbin->stale_gen = pctx->gen;
+
+	/* the list is newest first, so this keeps the stale list in the
+	 * order the references were added
+	 */
 	while ((pref = pbin->list)) {
 		DRMLISTDELINIT(&pref->base.thead);
 		pbin->list = pref->next;
-		pref->next = pctx->free;
-		pctx->free = pref;
+		if (pref->gen == pctx->gen && !pref->base.packet) {
+			pref->next = pbin->stale;
+			pbin->stale = pref;
+		} else {
+			pref->next = pctx->free;
+			pctx->free = pref;
+		}
 	}
 
 	bctx->relocs -= pbin->relocs;
 	pbin->relocs  = 0;
 }
 
-struct nouveau_bufref *
-nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
-		    struct nouveau_bo *bo, uint32_t flags)
+static struct nouveau_bufref_priv *
+bufctx_reuse(struct nouveau_bufctx_priv *pctx, struct nouveau_bufbin_priv *pbin,
+	     struct nouveau_bo *bo, uint32_t flags)
+{
+	struct nouveau_bufref_priv **ppref, *pref;
+
+	if (pbin->stale && pbin->stale_gen != pctx->gen)
+		bufctx_free_stale(pctx, pbin);
+
+	for (ppref = &pbin->stale; (pref = *ppref); ppref = &pref->next) {
+		if (pref->base.bo == bo && pref->base.flags == flags) {
+			*ppref = pref->next;
+			DRMLISTADDTAIL(&pref->base.thead, &pctx->base.current);
+			pref->next = pbin->list;
+			pbin->list = pref;
+			return pref;
+		}
+	}
+
+	return NULL;
+}
+
+static struct nouveau_bufref *
+bufctx_refn(struct nouveau_bufctx *bctx, int bin,
+	    struct nouveau_bo *bo, uint32_t flags)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
@@ -140,6 +202,7 @@ nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
 		pref->base.bo = bo;
 		pref->base.flags = flags;
 		pref->base.packet = 0;
+		pref->gen = 0;
 
 		DRMLISTADDTAIL(&pref->base.thead, &bctx->pending);
 		pref->bufctx = bctx;
@@ -150,6 +213,23 @@ nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
 	return &pref->base;
 }
 
+struct nouveau_bufref *
+nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
+		    struct nouveau_bo *bo, uint32_t flags)
+{
+	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
+	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
+	struct nouveau_bufref_priv *pref;
+
+	if (pbin->stale) {
+		pref = bufctx_reuse(pctx, pbin, bo, flags);
+		if (pref)
+			return &pref->base;
+	}
+
+	return bufctx_refn(bctx, bin, bo, flags);
+}
+
 struct nouveau_bufref *
 nouveau_bufctx_mthd(struct nouveau_bufctx *bctx, int bin, uint32_t packet,
 		    struct nouveau_bo *bo, uint64_t data, uint32_t flags,
@@ -157,7 +237,7 @@ nouveau_bufctx_mthd(struct nouveau_bufctx *bctx, int bin, uint32_t packet,
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
-	struct nouveau_bufref *bref = nouveau_bufctx_refn(bctx, bin, bo, flags);
+	struct nouveau_bufref *bref = bufctx_refn(bctx, bin, bo, flags);
 	if (bref) {
 		bref->packet = packet;
 		bref->data = data;
@@ -168,3 +248,29 @@ nouveau_bufctx_mthd(struct nouveau_bufctx *bctx, int bin, uint32_t packet,
 	}
 	return bref;
 }
+
+/* Called by the pushbuf once it has been through the pending references,
+ * whether or not they all made it into the krec, and when it's flushed
+ * and they need validating again.
+ */
+void
+bufctx_validated(struct nouveau_bufctx *bctx, bool valid)
+{
+	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
+	struct nouveau_bufref *bref;
+
+	DRMLISTFOREACHENTRY(bref, &bctx->pending, thead)
+		nouveau_bufref(bref)->gen = valid ? pctx->gen : 0;
+	DRMLISTJOIN(&bctx->pending, &bctx->current);
+	DRMINITLISTHEAD(&bctx->pending);
+}
+
+void
+bufctx_flushed(struct nouveau_bufctx *bctx)
+{
+	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
+
+	DRMLISTJOIN(&bctx->current, &bctx->pending);
+	DRMINITLISTHEAD(&bctx->current);
+	pctx->gen++;
+}
@@ -69,12 +69,27 @@ nouveau_device_open_existing(struct nouveau_device **pdev, int close, int fd,
 	return -EACCES;
 }
 
+static int
+nouveau_query_param(int fd, uint64_t param, uint64_t *value)
+{
+	struct drm_nouveau_getparam r = { param, 0 };
+	int ret = drmCommandWriteRead(fd, DRM_NOUVEAU_GETPARAM, &r, sizeof(r));
+	*value = r.value;
+	return ret;
+}
+
 int
 nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 {
 	struct nouveau_device_priv *nvdev = calloc(1, sizeof(*nvdev));
 	struct nouveau_device *dev = &nvdev->base;
-	uint64_t chipset, vram, gart, bousage;
+	drmParam params[] = {
+		{ NOUVEAU_GETPARAM_CHIPSET_ID },
+		{ NOUVEAU_GETPARAM_FB_SIZE },
+		{ NOUVEAU_GETPARAM_AGP_SIZE },
+		{ NOUVEAU_GETPARAM_HAS_BO_USAGE },
+	};
+	const drmFdInfo *info;
 	drmVersionPtr ver;
 	int ret;
 	char *tmp;
@@ -87,11 +102,21 @@ nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 		return -ENOMEM;
 	nvdev->base.fd = fd;
 
-	ver = drmGetVersion(fd);
-	if (ver) dev->drm_version = (ver->version_major << 24) |
-				    (ver->version_minor << 8) |
-				     ver->version_patchlevel;
-	drmFreeVersion(ver);
+	/* use the version cached on the fd if there is one, but don't go
+	 * through the rest of what drmGetFdInfo() gathers just for it
+	 */
+	info = drmGetCachedFdInfo(fd);
+	if (info) {
+		dev->drm_version = (info->version_major << 24) |
+				   (info->version_minor << 8) |
+				    info->version_patchlevel;
+	} else {
+		ver = drmGetVersion(fd);
+		if (ver) dev->drm_version = (ver->version_major << 24) |
+					    (ver->version_minor << 8) |
+					     ver->version_patchlevel;
+		drmFreeVersion(ver);
+	}
 
 	if ( dev->drm_version != 0x00000010 &&
 	    (dev->drm_version <  0x01000000 ||
@@ -100,19 +125,20 @@ nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 		return -EINVAL;
 	}
 
-	ret = nouveau_getparam(dev, NOUVEAU_GETPARAM_CHIPSET_ID, &chipset);
+	drmGetParams(fd, DRM_NOUVEAU_GETPARAM, nouveau_query_param,
+		     params, 4);
+	ret = params[0].ret;
 	if (ret == 0)
-	ret = nouveau_getparam(dev, NOUVEAU_GETPARAM_FB_SIZE, &vram);
+	ret = params[1].ret;
 	if (ret == 0)
-	ret = nouveau_getparam(dev, NOUVEAU_GETPARAM_AGP_SIZE, &gart);
+	ret = params[2].ret;
 	if (ret) {
 		nouveau_device_del(&dev);
 		return ret;
 	}
 
-	ret = nouveau_getparam(dev, NOUVEAU_GETPARAM_HAS_BO_USAGE, &bousage);
-	if (ret == 0)
-		nvdev->have_bo_usage = (bousage != 0);
+	if (params[3].ret == 0)
+		nvdev->have_bo_usage = (params[3].value != 0);
 
 	nvdev->close = close;
 
@@ -129,9 +155,9 @@ nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 	DRMINITLISTHEAD(&nvdev->bo_list);
 	nvdev->base.object.oclass = NOUVEAU_DEVICE_CLASS;
 	nvdev->base.lib_version = 0x01000000;
-	nvdev->base.chipset = chipset;
-	nvdev->base.vram_size = vram;
-	nvdev->base.gart_size = gart;
+	nvdev->base.chipset = params[0].value;
+	nvdev->base.vram_size = params[1].value;
+	nvdev->base.gart_size = params[2].value;
 	nvdev->base.vram_limit =
 		(nvdev->base.vram_size * nvdev->vram_limit_percent) / 100;
 	nvdev->base.gart_limit =
@@ -169,11 +195,7 @@ nouveau_device_del(struct nouveau_device **pdev)
 int
 nouveau_getparam(struct nouveau_device *dev, uint64_t param, uint64_t *value)
 {
-	struct drm_nouveau_getparam r = { param, 0 };
-	int fd = dev->fd, ret =
-		drmCommandWriteRead(fd, DRM_NOUVEAU_GETPARAM, &r, sizeof(r));
-	*value = r.value;
-	return ret;
+	return nouveau_query_param(dev->fd, param, value);
 }
 
 int
@@ -183,6 +205,89 @@ nouveau_setparam(struct nouveau_device *dev, uint64_t param, uint64_t value)
 	return drmCommandWrite(dev->fd, DRM_NOUVEAU_SETPARAM, &r, sizeof(r));
 }
 
+static void
+cli_kref_insert(struct nouveau_client_priv *pcli,
+		struct nouveau_client_kref *ckref)
+{
+	unsigned i = cli_kref_hash(pcli, ckref->handle);
+
+	while (pcli->kref[i].handle)
+		i = (i + 1) & (pcli->kref_nr - 1);
+	pcli->kref[i] = *ckref;
+	pcli->kref_used++;
+}
+
+/* Makes sure one more kref can be set without allocating. */
+int
+cli_kref_reserve(struct nouveau_client *client)
+{
+	struct nouveau_client_priv *pcli = nouveau_client(client);
+	struct nouveau_client_kref *old = pcli->kref;
+	unsigned old_nr = pcli->kref_nr, nr, i;
+
+	if ((pcli->kref_used + 1) * 2 <= old_nr)
+		return 0;
+
+	nr = old_nr ? old_nr * 2 : 64;
+	pcli->kref = calloc(nr, sizeof(*pcli->kref));
+	if (!pcli->kref) {
+		pcli->kref = old;
+		return -ENOMEM;
+	}
+	pcli->kref_nr = nr;
+	pcli->kref_used = 0;
+	pcli->kref_shift = 32 - (ffs(nr) - 1);
+
+	for (i = 0; i < old_nr; i++) {
+		if (old[i].handle)
+			cli_kref_insert(pcli, &old[i]);
+	}
+	free(old);
+	return 0;
+}
+
+/* Setting a NULL kref and pushbuf removes the buffer from the table,
+ * anything else must have been preceded by cli_kref_reserve().
+ */
+void
+cli_kref_set(struct nouveau_client *client, struct nouveau_bo *bo,
+	     struct drm_nouveau_gem_pushbuf_bo *kref,
+	     struct nouveau_pushbuf *push)
+{
+	struct nouveau_client_priv *pcli = nouveau_client(client);
+	struct nouveau_client_kref *ckref = cli_kref_find(pcli, bo->handle);
+	struct nouveau_client_kref new = { kref, push, bo->handle };
+	unsigned mask = pcli->kref_nr - 1, i, j, k;
+
+	if (kref || push) {
+		if (ckref)
+			*ckref = new;
+		else
+			cli_kref_insert(pcli, &new);
+		return;
+	}
+
+	if (!ckref)
+		return;
+
+	/* close the gap, so that lookups don't need tombstones */
+	i = j = ckref - pcli->kref;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!pcli->kref[j].handle)
+			break;
+		k = cli_kref_hash(pcli, pcli->kref[j].handle);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		pcli->kref[i] = pcli->kref[j];
+		i = j;
+	}
+	pcli->kref[i].handle = 0;
+	pcli->kref[i].kref = NULL;
+	pcli->kref[i].push = NULL;
+	pcli->kref_used--;
+}
+
 int
 nouveau_client_new(struct nouveau_device *dev, struct nouveau_client **pclient)
 {
@@ -226,6 +331,7 @@ nouveau_client_del(struct nouveau_client **pclient)
 		int id = pcli->base.id;
 		nvdev = nouveau_device(pcli->base.device);
 		nvdev->client[id / 32] &= ~(1 << (id % 32));
+		pushbuf_krec_pool_fini(&pcli->base);
 		free(pcli->kref);
 		free(pcli);
 	}
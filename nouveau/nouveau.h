@@ -200,6 +200,17 @@ struct nouveau_pushbuf {
 	uint32_t *end;
 };
 
+/* Buffer switches of an immediate pushbuf that found its whole ring busy
+ * and waited for the oldest buffer, buffers added to the ring instead of
+ * waiting and dropped again once spare, and the current size of the ring.
+ */
+struct nouveau_pushbuf_stats {
+	uint64_t stalls;
+	uint64_t grows;
+	uint64_t shrinks;
+	uint32_t buffers;
+};
+
 struct nouveau_pushbuf_refn {
 	struct nouveau_bo *bo;
 	uint32_t flags;
@@ -227,5 +238,7 @@ uint32_t nouveau_pushbuf_refd(struct nouveau_pushbuf *, struct nouveau_bo *);
 int  nouveau_pushbuf_kick(struct nouveau_pushbuf *, struct nouveau_object *channel);
 struct nouveau_bufctx *
 nouveau_pushbuf_bufctx(struct nouveau_pushbuf *, struct nouveau_bufctx *);
+void nouveau_pushbuf_get_stats(struct nouveau_pushbuf *,
+			       struct nouveau_pushbuf_stats *);
 
 #endif
@@ -20,15 +20,26 @@ uint32_t nouveau_debug;
 #endif
 #define err(fmt, args...) fprintf(stderr, "nouveau: "fmt, ##args)
 
+/* The client's krefs live in an open addressed hash table keyed by GEM
+ * handle, so its size follows the number of buffers on the client's
+ * pushbufs rather than the largest handle the kernel handed out.  Slots
+ * with a zero handle are empty, and the table is never more than half
+ * full.
+ */
 struct nouveau_client_kref {
 	struct drm_nouveau_gem_pushbuf_bo *kref;
 	struct nouveau_pushbuf *push;
+	uint32_t handle;
 };
 
 struct nouveau_client_priv {
 	struct nouveau_client base;
 	struct nouveau_client_kref *kref;
 	unsigned kref_nr;
+	unsigned kref_used;
+	unsigned kref_shift;
+	struct nouveau_pushbuf_krec *krec_pool;
+	int krec_pool_nr;
 };
 
 static inline struct nouveau_client_priv *
@@ -37,44 +48,51 @@ nouveau_client(struct nouveau_client *client)
 	return (struct nouveau_client_priv *)client;
 }
 
+static inline unsigned
+cli_kref_hash(struct nouveau_client_priv *pcli, uint32_t handle)
+{
+	return (handle * 0x9e3779b9u) >> pcli->kref_shift;
+}
+
+static inline struct nouveau_client_kref *
+cli_kref_find(struct nouveau_client_priv *pcli, uint32_t handle)
+{
+	struct nouveau_client_kref *ckref;
+	unsigned i;
+
+	if (!pcli->kref_nr)
+		return NULL;
+
+	i = cli_kref_hash(pcli, handle);
+	while ((ckref = &pcli->kref[i])->handle) {
+		if (ckref->handle == handle)
+			return ckref;
+		i = (i + 1) & (pcli->kref_nr - 1);
+	}
+
+	return NULL;
+}
+
 static inline struct drm_nouveau_gem_pushbuf_bo *
 cli_kref_get(struct nouveau_client *client, struct nouveau_bo *bo)
 {
-	struct nouveau_client_priv *pcli = nouveau_client(client);
-	struct drm_nouveau_gem_pushbuf_bo *kref = NULL;
-	if (pcli->kref_nr > bo->handle)
-		kref = pcli->kref[bo->handle].kref;
-	return kref;
+	struct nouveau_client_kref *ckref =
+		cli_kref_find(nouveau_client(client), bo->handle);
+	return ckref ? ckref->kref : NULL;
 }
 
 static inline struct nouveau_pushbuf *
 cli_push_get(struct nouveau_client *client, struct nouveau_bo *bo)
 {
-	struct nouveau_client_priv *pcli = nouveau_client(client);
-	struct nouveau_pushbuf *push = NULL;
-	if (pcli->kref_nr > bo->handle)
-		push = pcli->kref[bo->handle].push;
-	return push;
+	struct nouveau_client_kref *ckref =
+		cli_kref_find(nouveau_client(client), bo->handle);
+	return ckref ? ckref->push : NULL;
 }
 
-static inline void
-cli_kref_set(struct nouveau_client *client, struct nouveau_bo *bo,
-	     struct drm_nouveau_gem_pushbuf_bo *kref,
-	     struct nouveau_pushbuf *push)
-{
-	struct nouveau_client_priv *pcli = nouveau_client(client);
-	if (pcli->kref_nr <= bo->handle) {
-		pcli->kref = realloc(pcli->kref,
-				     sizeof(*pcli->kref) * bo->handle * 2);
-		while (pcli->kref_nr < bo->handle * 2) {
-			pcli->kref[pcli->kref_nr].kref = NULL;
-			pcli->kref[pcli->kref_nr].push = NULL;
-			pcli->kref_nr++;
-		}
-	}
-	pcli->kref[bo->handle].kref = kref;
-	pcli->kref[bo->handle].push = push;
-}
+int  cli_kref_reserve(struct nouveau_client *);
+void cli_kref_set(struct nouveau_client *, struct nouveau_bo *,
+		  struct drm_nouveau_gem_pushbuf_bo *,
+		  struct nouveau_pushbuf *);
 
 struct nouveau_bo_priv {
 	struct nouveau_bo base;
@@ -111,6 +129,13 @@ nouveau_device(struct nouveau_device *dev)
 int
 nouveau_device_open_existing(struct nouveau_device **, int, int, drm_context_t);
 
+/* bufctx.c */
+void bufctx_validated(struct nouveau_bufctx *, bool valid);
+void bufctx_flushed(struct nouveau_bufctx *);
+
+/* pushbuf.c */
+void pushbuf_krec_pool_fini(struct nouveau_client *);
+
 /* abi16.c */
 int  abi16_chan_nv04(struct nouveau_object *);
 int  abi16_chan_nvc0(struct nouveau_object *);
@@ -42,14 +42,24 @@
 #include "nouveau.h"
 #include "private.h"
 
+/* The client's krefs point into buffer[], so it can't move, but the reloc
+ * and push arrays start small and grow as needed.  Finished krecs go back
+ * to a small per-client pool and keep their arrays for the next pushbuf.
+ */
+#define PUSHBUF_KREC_RELOCS 64
+#define PUSHBUF_KREC_PUSHES 16
+#define PUSHBUF_KREC_POOL   8
+
 struct nouveau_pushbuf_krec {
 	struct nouveau_pushbuf_krec *next;
 	struct drm_nouveau_gem_pushbuf_bo buffer[NOUVEAU_GEM_MAX_BUFFERS];
-	struct drm_nouveau_gem_pushbuf_reloc reloc[NOUVEAU_GEM_MAX_RELOCS];
-	struct drm_nouveau_gem_pushbuf_push push[NOUVEAU_GEM_MAX_PUSH];
+	struct drm_nouveau_gem_pushbuf_reloc *reloc;
+	struct drm_nouveau_gem_pushbuf_push *push;
 	int nr_buffer;
 	int nr_reloc;
 	int nr_push;
+	int max_reloc;
+	int max_push;
 	uint64_t vram_used;
 	uint64_t gart_used;
 };
@@ -67,6 +77,11 @@ struct nouveau_pushbuf_priv {
 	uint32_t *bgn;
 	int bo_next;
 	int bo_nr;
+	int bo_min;
+	int bo_max;
+	int bo_idle;
+	int error;
+	struct nouveau_pushbuf_stats stats;
 	struct nouveau_bo *bos[];
 };
 
@@ -76,9 +91,102 @@ nouveau_pushbuf(struct nouveau_pushbuf *push)
 	return (struct nouveau_pushbuf_priv *)push;
 }
 
+/* An immediate pushbuf's ring may grow to this many times the buffers
+ * it was created with before nouveau_pushbuf_space() waits on the GPU.
+ */
+#define PUSHBUF_GROW_LIMIT 4
+
 static int pushbuf_validate(struct nouveau_pushbuf *, bool);
 static int pushbuf_flush(struct nouveau_pushbuf *);
 
+static int
+pushbuf_krec_grow(struct nouveau_pushbuf_krec *krec, int relocs, int pushes)
+{
+	void *ptr;
+	int max;
+
+	if (krec->nr_reloc + relocs > krec->max_reloc) {
+		max = krec->max_reloc ? krec->max_reloc : PUSHBUF_KREC_RELOCS;
+		while (max < krec->nr_reloc + relocs)
+			max *= 2;
+		ptr = realloc(krec->reloc, max * sizeof(*krec->reloc));
+		if (!ptr)
+			return -ENOMEM;
+		krec->reloc = ptr;
+		krec->max_reloc = max;
+	}
+
+	if (krec->nr_push + pushes > krec->max_push) {
+		max = krec->max_push ? krec->max_push : PUSHBUF_KREC_PUSHES;
+		while (max < krec->nr_push + pushes)
+			max *= 2;
+		ptr = realloc(krec->push, max * sizeof(*krec->push));
+		if (!ptr)
+			return -ENOMEM;
+		krec->push = ptr;
+		krec->max_push = max;
+	}
+
+	return 0;
+}
+
+static struct nouveau_pushbuf_krec *
+pushbuf_krec_get(struct nouveau_client *client)
+{
+	struct nouveau_client_priv *pcli = nouveau_client(client);
+	struct nouveau_pushbuf_krec *krec = pcli->krec_pool;
+
+	if (krec) {
+		pcli->krec_pool = krec->next;
+		pcli->krec_pool_nr--;
+	} else {
+		krec = calloc(1, sizeof(*krec));
+		if (!krec)
+			return NULL;
+	}
+
+	krec->next = NULL;
+	krec->nr_buffer = 0;
+	krec->nr_reloc = 0;
+	krec->nr_push = 0;
+	krec->vram_used = 0;
+	krec->gart_used = 0;
+	return krec;
+}
+
+static void
+pushbuf_krec_put(struct nouveau_client *client,
+		 struct nouveau_pushbuf_krec *krec)
+{
+	struct nouveau_client_priv *pcli = nouveau_client(client);
+
+	if (pcli->krec_pool_nr < PUSHBUF_KREC_POOL) {
+		krec->next = pcli->krec_pool;
+		pcli->krec_pool = krec;
+		pcli->krec_pool_nr++;
+		return;
+	}
+
+	free(krec->reloc);
+	free(krec->push);
+	free(krec);
+}
+
+void
+pushbuf_krec_pool_fini(struct nouveau_client *client)
+{
+	struct nouveau_client_priv *pcli = nouveau_client(client);
+	struct nouveau_pushbuf_krec *krec;
+
+	while ((krec = pcli->krec_pool)) {
+		pcli->krec_pool = krec->next;
+		free(krec->reloc);
+		free(krec->push);
+		free(krec);
+	}
+	pcli->krec_pool_nr = 0;
+}
+
 static bool
 pushbuf_kref_fits(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 		  uint32_t *domains)
@@ -196,6 +304,7 @@ pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 		kref->read_domains  |= domains_rd;
 	} else {
 		if (krec->nr_buffer == NOUVEAU_GEM_MAX_BUFFERS ||
+		    cli_kref_reserve(push->client) ||
 		    !pushbuf_kref_fits(push, bo, &domains))
 			return NULL;
 
@@ -230,6 +339,13 @@ pushbuf_krel(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 	struct drm_nouveau_gem_pushbuf_bo *bkref;
 	uint32_t reloc = data;
 
+	if (krec->nr_reloc == krec->max_reloc &&
+	    pushbuf_krec_grow(krec, 1, 0)) {
+		err("no memory for reloc, dropped\n");
+		nvpb->error = -ENOMEM;
+		return data;
+	}
+
 	pkref = cli_kref_get(push->client, nvpb->bo);
 	bkref = cli_kref_get(push->client, bo);
 	krel  = &krec->reloc[krec->nr_reloc++];
@@ -326,6 +442,12 @@ pushbuf_submit(struct nouveau_pushbuf *push, struct nouveau_object *chan)
 
 	nouveau_pushbuf_data(push, NULL, 0, 0);
 
+	/* a reloc or push was dropped, the commands can't be trusted.  a
+	 * deferred pushbuf stays failed, an immediate one until the kick
+	 */
+	if (nvpb->error)
+		return nvpb->error;
+
 	while (krec && krec->nr_push) {
 		req.channel = fifo->channel;
 		req.nr_buffers = krec->nr_buffer;
@@ -402,7 +524,11 @@ pushbuf_flush(struct nouveau_pushbuf *push)
 		ret = pushbuf_submit(push, push->channel);
 	} else {
 		nouveau_pushbuf_data(push, NULL, 0, 0);
-		krec->next = malloc(sizeof(*krec));
+		krec->next = pushbuf_krec_get(push->client);
+		if (!krec->next) {
+			nvpb->error = -ENOMEM;
+			return -ENOMEM;
+		}
 		nvpb->krec = krec->next;
 	}
 
@@ -422,8 +548,7 @@ pushbuf_flush(struct nouveau_pushbuf *push)
 	krec->nr_push = 0;
 
 	DRMLISTFOREACHENTRYSAFE(bctx, btmp, &nvpb->bctx_list, head) {
-		DRMLISTJOIN(&bctx->current, &bctx->pending);
-		DRMINITLISTHEAD(&bctx->current);
+		bufctx_flushed(bctx);
 		DRMLISTDELINIT(&bctx->head);
 	}
 
@@ -515,8 +640,7 @@ pushbuf_validate(struct nouveau_pushbuf *push, bool retry)
 		}
 	}
 
-	DRMLISTJOIN(&bctx->pending, &bctx->current);
-	DRMINITLISTHEAD(&bctx->pending);
+	bufctx_validated(bctx, ret == 0);
 
 	if (ret) {
 		pushbuf_refn_fail(push, sref, srel);
@@ -554,9 +678,12 @@ nouveau_pushbuf_new(struct nouveau_client *client, struct nouveau_object *chan,
 	if (ret)
 		return ret;
 
-	nvpb = calloc(1, sizeof(*nvpb) + nr * sizeof(*nvpb->bos));
+	nvpb = calloc(1, sizeof(*nvpb) + nr * PUSHBUF_GROW_LIMIT *
+			 sizeof(*nvpb->bos));
 	if (!nvpb)
 		return -ENOMEM;
+	nvpb->bo_min = nr;
+	nvpb->bo_max = nr * PUSHBUF_GROW_LIMIT;
 
 #ifndef SIMULATE
 	nvpb->suffix0 = req.suffix0;
@@ -565,7 +692,7 @@ nouveau_pushbuf_new(struct nouveau_client *client, struct nouveau_object *chan,
 	nvpb->suffix0 = 0xffffffff;
 	nvpb->suffix1 = 0xffffffff;
 #endif
-	nvpb->krec = calloc(1, sizeof(*nvpb->krec));
+	nvpb->krec = pushbuf_krec_get(client);
 	nvpb->list = nvpb->krec;
 	if (!nvpb->krec) {
 		free(nvpb);
@@ -616,7 +743,7 @@ nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 				nouveau_bo_ref(NULL, &bo);
 			}
 			nvpb->list = krec->next;
-			free(krec);
+			pushbuf_krec_put(nvpb->base.client, krec);
 		}
 		while (nvpb->bo_nr--)
 			nouveau_bo_ref(NULL, &nvpb->bos[nvpb->bo_nr]);
@@ -626,6 +753,16 @@ nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 	*ppush = NULL;
 }
 
+void
+nouveau_pushbuf_get_stats(struct nouveau_pushbuf *push,
+			  struct nouveau_pushbuf_stats *stats)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+
+	*stats = nvpb->stats;
+	stats->buffers = nvpb->bo_nr;
+}
+
 struct nouveau_bufctx *
 nouveau_pushbuf_bufctx(struct nouveau_pushbuf *push, struct nouveau_bufctx *ctx)
 {
@@ -634,6 +771,89 @@ nouveau_pushbuf_bufctx(struct nouveau_pushbuf *push, struct nouveau_bufctx *ctx)
 	return prev;
 }
 
+static void
+pushbuf_ring_shrink(struct nouveau_pushbuf *push, struct nouveau_bo *next)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	int n = nvpb->bo_next;
+
+	/* after a whole lap without finding a busy buffer, drop the oldest
+	 * one if it's idle as well, so the ring keeps what's in flight plus
+	 * one spare
+	 */
+	if (nvpb->bo_idle < nvpb->bo_nr || nvpb->bo_nr <= nvpb->bo_min ||
+	    nvpb->bos[n] == nvpb->bo || nvpb->bos[n] == next ||
+	    nouveau_bo_wait(nvpb->bos[n], NOUVEAU_BO_WR | NOUVEAU_BO_NOBLOCK,
+			    push->client))
+		return;
+
+	nouveau_bo_ref(NULL, &nvpb->bos[n]);
+	memmove(&nvpb->bos[n], &nvpb->bos[n + 1],
+		(nvpb->bo_nr - n - 1) * sizeof(*nvpb->bos));
+	nvpb->bos[--nvpb->bo_nr] = NULL;
+	if (nvpb->bo_next == nvpb->bo_nr)
+		nvpb->bo_next = 0;
+	nvpb->bo_idle = 0;
+	nvpb->stats.shrinks++;
+}
+
+/* Picks the buffer an immediate pushbuf switches to: the first one in the
+ * ring the GPU is done with, otherwise a new one while the ring is below
+ * its limit.  Only then is the oldest buffer used, which means waiting for
+ * the GPU to finish with it.  Returns whether the buffer is known idle.
+ */
+static bool
+pushbuf_ring_next(struct nouveau_pushbuf *push, struct nouveau_bo **pbo)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_client *client = push->client;
+	struct nouveau_bo *bo;
+	bool busy = false;
+	int i, n;
+
+	for (i = 0; i < nvpb->bo_nr; i++) {
+		n = (nvpb->bo_next + i) % nvpb->bo_nr;
+		bo = nvpb->bos[n];
+		if (bo == nvpb->bo)
+			continue;
+
+		if (nouveau_bo_wait(bo, NOUVEAU_BO_WR | NOUVEAU_BO_NOBLOCK,
+				    client)) {
+			busy = true;
+			continue;
+		}
+
+		nvpb->bo_idle = busy ? 0 : nvpb->bo_idle + 1;
+		nvpb->bo_next = (n + 1) % nvpb->bo_nr;
+		nouveau_bo_ref(bo, pbo);
+		pushbuf_ring_shrink(push, bo);
+		return true;
+	}
+
+	/* every other buffer is still queued, add one in front of the
+	 * oldest so that it's the last to be reused
+	 */
+	nvpb->bo_idle = 0;
+	n = nvpb->bo_next;
+	if (nvpb->bo_nr < nvpb->bo_max &&
+	    !nouveau_bo_new(client->device, nvpb->type, 0,
+			    nvpb->bos[0]->size, NULL, &bo)) {
+		memmove(&nvpb->bos[n + 1], &nvpb->bos[n],
+			(nvpb->bo_nr - n) * sizeof(*nvpb->bos));
+		nvpb->bos[n] = bo;
+		nvpb->bo_nr++;
+		nvpb->bo_next = n + 1;
+		nvpb->stats.grows++;
+		nouveau_bo_ref(bo, pbo);
+		return true;
+	}
+
+	nvpb->bo_next = (n + 1) % nvpb->bo_nr;
+	nvpb->stats.stalls++;
+	nouveau_bo_ref(nvpb->bos[n], pbo);
+	return false;
+}
+
 int
 nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 		      uint32_t dwords, uint32_t relocs, uint32_t pushes)
@@ -643,14 +863,15 @@ nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 	struct nouveau_client *client = push->client;
 	struct nouveau_bo *bo = NULL;
 	bool flushed = false;
+	bool idle = false;
 	int ret = 0;
 
 	/* switch to next buffer if insufficient space in the current one */
 	if (push->cur + dwords >= push->end) {
-		if (nvpb->bo_next < nvpb->bo_nr) {
+		if (push->channel) {
+			idle = pushbuf_ring_next(push, &bo);
+		} else if (nvpb->bo_next < nvpb->bo_nr) {
 			nouveau_bo_ref(nvpb->bos[nvpb->bo_next++], &bo);
-			if (nvpb->bo_next == nvpb->bo_nr && push->channel)
-				nvpb->bo_next = 0;
 		} else {
 			ret = nouveau_bo_new(client->device, nvpb->type, 0,
 					     nvpb->bos[0]->size, NULL, &bo);
@@ -672,14 +893,21 @@ nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 		    !pushbuf_kref(push, bo, push->flags))) ||
 	    krec->nr_reloc + relocs >= NOUVEAU_GEM_MAX_RELOCS ||
 	    krec->nr_push + pushes >= NOUVEAU_GEM_MAX_PUSH) {
-		if (nvpb->bo && krec->nr_buffer)
-			pushbuf_flush(push);
+		if (nvpb->bo && krec->nr_buffer) {
+			ret = pushbuf_flush(push);
+			if (ret && !push->channel) {
+				/* still on the full krec */
+				nouveau_bo_ref(NULL, &bo);
+				return ret;
+			}
+		}
 		flushed = true;
 	}
 
 	/* if necessary, switch to new buffer */
 	if (bo) {
-		ret = nouveau_bo_map(bo, NOUVEAU_BO_WR, push->client);
+		ret = nouveau_bo_map(bo, idle ? 0 : NOUVEAU_BO_WR,
+				     push->client);
 		if (ret)
 			return ret;
 
@@ -695,6 +923,11 @@ nouveau_pushbuf_space(struct nouveau_pushbuf *push,
 	}
 
 	pushbuf_kref(push, nvpb->bo, push->flags);
+
+	ret = pushbuf_krec_grow(nvpb->krec, relocs, pushes);
+	if (ret)
+		return ret;
+
 	return flushed ? pushbuf_validate(push, false) : 0;
 }
 
@@ -720,6 +953,13 @@ nouveau_pushbuf_data(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 	}
 
 	if (bo) {
+		if (krec->nr_push == krec->max_push &&
+		    pushbuf_krec_grow(krec, 0, 1)) {
+			err("no memory for push, dropped\n");
+			nvpb->error = -ENOMEM;
+			return;
+		}
+
 		kref = cli_kref_get(push->client, bo);
 		kpsh = &krec->push[krec->nr_push++];
 		kpsh->bo_index = kref - krec->buffer;
@@ -768,8 +1008,17 @@ nouveau_pushbuf_refd(struct nouveau_pushbuf *push, struct nouveau_bo *bo)
 int
 nouveau_pushbuf_kick(struct nouveau_pushbuf *push, struct nouveau_object *chan)
 {
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	int ret, vret;
+
 	if (!push->channel)
 		return pushbuf_submit(push, chan);
-	pushbuf_flush(push);
-	return pushbuf_validate(push, false);
+
+	/* an immediate pushbuf discards what it couldn't submit, so the
+	 * error is reported once and the pushbuf is usable again
+	 */
+	ret = pushbuf_flush(push);
+	nvpb->error = 0;
+	vret = pushbuf_validate(push, false);
+	return ret ? ret : vret;
 }
@@ -33,11 +33,11 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include "radeon_cs.h"
 #include "radeon_cs_int.h"
+#include "radeon_cs_priv.h"
 #include "radeon_bo_int.h"
 #include "radeon_cs_gem.h"
 #include "radeon_bo_gem.h"
@@ -53,6 +53,8 @@ struct radeon_cs_manager_gem {
     struct radeon_cs_manager    base;
     uint32_t                    device_id;
     unsigned                    nbof;
+    /* bumped whenever an emit resets the space totals */
+    uint32_t                    space_generation;
 };
 
 #pragma pack(1)
@@ -73,10 +75,14 @@ struct cs_gem {
     unsigned                    nrelocs;
     uint32_t                    *relocs;
     struct radeon_bo_int        **relocs_bo;
+    /* open addressed handle -> reloc index + 1, 0 is a free slot */
+    uint32_t                    *reloc_hash;
+    unsigned                    reloc_hash_bits;
+    struct radeon_cs_space_state space;
 };
 
-static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
-static uint32_t cs_id_source = 0;
+/* bit ids handed out to the first 32 live cs, see radeon_cs_get_id() */
+static atomic_t cs_id_source;
 
 /**
  * result is undefined if called with ~0
@@ -93,17 +99,17 @@ static uint32_t get_first_zero(const uint32_t n)
  **/
 static uint32_t generate_id(void)
 {
-    uint32_t r = 0;
-    pthread_mutex_lock( &id_mutex );
-    /* check for free ids */
-    if (cs_id_source != ~r) {
-        /* find first zero bit */
-        r = get_first_zero(cs_id_source);
+    uint32_t ids, r;
 
-        /* set id as reserved */
-        cs_id_source |= r;
-    }
-    pthread_mutex_unlock( &id_mutex );
+    do {
+        ids = atomic_read(&cs_id_source);
+        /* check for free ids */
+        if (ids == ~0u)
+            return 0;
+        /* find first zero bit */
+        r = get_first_zero(ids);
+        /* set id as reserved, unless someone else got there first */
+    } while ((uint32_t)atomic_cmpxchg(&cs_id_source, ids, ids | r) != ids);
     return r;
 }
 
@@ -112,11 +118,64 @@ static uint32_t generate_id(void)
  **/
 static void free_id(uint32_t id)
 {
-    pthread_mutex_lock( &id_mutex );
+    if (id)
+        atomic_dec(&cs_id_source, id);
+}
 
-    cs_id_source &= ~id;
+static unsigned cs_gem_hash_slot(struct cs_gem *csg, uint32_t handle)
+{
+    return (handle * 0x9e3779b1u) >> (32 - csg->reloc_hash_bits);
+}
+
+/**
+ * Returns the index of the reloc of handle in cs, or -1 if there is none.
+ * The table is kept at most half full so a miss ends on a free slot
+ * after a few probes, whether or not the cs got an id bit.
+ **/
+static int cs_gem_find_reloc(struct cs_gem *csg, uint32_t handle)
+{
+    unsigned mask = (1u << csg->reloc_hash_bits) - 1;
+    unsigned slot = cs_gem_hash_slot(csg, handle);
+    uint32_t i;
+
+    while ((i = csg->reloc_hash[slot]) != 0) {
+        if (csg->relocs[(i - 1) * RELOC_SIZE] == handle)
+            return i - 1;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static void cs_gem_hash_insert(struct cs_gem *csg, uint32_t handle,
+                               unsigned i)
+{
+    unsigned mask = (1u << csg->reloc_hash_bits) - 1;
+    unsigned slot = cs_gem_hash_slot(csg, handle);
+
+    while (csg->reloc_hash[slot] != 0)
+        slot = (slot + 1) & mask;
+    csg->reloc_hash[slot] = i + 1;
+}
+
+/**
+ * Doubles the hash table and reinserts the relocs of the cs.
+ **/
+static int cs_gem_hash_grow(struct cs_gem *csg)
+{
+    uint32_t *hash;
+    unsigned i;
 
-    pthread_mutex_unlock( &id_mutex );
+    hash = (uint32_t*)calloc(2u << csg->reloc_hash_bits, sizeof(uint32_t));
+    if (hash == NULL) {
+        return -ENOMEM;
+    }
+    free(csg->reloc_hash);
+    csg->reloc_hash = hash;
+    csg->reloc_hash_bits++;
+    for (i = 0; i < csg->base.crelocs; i++) {
+        cs_gem_hash_insert(csg, csg->relocs[i * RELOC_SIZE], i);
+    }
+    return 0;
 }
 
 static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
@@ -157,6 +216,17 @@ static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
         free(csg);
         return NULL;
     }
+    /* twice as many slots as the initial relocs */
+    csg->reloc_hash_bits = 9;
+    csg->reloc_hash = (uint32_t*)calloc(1u << csg->reloc_hash_bits,
+                                        sizeof(uint32_t));
+    if (csg->reloc_hash == NULL) {
+        free(csg->relocs);
+        free(csg->relocs_bo);
+        free(csg->base.packets);
+        free(csg);
+        return NULL;
+    }
     csg->chunks[0].chunk_id = RADEON_CHUNK_ID_IB;
     csg->chunks[0].length_dw = 0;
     csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)csg->base.packets;
@@ -176,7 +246,7 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     struct cs_gem *csg = (struct cs_gem*)cs;
     struct cs_reloc_gem *reloc;
     uint32_t idx;
-    unsigned i;
+    int i;
 
     assert(boi->space_accounted);
 
@@ -193,46 +263,37 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     if (write_domain == RADEON_GEM_DOMAIN_CPU) {
         return -EINVAL;
     }
-    /* use bit field hash function to determine
-       if this bo is for sure not in this cs.*/
-    if ((atomic_read((atomic_t *)radeon_gem_get_reloc_in_cs(bo)) & cs->id)) {
-        /* check if bo is already referenced.
-         * Scanning from end to begin reduces cycles with mesa because
-         * it often relocates same shared dma bo again. */
-        for(i = cs->crelocs; i != 0;) {
-            --i;
-            idx = i * RELOC_SIZE;
-            reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
-            if (reloc->handle == bo->handle) {
-                /* Check domains must be in read or write. As we check already
-                 * checked that in argument one of the read or write domain was
-                 * set we only need to check that if previous reloc as the read
-                 * domain set then the read_domain should also be set for this
-                 * new relocation.
-                 */
-                /* the DDX expects to read and write from same pixmap */
-                if (write_domain && (reloc->read_domain & write_domain)) {
-                    reloc->read_domain = 0;
-                    reloc->write_domain = write_domain;
-                } else if (read_domain & reloc->write_domain) {
-                    reloc->read_domain = 0;
-                } else {
-                    if (write_domain != reloc->write_domain)
-                        return -EINVAL;
-                    if (read_domain != reloc->read_domain)
-                        return -EINVAL;
-                }
-
-                reloc->read_domain |= read_domain;
-                reloc->write_domain |= write_domain;
-                /* update flags */
-                reloc->flags |= (flags & reloc->flags);
-                /* write relocation packet */
-                radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
-                radeon_cs_write_dword((struct radeon_cs *)cs, idx);
-                return 0;
-            }
+    i = cs_gem_find_reloc(csg, boi->handle);
+    if (i >= 0) {
+        idx = i * RELOC_SIZE;
+        reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
+        /* Check domains must be in read or write. As we check already
+         * checked that in argument one of the read or write domain was
+         * set we only need to check that if previous reloc as the read
+         * domain set then the read_domain should also be set for this
+         * new relocation.
+         */
+        /* the DDX expects to read and write from same pixmap */
+        if (write_domain && (reloc->read_domain & write_domain)) {
+            reloc->read_domain = 0;
+            reloc->write_domain = write_domain;
+        } else if (read_domain & reloc->write_domain) {
+            reloc->read_domain = 0;
+        } else {
+            if (write_domain != reloc->write_domain)
+                return -EINVAL;
+            if (read_domain != reloc->read_domain)
+                return -EINVAL;
         }
+
+        reloc->read_domain |= read_domain;
+        reloc->write_domain |= write_domain;
+        /* update flags */
+        reloc->flags |= (flags & reloc->flags);
+        /* write relocation packet */
+        radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
+        radeon_cs_write_dword((struct radeon_cs *)cs, idx);
+        return 0;
     }
     /* new relocation */
     if (csg->base.crelocs >= csg->nrelocs) {
@@ -253,6 +314,12 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
         csg->nrelocs += 1;
         csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
     }
+    if ((csg->base.crelocs + 1) * 2 > (1u << csg->reloc_hash_bits)) {
+        if (cs_gem_hash_grow(csg)) {
+            return -ENOMEM;
+        }
+    }
+    cs_gem_hash_insert(csg, bo->handle, csg->base.crelocs);
     csg->relocs_bo[csg->base.crelocs] = boi;
     idx = (csg->base.crelocs++) * RELOC_SIZE;
     reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
@@ -263,7 +330,8 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     csg->chunks[1].length_dw += RELOC_SIZE;
     radeon_bo_ref(bo);
     /* bo might be referenced from another context so have to use atomic opertions */
-    atomic_add((atomic_t *)radeon_gem_get_reloc_in_cs(bo), cs->id);
+    if (cs->id)
+        atomic_add((atomic_t *)radeon_gem_get_reloc_in_cs(bo), cs->id);
     cs->relocs_total_size += boi->size;
     radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
     radeon_cs_write_dword((struct radeon_cs *)cs, idx);
@@ -441,7 +509,8 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
     for (i = 0; i < csg->base.crelocs; i++) {
         csg->relocs_bo[i]->space_accounted = 0;
         /* bo might be referenced from another context so have to use atomic opertions */
-        atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
+        if (cs->id)
+            atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
         radeon_bo_unref((struct radeon_bo *)csg->relocs_bo[i]);
         csg->relocs_bo[i] = NULL;
     }
@@ -449,6 +518,7 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
     cs->csm->read_used = 0;
     cs->csm->vram_write_used = 0;
     cs->csm->gart_write_used = 0;
+    ((struct radeon_cs_manager_gem *)cs->csm)->space_generation++;
     return r;
 }
 
@@ -457,6 +527,7 @@ static int cs_gem_destroy(struct radeon_cs_int *cs)
     struct cs_gem *csg = (struct cs_gem*)cs;
 
     free_id(cs->id);
+    free(csg->reloc_hash);
     free(csg->relocs_bo);
     free(cs->relocs);
     free(cs->packets);
@@ -473,7 +544,8 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
         for (i = 0; i < csg->base.crelocs; i++) {
             if (csg->relocs_bo[i]) {
                 /* bo might be referenced from another context so have to use atomic opertions */
-                atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
+                if (cs->id)
+                    atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
                 radeon_bo_unref((struct radeon_bo *)csg->relocs_bo[i]);
                 csg->relocs_bo[i] = NULL;
             }
@@ -482,6 +554,10 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
     cs->relocs_total_size = 0;
     cs->cdw = 0;
     cs->section_ndw = 0;
+    if (cs->crelocs) {
+        memset(csg->reloc_hash, 0,
+               sizeof(uint32_t) << csg->reloc_hash_bits);
+    }
     cs->crelocs = 0;
     csg->chunks[0].length_dw = 0;
     csg->chunks[1].length_dw = 0;
@@ -530,6 +606,15 @@ static int radeon_get_device_id(int fd, uint32_t *device_id)
     return r;
 }
 
+struct radeon_cs_space_state *
+radeon_cs_gem_space_state(struct radeon_cs_int *cs, uint32_t *generation)
+{
+    if (cs->csm->funcs != &radeon_cs_gem_funcs)
+        return NULL;
+    *generation = ((struct radeon_cs_manager_gem *)cs->csm)->space_generation;
+    return &((struct cs_gem *)cs)->space;
+}
+
 struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd)
 {
     struct radeon_cs_manager_gem *csm;
@@ -0,0 +1,22 @@
+#ifndef _RADEON_CS_PRIV_H_
+#define _RADEON_CS_PRIV_H_
+
+/* Incremental space accounting state.  It lives in the gem cs and cs
+ * manager rather than in radeon_cs_int, which is installed and may be
+ * allocated outside libdrm with its old size.
+ */
+struct radeon_cs_space_state {
+    /* bos[0..bo_count) were accounted by the last space check ... */
+    int         bo_count;
+    /* ... while the manager totals were in this generation */
+    uint32_t    generation;
+};
+
+/* Returns the space state of a gem cs and the current generation of its
+ * manager, which changes whenever a cs emit resets the totals, or NULL
+ * for any other cs.
+ */
+struct radeon_cs_space_state *
+radeon_cs_gem_space_state(struct radeon_cs_int *cs, uint32_t *generation);
+
+#endif
@@ -31,6 +31,7 @@
 #include "radeon_cs.h"
 #include "radeon_bo_int.h"
 #include "radeon_cs_int.h"
+#include "radeon_cs_priv.h"
 
 struct rad_sizes {
     int32_t op_read;
@@ -105,10 +106,11 @@ static inline int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct ra
     return 0;
 }
 
-static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_space_check *new_tmp)
+static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_space_check *new_tmp,
+                                    struct radeon_cs_space_state *state, uint32_t generation)
 {
     struct radeon_cs_manager *csm = cs->csm;
-    int i;
+    int i, first;
     struct radeon_bo_int *bo;
     struct rad_sizes sizes;
     int ret;
@@ -120,8 +122,14 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
 
     memset(&sizes, 0, sizeof(struct rad_sizes));
 
+    /* only the bos added since the last check need accounting, unless
+     * an emit has reset the totals and the bos' accounting since */
+    first = 0;
+    if (state && state->generation == generation)
+        first = state->bo_count;
+
     /* prepare */
-    for (i = 0; i < cs->bo_count; i++) {
+    for (i = first; i < cs->bo_count; i++) {
         ret = radeon_cs_setup_bo(&cs->bos[i], &sizes);
         if (ret)
             return ret;
@@ -151,13 +159,18 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     csm->vram_write_used += sizes.op_vram_write;
     csm->read_used += sizes.op_read;
     /* commit */
-    for (i = 0; i < cs->bo_count; i++) {
+    for (i = first; i < cs->bo_count; i++) {
         bo = cs->bos[i].bo;
         bo->space_accounted = cs->bos[i].new_accounted;
     }
     if (new_tmp)
         new_tmp->bo->space_accounted = new_tmp->new_accounted;
 
+    if (state) {
+        state->bo_count = cs->bo_count;
+        state->generation = generation;
+    }
+
     return RADEON_CS_SPACE_OK;
 }
 
@@ -186,11 +199,14 @@ void radeon_cs_space_add_persistent_bo(struct radeon_cs *cs, struct radeon_bo *b
 static int radeon_cs_check_space_internal(struct radeon_cs_int *cs,
                       struct radeon_cs_space_check *tmp_bo)
 {
+    struct radeon_cs_space_state *state;
+    uint32_t generation;
     int ret;
     int flushed = 0;
 
 again:
-    ret = radeon_cs_do_space_check(cs, tmp_bo);
+    state = radeon_cs_gem_space_state(cs, &generation);
+    ret = radeon_cs_do_space_check(cs, tmp_bo, state, generation);
     if (ret == RADEON_CS_SPACE_OP_TO_BIG)
         return -1;
     if (ret == RADEON_CS_SPACE_FLUSH) {
@@ -233,6 +249,8 @@ int radeon_cs_space_check(struct radeon_cs *cs)
 void radeon_cs_space_reset_bos(struct radeon_cs *cs)
 {
     struct radeon_cs_int *csi = (struct radeon_cs_int *)cs;
+    struct radeon_cs_space_state *state;
+    uint32_t generation;
     int i;
     for (i = 0; i < csi->bo_count; i++) {
         radeon_bo_unref((struct radeon_bo *)csi->bos[i].bo);
@@ -242,4 +260,7 @@ void radeon_cs_space_reset_bos(struct radeon_cs *cs)
         csi->bos[i].new_accounted = 0;
     }
     csi->bo_count = 0;
+    state = radeon_cs_gem_space_state(csi, &generation);
+    if (state)
+        state->bo_count = 0;
 }
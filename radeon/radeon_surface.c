@@ -27,15 +27,20 @@
  *      Jérôme Glisse <jglisse@redhat.com>
  */
 #include <errno.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "drm.h"
 #include "xf86drm.h"
 #include "radeon_drm.h"
 #include "radeon_surface.h"
+#include "libdrm_lists.h"
 
 #define ALIGN(value, alignment) (((value) + alignment - 1) & ~(alignment - 1))
 #define MAX2(A, B)              ((A) > (B) ? (A) : (B))
@@ -94,6 +99,17 @@ struct radeon_hw_info {
     uint32_t                        tile_mode_array[32];
 };
 
+/* the fields of struct radeon_surface that radeon_surface_init() reads */
+#define RADEON_SURFACE_KEY_SIZE 16
+
+struct radeon_surface_cache_entry {
+    drmMMListHead                       lru;
+    struct radeon_surface_cache_entry   *next;
+    uint32_t                            hash;
+    uint32_t                            key[RADEON_SURFACE_KEY_SIZE];
+    struct radeon_surface               surf;
+};
+
 struct radeon_surface_manager {
     int                         fd;
     uint32_t                    device_id;
@@ -101,6 +117,15 @@ struct radeon_surface_manager {
     unsigned                    family;
     hw_init_surface_t           surface_init;
     hw_best_surface_t           surface_best;
+    /* layouts computed by radeon_surface_init(), most recently used
+     * first, and hashed by their input fields */
+    unsigned                            cache_size;
+    unsigned                            cache_count;
+    drmMMListHead                       cache_lru;
+    struct radeon_surface_cache_entry   *cache_entries;
+    struct radeon_surface_cache_entry   **cache_table;
+    unsigned                            cache_table_size;
+    struct radeon_surface_cache_stats   cache_stats;
 };
 
 /* helper */
@@ -117,6 +142,41 @@ static int radeon_get_value(int fd, unsigned req, uint32_t *value)
     return r;
 }
 
+static int radeon_query_value(int fd, uint64_t req, uint64_t *value)
+{
+    uint32_t tmp;
+    int r;
+
+    r = radeon_get_value(fd, req, &tmp);
+    *value = tmp;
+    return r;
+}
+
+/* single value queries that are cached on the fd, see drmGetParams */
+static int radeon_get_values(int fd, drmParam *params, int count)
+{
+    return drmGetParams(fd, DRM_RADEON_INFO, radeon_query_value,
+                        params, count);
+}
+
+/* from the fd's cached information if it has some, without creating it */
+static int radeon_get_drm_minor(int fd)
+{
+    const drmFdInfo *info = drmGetCachedFdInfo(fd);
+    drmVersionPtr version;
+    int minor = 0;
+
+    if (info) {
+        return info->version_minor;
+    }
+    version = drmGetVersion(fd);
+    if (version) {
+        minor = version->version_minor;
+        drmFreeVersion(version);
+    }
+    return minor;
+}
+
 static int radeon_get_family(struct radeon_surface_manager *surf_man)
 {
     switch (surf_man->device_id) {
@@ -180,24 +240,15 @@ static void surf_minify(struct radeon_surface *surf,
 /* ===========================================================================
  * r600/r700 family
  */
-static int r6_init_hw_info(struct radeon_surface_manager *surf_man)
+static int r6_init_hw_info(struct radeon_surface_manager *surf_man,
+                           const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 14) {
+    if (desc->drm_minor >= 14) {
         surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch ((tiling_config & 0xe) >> 1) {
     case 0:
@@ -463,24 +514,15 @@ static int r6_surface_best(struct radeon_surface_manager *surf_man,
 /* ===========================================================================
  * evergreen family
  */
-static int eg_init_hw_info(struct radeon_surface_manager *surf_man)
+static int eg_init_hw_info(struct radeon_surface_manager *surf_man,
+                           const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 16) {
+    if (desc->drm_minor >= 16) {
         surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch (tiling_config & 0xf) {
     case 0:
@@ -1175,26 +1217,17 @@ static void si_gb_tile_mode(uint32_t gb_tile_mode,
     }
 }
 
-static int si_init_hw_info(struct radeon_surface_manager *surf_man)
+static int si_init_hw_info(struct radeon_surface_manager *surf_man,
+                           const struct radeon_surface_hw_desc *desc)
 {
-    uint32_t tiling_config;
-    drmVersionPtr version;
-    int r;
-
-    r = radeon_get_value(surf_man->fd, RADEON_INFO_TILING_CONFIG,
-                         &tiling_config);
-    if (r) {
-        return r;
-    }
+    uint32_t tiling_config = desc->tiling_config;
 
     surf_man->hw_info.allow_2d = 0;
-    version = drmGetVersion(surf_man->fd);
-    if (version && version->version_minor >= 33) {
-        if (!radeon_get_value(surf_man->fd, RADEON_INFO_SI_TILE_MODE_ARRAY, surf_man->hw_info.tile_mode_array)) {
-            surf_man->hw_info.allow_2d = 1;
-        }
+    if (desc->drm_minor >= 33) {
+        memcpy(surf_man->hw_info.tile_mode_array, desc->tile_mode_array,
+               sizeof(surf_man->hw_info.tile_mode_array));
+        surf_man->hw_info.allow_2d = 1;
     }
-    drmFreeVersion(version);
 
     switch (tiling_config & 0xf) {
     case 0:
@@ -1769,52 +1802,194 @@ static int si_surface_best(struct radeon_surface_manager *surf_man,
 
 
 /* ===========================================================================
- * public API
+ * hardware presets
  */
-struct radeon_surface_manager *radeon_surface_manager_new(int fd)
-{
-    struct radeon_surface_manager *surf_man;
+/* only the fields the layout code reads */
+#define SI_GB_TILE_MODE(pipe, split, bankw, bankh, mtilea)              \
+    (((pipe) << 6) | ((split) << 11) | ((bankw) << 14) |                \
+     ((bankh) << 16) | ((mtilea) << 18) | (SI__NUM_BANKS__16_BANK << 20))
+
+/* the tile mode array the kernel programs, indexed by SI_TILE_MODE_* */
+#define SI_TILE_MODE_ARRAY(pipe) {                                          \
+    /* depth/stencil 2D, 2D_2AA/4AA, 2D_8AA, 2D_4AA with stencil */        \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__64B, 0, 2, 1),                   \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__128B, 0, 2, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__256B, 0, 2, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__128B, 0, 2, 1),                  \
+    /* depth/stencil 1D, uncompressed 16bpp, 32bpp and stencil only */     \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__64B, 0, 1, 1),                   \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__4096B, 0, 1, 1),                 \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__4096B, 0, 0, 1),                 \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__4096B, 0, 1, 2),                 \
+    /* linear aligned, scanout 1D, 8bpp, 16bpp and 32bpp */                \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__64B, 0, 1, 1),                   \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__64B, 0, 1, 1),                   \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__256B, 0, 2, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__256B, 0, 1, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__512B, 0, 0, 1),                  \
+    /* color 1D, 2D 8bpp, 16bpp, 32bpp and 64bpp */                        \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__64B, 0, 1, 1),                   \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__256B, 0, 2, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__256B, 0, 1, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__512B, 0, 0, 1),                  \
+    SI_GB_TILE_MODE(pipe, SI__TILE_SPLIT__4096B, 0, 0, 1),                 \
+}
 
-    surf_man = calloc(1, sizeof(struct radeon_surface_manager));
-    if (surf_man == NULL) {
+static const struct {
+    const char                          *name;
+    struct radeon_surface_hw_desc       desc;
+} radeon_surface_hw_presets[] = {
+    /* 8 pipes, 8 banks, 256B groups */
+    { "r600",       { 0x9400, 0x00000016, 34 } },
+    /* 8 pipes, 8 banks, 256B groups, 4KB rows */
+    { "cypress",    { 0x6898, 0x00002013, 34 } },
+    /* 2 pipes, 4 banks, 256B groups, 2KB rows */
+    { "palm",       { 0x9802, 0x00001001, 34 } },
+    /* 8 pipes, 16 banks, 256B groups, 4KB rows */
+    { "tahiti",     { 0x6798, 0x00002023, 34,
+                      SI_TILE_MODE_ARRAY(SI__PIPE_CONFIG__ADDR_SURF_P8_32x32_8x16) } },
+    /* 4 pipes, 16 banks, 256B groups, 4KB rows */
+    { "verde",      { 0x683D, 0x00002022, 34,
+                      SI_TILE_MODE_ARRAY(SI__PIPE_CONFIG__ADDR_SURF_P4_8x16) } },
+};
+
+/**
+ * Returns the name of the \p index th bundled hardware description, or NULL
+ * past the last one.
+ */
+const char *radeon_surface_hw_preset_name(unsigned index)
+{
+    if (index >= sizeof(radeon_surface_hw_presets) / sizeof(radeon_surface_hw_presets[0])) {
         return NULL;
     }
-    surf_man->fd = fd;
-    if (radeon_get_value(fd, RADEON_INFO_DEVICE_ID, &surf_man->device_id)) {
-        goto out_err;
+    return radeon_surface_hw_presets[index].name;
+}
+
+/**
+ * Returns the bundled description of a typical r600, evergreen or southern
+ * islands part, by the name radeon_surface_hw_preset_name() gives it.
+ */
+const struct radeon_surface_hw_desc *radeon_surface_hw_preset(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; radeon_surface_hw_preset_name(i); i++) {
+        if (!strcmp(radeon_surface_hw_presets[i].name, name)) {
+            return &radeon_surface_hw_presets[i].desc;
+        }
     }
+    return NULL;
+}
+
+
+/* ===========================================================================
+ * public API
+ */
+static int radeon_surface_manager_init(struct radeon_surface_manager *surf_man,
+                                       const struct radeon_surface_hw_desc *desc)
+{
+    DRMINITLISTHEAD(&surf_man->cache_lru);
+    surf_man->device_id = desc->device_id;
     if (radeon_get_family(surf_man)) {
-        goto out_err;
+        return -EINVAL;
     }
 
     if (surf_man->family <= CHIP_RV740) {
-        if (r6_init_hw_info(surf_man)) {
-            goto out_err;
+        if (r6_init_hw_info(surf_man, desc)) {
+            return -EINVAL;
         }
         surf_man->surface_init = &r6_surface_init;
         surf_man->surface_best = &r6_surface_best;
     } else if (surf_man->family <= CHIP_ARUBA) {
-        if (eg_init_hw_info(surf_man)) {
-            goto out_err;
+        if (eg_init_hw_info(surf_man, desc)) {
+            return -EINVAL;
         }
         surf_man->surface_init = &eg_surface_init;
         surf_man->surface_best = &eg_surface_best;
     } else {
-        if (si_init_hw_info(surf_man)) {
-            goto out_err;
+        if (si_init_hw_info(surf_man, desc)) {
+            return -EINVAL;
         }
         surf_man->surface_init = &si_surface_init;
         surf_man->surface_best = &si_surface_best;
     }
+    return 0;
+}
 
+struct radeon_surface_manager *radeon_surface_manager_new(int fd)
+{
+    struct radeon_surface_manager *surf_man;
+    struct radeon_surface_hw_desc desc;
+    drmParam params[2] = {
+        { RADEON_INFO_DEVICE_ID },
+        { RADEON_INFO_TILING_CONFIG },
+    };
+
+    surf_man = calloc(1, sizeof(struct radeon_surface_manager));
+    if (surf_man == NULL) {
+        return NULL;
+    }
+    surf_man->fd = fd;
+    memset(&desc, 0, sizeof(desc));
+    /* this creates the fd's device information, caching the values below */
+    desc.drm_minor = radeon_get_drm_minor(fd);
+    /* fetch everything the hw_info init needs in one go */
+    radeon_get_values(fd, params, 2);
+    if (params[0].ret || params[1].ret) {
+        goto out_err;
+    }
+
+    desc.device_id = params[0].value;
+    desc.tiling_config = params[1].value;
+    surf_man->device_id = desc.device_id;
+    if (radeon_get_family(surf_man)) {
+        goto out_err;
+    }
+    if (surf_man->family >= CHIP_TAHITI && desc.drm_minor >= 33 &&
+        radeon_get_value(fd, RADEON_INFO_SI_TILE_MODE_ARRAY, desc.tile_mode_array)) {
+        /* without the tile mode array SI can't do 2D tiling */
+        desc.drm_minor = 32;
+    }
+
+    if (radeon_surface_manager_init(surf_man, &desc)) {
+        goto out_err;
+    }
     return surf_man;
 out_err:
     free(surf_man);
     return NULL;
 }
 
+/**
+ * Creates a surface manager for the hardware \p desc describes, without a
+ * device: it lays out surfaces as radeon_surface_manager_new() would on that
+ * hardware.
+ */
+struct radeon_surface_manager *
+radeon_surface_manager_new_from_desc(const struct radeon_surface_hw_desc *desc)
+{
+    struct radeon_surface_manager *surf_man;
+
+    if (desc == NULL) {
+        return NULL;
+    }
+    surf_man = calloc(1, sizeof(struct radeon_surface_manager));
+    if (surf_man == NULL) {
+        return NULL;
+    }
+    surf_man->fd = -1;
+    if (radeon_surface_manager_init(surf_man, desc)) {
+        free(surf_man);
+        return NULL;
+    }
+    return surf_man;
+}
+
 void radeon_surface_manager_free(struct radeon_surface_manager *surf_man)
 {
+    if (surf_man) {
+        radeon_surface_manager_set_cache_size(surf_man, 0);
+    }
     free(surf_man);
 }
 
@@ -1885,12 +2060,161 @@ static int radeon_surface_sanity(struct radeon_surface_manager *surf_man,
     return 0;
 }
 
+static void radeon_surface_cache_key(const struct radeon_surface *surf,
+                                     uint32_t *key)
+{
+    key[0] = surf->npix_x;
+    key[1] = surf->npix_y;
+    key[2] = surf->npix_z;
+    key[3] = surf->blk_w;
+    key[4] = surf->blk_h;
+    key[5] = surf->blk_d;
+    key[6] = surf->array_size;
+    key[7] = surf->last_level;
+    key[8] = surf->bpe;
+    key[9] = surf->nsamples;
+    key[10] = surf->flags;
+    key[11] = surf->bankw;
+    key[12] = surf->bankh;
+    key[13] = surf->mtilea;
+    key[14] = surf->tile_split;
+    key[15] = surf->stencil_tile_split;
+}
+
+static uint32_t radeon_surface_cache_hash(const uint32_t *key)
+{
+    uint32_t hash = 2166136261u;
+    unsigned i;
+
+    for (i = 0; i < RADEON_SURFACE_KEY_SIZE; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* copy the computed layout, leaving the levels past last_level alone */
+static void radeon_surface_cache_copy(struct radeon_surface *dst,
+                                      const struct radeon_surface *src)
+{
+    unsigned n = src->last_level + 1;
+
+    memcpy(dst, src, offsetof(struct radeon_surface, level));
+    memcpy(dst->level, src->level, n * sizeof(src->level[0]));
+    memcpy(dst->stencil_level, src->stencil_level,
+           n * sizeof(src->stencil_level[0]));
+    memcpy(dst->tiling_index, src->tiling_index,
+           n * sizeof(src->tiling_index[0]));
+    memcpy(dst->stencil_tiling_index, src->stencil_tiling_index,
+           n * sizeof(src->stencil_tiling_index[0]));
+}
+
+static struct radeon_surface_cache_entry **
+radeon_surface_cache_find(struct radeon_surface_manager *surf_man,
+                          const uint32_t *key, uint32_t hash)
+{
+    struct radeon_surface_cache_entry **p;
+
+    p = &surf_man->cache_table[hash & (surf_man->cache_table_size - 1)];
+    for (; *p; p = &(*p)->next) {
+        if ((*p)->hash == hash && !memcmp((*p)->key, key, sizeof((*p)->key))) {
+            break;
+        }
+    }
+    return p;
+}
+
+static void radeon_surface_cache_insert(struct radeon_surface_manager *surf_man,
+                                        const uint32_t *key, uint32_t hash,
+                                        const struct radeon_surface *surf)
+{
+    struct radeon_surface_cache_entry *entry, **p;
+
+    if (surf_man->cache_count < surf_man->cache_size) {
+        entry = &surf_man->cache_entries[surf_man->cache_count++];
+    } else {
+        /* reuse the least recently used entry */
+        entry = DRMLISTENTRY(struct radeon_surface_cache_entry,
+                             surf_man->cache_lru.prev, lru);
+        p = radeon_surface_cache_find(surf_man, entry->key, entry->hash);
+        *p = entry->next;
+        DRMLISTDEL(&entry->lru);
+        surf_man->cache_stats.evictions++;
+    }
+    memcpy(entry->key, key, sizeof(entry->key));
+    entry->hash = hash;
+    radeon_surface_cache_copy(&entry->surf, surf);
+
+    p = &surf_man->cache_table[hash & (surf_man->cache_table_size - 1)];
+    entry->next = *p;
+    *p = entry;
+    DRMLISTADD(&entry->lru, &surf_man->cache_lru);
+}
+
+/**
+ * Sets the number of layouts radeon_surface_init() remembers, so that
+ * initializing a surface with the same fields as one of them is a copy.
+ * 0, the default, disables the cache.
+ */
+int radeon_surface_manager_set_cache_size(struct radeon_surface_manager *surf_man,
+                                          unsigned entries)
+{
+    struct radeon_surface_cache_entry *pool = NULL, **table = NULL;
+    unsigned table_size = 0;
+
+    if (surf_man == NULL) {
+        return -EINVAL;
+    }
+
+    /* drop everything, the cache is cheap to refill */
+    if (entries) {
+        table_size = next_power_of_two(entries * 2);
+        pool = malloc(entries * sizeof(*pool));
+        table = calloc(table_size, sizeof(*table));
+        if (pool == NULL || table == NULL) {
+            free(pool);
+            free(table);
+            return -ENOMEM;
+        }
+    }
+    free(surf_man->cache_entries);
+    free(surf_man->cache_table);
+    surf_man->cache_entries = pool;
+    surf_man->cache_table = table;
+    surf_man->cache_table_size = table_size;
+    surf_man->cache_size = entries;
+    surf_man->cache_count = 0;
+    DRMINITLISTHEAD(&surf_man->cache_lru);
+    return 0;
+}
+
+void radeon_surface_manager_get_cache_stats(struct radeon_surface_manager *surf_man,
+                                            struct radeon_surface_cache_stats *stats)
+{
+    *stats = surf_man->cache_stats;
+}
+
 int radeon_surface_init(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf)
 {
+    struct radeon_surface_cache_entry *entry;
+    uint32_t key[RADEON_SURFACE_KEY_SIZE], hash = 0;
     unsigned mode, type;
     int r;
 
+    if (surf_man && surf && surf_man->cache_size) {
+        radeon_surface_cache_key(surf, key);
+        hash = radeon_surface_cache_hash(key);
+        entry = *radeon_surface_cache_find(surf_man, key, hash);
+        if (entry) {
+            DRMLISTDEL(&entry->lru);
+            DRMLISTADD(&entry->lru, &surf_man->cache_lru);
+            radeon_surface_cache_copy(surf, &entry->surf);
+            surf_man->cache_stats.hits++;
+            return 0;
+        }
+        surf_man->cache_stats.misses++;
+    }
+
     type = RADEON_SURF_GET(surf->flags, TYPE);
     mode = RADEON_SURF_GET(surf->flags, MODE);
 
@@ -1898,7 +2222,11 @@ int radeon_surface_init(struct radeon_surface_manager *surf_man,
     if (r) {
         return r;
     }
-    return surf_man->surface_init(surf_man, surf);
+    r = surf_man->surface_init(surf_man, surf);
+    if (r == 0 && surf_man->cache_size) {
+        radeon_surface_cache_insert(surf_man, key, hash, surf);
+    }
+    return r;
 }
 
 int radeon_surface_best(struct radeon_surface_manager *surf_man,
@@ -1916,3 +2244,587 @@ int radeon_surface_best(struct radeon_surface_manager *surf_man,
     }
     return surf_man->surface_best(surf_man, surf);
 }
+
+/**
+ * Lays out \p count surfaces, each with radeon_surface_best() followed by
+ * radeon_surface_init().  The result of each goes to \p results unless it
+ * is NULL; the return value is 0 if all of them succeeded, otherwise the
+ * error of the first one that failed.
+ */
+int radeon_surface_init_array(struct radeon_surface_manager *surf_man,
+                              struct radeon_surface *surfs, unsigned count,
+                              int *results)
+{
+    unsigned i;
+    int r, ret = 0;
+
+    for (i = 0; i < count; i++) {
+        r = radeon_surface_best(surf_man, &surfs[i]);
+        if (r == 0) {
+            r = radeon_surface_init(surf_man, &surfs[i]);
+        }
+        if (results) {
+            results[i] = r;
+        }
+        if (r && ret == 0) {
+            ret = r;
+        }
+    }
+    return ret;
+}
+
+
+/* ===========================================================================
+ * CPU tiling
+ */
+/* pixel index bits within a micro tile, lowest first */
+#define X0 0
+#define X1 1
+#define X2 2
+#define Y0 3
+#define Y1 4
+#define Y2 5
+
+static const uint8_t radeon_tile_order_display[5][6] = {
+    { X0, X1, X2, Y1, Y0, Y2 },     /* 8bpp */
+    { X0, X1, X2, Y0, Y1, Y2 },     /* 16bpp */
+    { X0, X1, Y0, X2, Y1, Y2 },     /* 32bpp */
+    { X0, Y0, X1, X2, Y1, Y2 },     /* 64bpp */
+    { Y0, X0, X1, X2, Y1, Y2 },     /* 128bpp */
+};
+
+static const uint8_t radeon_tile_order_thin[6] = { X0, Y0, X1, Y1, X2, Y2 };
+
+typedef void (*radeon_tile_kernel_t)(uint8_t *tile, uint8_t *linear,
+                                     unsigned pitch, const uint32_t *offsets);
+
+struct radeon_tiling {
+    unsigned                    bpe;
+    unsigned                    mode;
+    unsigned                    width;
+    unsigned                    height;
+    unsigned                    pitch_bytes;
+    uint64_t                    base;
+    const uint8_t               *order;
+    /* micro tiles per row and bytes per micro tile */
+    unsigned                    tiles_x;
+    unsigned                    tileb;
+    /* 2D only */
+    unsigned                    num_pipes;
+    unsigned                    pipe_bits;
+    unsigned                    bank_bits;
+    unsigned                    group_bits;
+    unsigned                    bankw;
+    unsigned                    bankh;
+    unsigned                    mtilea;
+    unsigned                    mtiles_x;
+    int                         si_pipe_config;
+    /* address of each pixel of a micro tile from its start, in row order */
+    uint32_t                    offsets[64];
+    radeon_tile_kernel_t        to_tiled;
+    radeon_tile_kernel_t        from_tiled;
+};
+
+static unsigned radeon_tile_pixel_index(const uint8_t *order,
+                                        unsigned x, unsigned y)
+{
+    unsigned i, index = 0;
+
+    for (i = 0; i < 6; i++) {
+        if (order[i] < Y0) {
+            index |= ((x >> order[i]) & 1) << i;
+        } else {
+            index |= ((y >> (order[i] - Y0)) & 1) << i;
+        }
+    }
+    return index;
+}
+
+/* spread an offset within one pipe and bank over all of them */
+static uint64_t radeon_tile_expand(const struct radeon_tiling *t, uint64_t offset)
+{
+    uint64_t mask = (1 << t->group_bits) - 1;
+
+    return (offset & mask) |
+           ((offset & ~mask) << (t->pipe_bits + t->bank_bits));
+}
+
+#define BIT(v, n) (((v) >> (n)) & 1)
+
+/* x and y count micro tiles */
+static unsigned radeon_tile_pipe(const struct radeon_tiling *t,
+                                 unsigned x, unsigned y)
+{
+    switch (t->si_pipe_config) {
+    case SI__PIPE_CONFIG__ADDR_SURF_P2:
+        return BIT(x, 0) ^ BIT(y, 0);
+    case SI__PIPE_CONFIG__ADDR_SURF_P4_8x16:
+        return (BIT(x, 1) ^ BIT(y, 0)) |
+               (BIT(x, 0) ^ BIT(y, 1)) << 1;
+    case SI__PIPE_CONFIG__ADDR_SURF_P8_32x32_8x16:
+        return (BIT(x, 1) ^ BIT(x, 2) ^ BIT(y, 0)) |
+               (BIT(x, 0) ^ BIT(y, 1)) << 1 |
+               (BIT(x, 2) ^ BIT(y, 2)) << 2;
+    }
+
+    /* evergreen, and the SI configurations above don't cover */
+    switch (t->num_pipes) {
+    case 2:
+        return BIT(x, 0) ^ BIT(y, 0);
+    case 4:
+        return (BIT(x, 0) ^ BIT(y, 1)) |
+               (BIT(x, 1) ^ BIT(y, 0)) << 1;
+    case 8:
+        return (BIT(x, 0) ^ BIT(y, 2)) |
+               (BIT(x, 1) ^ BIT(y, 1) ^ BIT(y, 2)) << 1 |
+               (BIT(x, 2) ^ BIT(y, 0)) << 2;
+    default:
+        return 0;
+    }
+}
+
+/* x counts bank widths of micro tiles for all pipes, y bank heights */
+static unsigned radeon_tile_bank(const struct radeon_tiling *t,
+                                 unsigned x, unsigned y)
+{
+    switch (1 << t->bank_bits) {
+    case 2:
+        return BIT(x, 0) ^ BIT(y, 0);
+    case 4:
+        return (BIT(x, 0) ^ BIT(y, 1)) |
+               (BIT(x, 1) ^ BIT(y, 0)) << 1;
+    case 8:
+        return (BIT(x, 0) ^ BIT(y, 2)) |
+               (BIT(x, 1) ^ BIT(y, 1) ^ BIT(y, 2)) << 1 |
+               (BIT(x, 2) ^ BIT(y, 0)) << 2;
+    case 16:
+        return (BIT(x, 0) ^ BIT(y, 3)) |
+               (BIT(x, 1) ^ BIT(y, 2) ^ BIT(y, 3)) << 1 |
+               (BIT(x, 2) ^ BIT(y, 1)) << 2 |
+               (BIT(x, 3) ^ BIT(y, 0)) << 3;
+    default:
+        return 0;
+    }
+}
+
+#undef BIT
+
+/* address of the first pixel of micro tile x, y, from the start of the slice */
+static uint64_t radeon_tile_base(const struct radeon_tiling *t,
+                                 unsigned x, unsigned y)
+{
+    unsigned mtilew, mtileh, pipe, bank;
+    uint64_t offset;
+
+    if (t->mode == RADEON_SURF_MODE_1D) {
+        return ((uint64_t)y * t->tiles_x + x) * t->tileb;
+    }
+
+    /* macro tile size in micro tiles */
+    mtilew = t->bankw * t->num_pipes * t->mtilea;
+    mtileh = t->bankh * (1 << t->bank_bits) / t->mtilea;
+
+    /* offset within one pipe and bank */
+    offset = (uint64_t)((y / mtileh) * t->mtiles_x + x / mtilew) *
+             t->bankw * t->bankh * t->tileb;
+    offset += ((y % t->bankh) * t->bankw + (x / t->num_pipes) % t->bankw) *
+              t->tileb;
+
+    pipe = radeon_tile_pipe(t, x, y);
+    bank = radeon_tile_bank(t, x / (t->bankw * t->num_pipes), y / t->bankh);
+    return radeon_tile_expand(t, offset) |
+           (uint64_t)pipe << t->group_bits |
+           (uint64_t)bank << (t->group_bits + t->pipe_bits);
+}
+
+/* The reference: the address of pixel x, y, worked out from scratch. */
+static uint64_t radeon_tile_address(const struct radeon_tiling *t,
+                                    unsigned x, unsigned y)
+{
+    unsigned index = radeon_tile_pixel_index(t->order, x % 8, y % 8);
+    unsigned mtilew, mtileh, pipe, bank;
+    uint64_t offset;
+
+    if (t->mode == RADEON_SURF_MODE_1D) {
+        return ((uint64_t)(y / 8) * t->tiles_x + x / 8) * t->tileb +
+               index * t->bpe;
+    }
+
+    mtilew = t->bankw * t->num_pipes * t->mtilea;
+    mtileh = t->bankh * (1 << t->bank_bits) / t->mtilea;
+    offset = (uint64_t)((y / 8 / mtileh) * t->mtiles_x + x / 8 / mtilew) *
+             t->bankw * t->bankh * t->tileb;
+    offset += ((y / 8 % t->bankh) * t->bankw + (x / 8 / t->num_pipes) % t->bankw) *
+              t->tileb;
+    offset += index * t->bpe;
+
+    pipe = radeon_tile_pipe(t, x / 8, y / 8);
+    bank = radeon_tile_bank(t, x / 8 / (t->bankw * t->num_pipes), y / 8 / t->bankh);
+    return radeon_tile_expand(t, offset) |
+           (uint64_t)pipe << t->group_bits |
+           (uint64_t)bank << (t->group_bits + t->pipe_bits);
+}
+
+/* Copies a whole micro tile, one pixel at a time. */
+#define RADEON_TILE_KERNEL_PIXELS(bpe)                                      \
+static void radeon_tile_pixels##bpe##_to(uint8_t *tile, uint8_t *linear,   \
+                                         unsigned pitch,                    \
+                                         const uint32_t *offsets)           \
+{                                                                           \
+    unsigned x, y;                                                          \
+                                                                            \
+    for (y = 0; y < 8; y++, linear += pitch, offsets += 8) {                \
+        for (x = 0; x < 8; x++) {                                           \
+            memcpy(tile + offsets[x], linear + x * bpe, bpe);               \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static void radeon_tile_pixels##bpe##_from(uint8_t *tile, uint8_t *linear, \
+                                           unsigned pitch,                  \
+                                           const uint32_t *offsets)         \
+{                                                                           \
+    unsigned x, y;                                                          \
+                                                                            \
+    for (y = 0; y < 8; y++, linear += pitch, offsets += 8) {                \
+        for (x = 0; x < 8; x++) {                                           \
+            memcpy(linear + x * bpe, tile + offsets[x], bpe);               \
+        }                                                                   \
+    }                                                                       \
+}
+
+/* Copies a micro tile whose rows are made of 16 byte runs. */
+#define RADEON_TILE_KERNEL_CHUNKS(bpe)                                      \
+static void radeon_tile_chunks##bpe##_to(uint8_t *tile, uint8_t *linear,   \
+                                         unsigned pitch,                    \
+                                         const uint32_t *offsets)           \
+{                                                                           \
+    unsigned x, y;                                                          \
+                                                                            \
+    for (y = 0; y < 8; y++, linear += pitch, offsets += 8) {                \
+        for (x = 0; x < 8; x += 16 / bpe) {                                 \
+            memcpy(tile + offsets[x], linear + x * bpe, 16);                \
+        }                                                                   \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static void radeon_tile_chunks##bpe##_from(uint8_t *tile, uint8_t *linear, \
+                                           unsigned pitch,                  \
+                                           const uint32_t *offsets)         \
+{                                                                           \
+    unsigned x, y;                                                          \
+                                                                            \
+    for (y = 0; y < 8; y++, linear += pitch, offsets += 8) {                \
+        for (x = 0; x < 8; x += 16 / bpe) {                                 \
+            memcpy(linear + x * bpe, tile + offsets[x], 16);                \
+        }                                                                   \
+    }                                                                       \
+}
+
+RADEON_TILE_KERNEL_PIXELS(1)
+RADEON_TILE_KERNEL_PIXELS(2)
+RADEON_TILE_KERNEL_PIXELS(4)
+RADEON_TILE_KERNEL_PIXELS(8)
+RADEON_TILE_KERNEL_PIXELS(16)
+RADEON_TILE_KERNEL_CHUNKS(2)
+RADEON_TILE_KERNEL_CHUNKS(4)
+RADEON_TILE_KERNEL_CHUNKS(8)
+RADEON_TILE_KERNEL_CHUNKS(16)
+
+#ifdef __SSE2__
+/* Copies a 32bpp micro tile made of 2x2 pixel quads, two rows at a time. */
+static void radeon_tile_quads4_to(uint8_t *tile, uint8_t *linear,
+                                  unsigned pitch, const uint32_t *offsets)
+{
+    __m128i a0, a1, b0, b1;
+    unsigned y;
+
+    for (y = 0; y < 8; y += 2, linear += 2 * pitch, offsets += 16) {
+        a0 = _mm_loadu_si128((const __m128i *)linear);
+        a1 = _mm_loadu_si128((const __m128i *)(linear + 16));
+        b0 = _mm_loadu_si128((const __m128i *)(linear + pitch));
+        b1 = _mm_loadu_si128((const __m128i *)(linear + pitch + 16));
+        _mm_storeu_si128((__m128i *)(tile + offsets[0]), _mm_unpacklo_epi64(a0, b0));
+        _mm_storeu_si128((__m128i *)(tile + offsets[2]), _mm_unpackhi_epi64(a0, b0));
+        _mm_storeu_si128((__m128i *)(tile + offsets[4]), _mm_unpacklo_epi64(a1, b1));
+        _mm_storeu_si128((__m128i *)(tile + offsets[6]), _mm_unpackhi_epi64(a1, b1));
+    }
+}
+
+static void radeon_tile_quads4_from(uint8_t *tile, uint8_t *linear,
+                                    unsigned pitch, const uint32_t *offsets)
+{
+    __m128i q0, q1, q2, q3;
+    unsigned y;
+
+    for (y = 0; y < 8; y += 2, linear += 2 * pitch, offsets += 16) {
+        q0 = _mm_loadu_si128((const __m128i *)(tile + offsets[0]));
+        q1 = _mm_loadu_si128((const __m128i *)(tile + offsets[2]));
+        q2 = _mm_loadu_si128((const __m128i *)(tile + offsets[4]));
+        q3 = _mm_loadu_si128((const __m128i *)(tile + offsets[6]));
+        _mm_storeu_si128((__m128i *)linear, _mm_unpacklo_epi64(q0, q1));
+        _mm_storeu_si128((__m128i *)(linear + 16), _mm_unpacklo_epi64(q2, q3));
+        _mm_storeu_si128((__m128i *)(linear + pitch), _mm_unpackhi_epi64(q0, q1));
+        _mm_storeu_si128((__m128i *)(linear + pitch + 16), _mm_unpackhi_epi64(q2, q3));
+    }
+}
+#endif
+
+/* whether each run of n pixels of a row lands in one piece */
+static int radeon_tile_has_runs(const struct radeon_tiling *t, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < 64; i++) {
+        if (i % n && t->offsets[i] != t->offsets[i - 1] + t->bpe) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void radeon_tile_pick_kernels(struct radeon_tiling *t)
+{
+    static const struct {
+        radeon_tile_kernel_t    pixels_to, pixels_from;
+        radeon_tile_kernel_t    chunks_to, chunks_from;
+    } kernels[] = {
+        { radeon_tile_pixels1_to, radeon_tile_pixels1_from, NULL, NULL },
+        { radeon_tile_pixels2_to, radeon_tile_pixels2_from,
+          radeon_tile_chunks2_to, radeon_tile_chunks2_from },
+        { radeon_tile_pixels4_to, radeon_tile_pixels4_from,
+          radeon_tile_chunks4_to, radeon_tile_chunks4_from },
+        { radeon_tile_pixels8_to, radeon_tile_pixels8_from,
+          radeon_tile_chunks8_to, radeon_tile_chunks8_from },
+        { radeon_tile_pixels16_to, radeon_tile_pixels16_from,
+          radeon_tile_chunks16_to, radeon_tile_chunks16_from },
+    };
+    unsigned k = __builtin_ctz(t->bpe);
+
+    t->to_tiled = kernels[k].pixels_to;
+    t->from_tiled = kernels[k].pixels_from;
+    if (t->bpe >= 2 && radeon_tile_has_runs(t, 16 / t->bpe)) {
+        t->to_tiled = kernels[k].chunks_to;
+        t->from_tiled = kernels[k].chunks_from;
+        return;
+    }
+#ifdef __SSE2__
+    if (t->bpe == 4 && radeon_tile_has_runs(t, 2)) {
+        unsigned i;
+
+        /* each pair of pixels is followed by the pair below it */
+        for (i = 0; i < 64; i += 2) {
+            if ((i / 8) % 2 == 0 &&
+                t->offsets[i + 8] != t->offsets[i] + 8) {
+                return;
+            }
+        }
+        t->to_tiled = radeon_tile_quads4_to;
+        t->from_tiled = radeon_tile_quads4_from;
+    }
+#endif
+}
+
+static int radeon_tiling_init(struct radeon_surface_manager *surf_man,
+                              const struct radeon_surface *surf,
+                              unsigned level, unsigned slice,
+                              struct radeon_tiling *t)
+{
+    const struct radeon_surface_level *lvl;
+    unsigned num_banks, i;
+    uint64_t mask;
+
+    if (surf_man == NULL || surf == NULL || level > surf->last_level) {
+        return -EINVAL;
+    }
+    lvl = &surf->level[level];
+    if (slice >= lvl->nblk_z * surf->array_size) {
+        return -EINVAL;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->bpe = surf->bpe;
+    t->mode = lvl->mode;
+    t->width = (lvl->npix_x + surf->blk_w - 1) / surf->blk_w;
+    t->height = (lvl->npix_y + surf->blk_h - 1) / surf->blk_h;
+    t->pitch_bytes = lvl->pitch_bytes;
+    t->base = lvl->offset + slice * lvl->slice_size;
+    if (t->mode < RADEON_SURF_MODE_1D) {
+        return 0;
+    }
+
+    if (surf->nsamples != 1 || t->bpe > 16 || (t->bpe & (t->bpe - 1))) {
+        return -ENOSYS;
+    }
+    if (surf->flags & RADEON_SURF_SCANOUT) {
+        t->order = radeon_tile_order_display[__builtin_ctz(t->bpe)];
+    } else {
+        t->order = radeon_tile_order_thin;
+    }
+    t->tiles_x = lvl->nblk_x / 8;
+    t->tileb = 64 * t->bpe;
+
+    if (t->mode == RADEON_SURF_MODE_2D) {
+        /* r6xx macro tiles aren't built like the later ones */
+        if (surf_man->family <= CHIP_RV740 || t->tileb > surf->tile_split) {
+            return -ENOSYS;
+        }
+        /* slices past the first are rotated over the pipes and banks,
+         * which isn't done here */
+        if (slice > 0) {
+            return -ENOSYS;
+        }
+        t->num_pipes = surf_man->hw_info.num_pipes;
+        num_banks = surf_man->hw_info.num_banks;
+        t->si_pipe_config = -1;
+        if (surf_man->family >= CHIP_TAHITI) {
+            uint32_t gb_tile_mode;
+
+            if (!(surf->flags & RADEON_SURF_HAS_TILE_MODE_INDEX)) {
+                return -ENOSYS;
+            }
+            gb_tile_mode = surf_man->hw_info.tile_mode_array[surf->tiling_index[level]];
+            si_gb_tile_mode(gb_tile_mode, &t->num_pipes, &num_banks,
+                            NULL, NULL, NULL, NULL);
+            t->si_pipe_config = SI__GB_TILE_MODE__PIPE_CONFIG(gb_tile_mode);
+        }
+        t->pipe_bits = __builtin_ctz(t->num_pipes);
+        t->bank_bits = __builtin_ctz(num_banks);
+        t->group_bits = __builtin_ctz(surf_man->hw_info.group_bytes);
+        t->bankw = surf->bankw;
+        t->bankh = surf->bankh;
+        t->mtilea = surf->mtilea;
+        /* a macro tile has to fill a group in each pipe and bank */
+        if (t->bankw * t->bankh * t->tileb < surf_man->hw_info.group_bytes) {
+            return -ENOSYS;
+        }
+        t->mtiles_x = t->tiles_x / (t->bankw * t->num_pipes * t->mtilea);
+    }
+
+    /* every micro tile starts at a multiple of its size within its pipe
+     * and bank, so its pixels are at the same place relative to its start
+     */
+    mask = (1 << t->group_bits) - 1;
+    for (i = 0; i < 64; i++) {
+        uint64_t offset = radeon_tile_pixel_index(t->order, i % 8, i / 8) * t->bpe;
+
+        if (t->mode == RADEON_SURF_MODE_2D) {
+            offset = (offset & mask) |
+                     ((offset & ~mask) << (t->pipe_bits + t->bank_bits));
+        }
+        t->offsets[i] = offset;
+    }
+    radeon_tile_pick_kernels(t);
+    return 0;
+}
+
+static void radeon_tiling_copy(const struct radeon_tiling *t, uint8_t *tiled,
+                               uint8_t *linear, unsigned linear_pitch,
+                               int to_tiled, unsigned flags)
+{
+    unsigned x, y, tx, ty, i;
+    uint8_t *tile, *row;
+
+    tiled += t->base;
+    if (t->mode < RADEON_SURF_MODE_1D) {
+        for (y = 0; y < t->height; y++) {
+            row = linear + (uint64_t)y * linear_pitch;
+            if (to_tiled) {
+                memcpy(tiled + (uint64_t)y * t->pitch_bytes, row, t->width * t->bpe);
+            } else {
+                memcpy(row, tiled + (uint64_t)y * t->pitch_bytes, t->width * t->bpe);
+            }
+        }
+        return;
+    }
+
+    if (flags & RADEON_SURF_COPY_SCALAR) {
+        for (y = 0; y < t->height; y++) {
+            for (x = 0; x < t->width; x++) {
+                tile = tiled + radeon_tile_address(t, x, y);
+                row = linear + (uint64_t)y * linear_pitch + x * t->bpe;
+                if (to_tiled) {
+                    memcpy(tile, row, t->bpe);
+                } else {
+                    memcpy(row, tile, t->bpe);
+                }
+            }
+        }
+        return;
+    }
+
+    for (ty = 0; ty < (t->height + 7) / 8; ty++) {
+        for (tx = 0; tx < (t->width + 7) / 8; tx++) {
+            tile = tiled + radeon_tile_base(t, tx, ty);
+            row = linear + (uint64_t)ty * 8 * linear_pitch + tx * 8 * t->bpe;
+            if (tx * 8 + 8 <= t->width && ty * 8 + 8 <= t->height) {
+                if (to_tiled) {
+                    t->to_tiled(tile, row, linear_pitch, t->offsets);
+                } else {
+                    t->from_tiled(tile, row, linear_pitch, t->offsets);
+                }
+                continue;
+            }
+            /* the pixels of an edge tile inside the surface */
+            for (i = 0; i < 64; i++) {
+                x = i % 8;
+                y = i / 8;
+                if (tx * 8 + x >= t->width || ty * 8 + y >= t->height) {
+                    continue;
+                }
+                if (to_tiled) {
+                    memcpy(tile + t->offsets[i],
+                           row + y * linear_pitch + x * t->bpe, t->bpe);
+                } else {
+                    memcpy(row + y * linear_pitch + x * t->bpe,
+                           tile + t->offsets[i], t->bpe);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Copies slice \p slice of mip level \p level of \p surf from \p linear,
+ * with rows \p linear_pitch bytes apart, to \p tiled, the start of the
+ * surface's buffer.  The level is copied in blocks of surf->bpe bytes, as
+ * many as it has pixels; the stencil of depth/stencil surfaces isn't.
+ * Returns -ENOSYS for layouts the CPU can't address, see radeon_surface.h
+ * for the supported ones.
+ */
+int radeon_surface_copy_to_tiled(struct radeon_surface_manager *surf_man,
+                                 const struct radeon_surface *surf,
+                                 unsigned level, unsigned slice,
+                                 void *tiled, const void *linear,
+                                 unsigned linear_pitch, unsigned flags)
+{
+    struct radeon_tiling t;
+    int r;
+
+    r = radeon_tiling_init(surf_man, surf, level, slice, &t);
+    if (r) {
+        return r;
+    }
+    radeon_tiling_copy(&t, tiled, (uint8_t *)linear, linear_pitch, 1, flags);
+    return 0;
+}
+
+/**
+ * The other way around from radeon_surface_copy_to_tiled().
+ */
+int radeon_surface_copy_from_tiled(struct radeon_surface_manager *surf_man,
+                                   const struct radeon_surface *surf,
+                                   unsigned level, unsigned slice,
+                                   void *linear, unsigned linear_pitch,
+                                   const void *tiled, unsigned flags)
+{
+    struct radeon_tiling t;
+    int r;
+
+    r = radeon_tiling_init(surf_man, surf, level, slice, &t);
+    if (r) {
+        return r;
+    }
+    radeon_tiling_copy(&t, (uint8_t *)tiled, linear, linear_pitch, 0, flags);
+    return 0;
+}
@@ -138,11 +138,65 @@ struct radeon_surface {
     uint32_t                    stencil_tiling_index[RADEON_SURF_MAX_LEVEL];
 };
 
+struct radeon_surface_cache_stats {
+    uint64_t                    hits;
+    uint64_t                    misses;
+    uint64_t                    evictions;
+};
+
+/* What radeon_surface_manager_new() asks the kernel about the device. */
+struct radeon_surface_hw_desc {
+    uint32_t                    device_id;
+    uint32_t                    tiling_config;      /* RADEON_INFO_TILING_CONFIG */
+    uint32_t                    drm_minor;          /* decides on 2D tiling */
+    uint32_t                    tile_mode_array[32]; /* SI only */
+};
+
 struct radeon_surface_manager *radeon_surface_manager_new(int fd);
+struct radeon_surface_manager *
+radeon_surface_manager_new_from_desc(const struct radeon_surface_hw_desc *desc);
+const char *radeon_surface_hw_preset_name(unsigned index);
+const struct radeon_surface_hw_desc *radeon_surface_hw_preset(const char *name);
 void radeon_surface_manager_free(struct radeon_surface_manager *surf_man);
+int radeon_surface_manager_set_cache_size(struct radeon_surface_manager *surf_man,
+                                          unsigned entries);
+void radeon_surface_manager_get_cache_stats(struct radeon_surface_manager *surf_man,
+                                            struct radeon_surface_cache_stats *stats);
 int radeon_surface_init(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
 int radeon_surface_best(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
+int radeon_surface_init_array(struct radeon_surface_manager *surf_man,
+                              struct radeon_surface *surfs, unsigned count,
+                              int *results);
+
+/* CPU tiling and detiling of one slice of one mip level.  Supported are
+ * linear and 1D tiled surfaces of any family, and 2D tiled surfaces on
+ * evergreen and later, where only the first slice can be copied: slices
+ * past it are rotated over the pipes and banks, which isn't modeled.
+ * Everything else returns -ENOSYS, namely:
+ *  - 2D tiling on r6xx/r7xx, whose macro tiles are laid out differently
+ *  - 2D slices past the first of arrays, cubemaps and 3D surfaces
+ *  - multisampled surfaces, and elements that aren't 1, 2, 4, 8 or 16 bytes
+ *  - micro tiles split over several banks (64 * bpe > tile_split)
+ *  - macro tiles smaller than a pipe interleave group
+ *  - SI surfaces without RADEON_SURF_HAS_TILE_MODE_INDEX
+ * The addresses follow the evergreen and SI pipe and bank equations and
+ * are tested against values worked out by hand, not against hardware.
+ */
+
+/* radeon_surface_copy_* flags */
+#define RADEON_SURF_COPY_SCALAR                 (1 << 0) /* per pixel reference */
+
+int radeon_surface_copy_to_tiled(struct radeon_surface_manager *surf_man,
+                                 const struct radeon_surface *surf,
+                                 unsigned level, unsigned slice,
+                                 void *tiled, const void *linear,
+                                 unsigned linear_pitch, unsigned flags);
+int radeon_surface_copy_from_tiled(struct radeon_surface_manager *surf_man,
+                                   const struct radeon_surface *surf,
+                                   unsigned level, unsigned slice,
+                                   void *linear, unsigned linear_pitch,
+                                   const void *tiled, unsigned flags);
 
 #endif
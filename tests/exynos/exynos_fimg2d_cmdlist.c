@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2013 Samsung Electronics Co.Ltd
+ *
+ * This program is free software; you can redistribute  it and/or modify it
+ * under  the terms of  the GNU General  Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ *
+ */
+
+/*
+ * Checks the command lists fimg2d operations hand to the kernel, without
+ * the hardware: the exynos ioctls are caught here and the command lists
+ * recorded.  A solid fill is compared against the registers it has to
+ * write, then a long run of mixed operations is done once summiting each
+ * right away and once in deferred mode, which has to come to the same
+ * command lists and execute them in full batches.  Operations recorded in
+ * deferred mode have to stay ahead of those done after it is disabled, with
+ * the userptr buffers they were recorded with, and those that couldn't be
+ * summited when the kernel refused one have to stay queued.  Last, deferred
+ * batches are executed asynchronously: one that doesn't fit next to those
+ * still running has to be refused without losing anything, and go once
+ * the completion event of an earlier one is fed back through
+ * exynos_handle_event().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+
+#include "exynos_drm.h"
+#include "exynos_drmif.h"
+#include "fimg2d_reg.h"
+#include "fimg2d.h"
+
+#define NUM_OPS		200
+#define MAX_CMDLISTS	(NUM_OPS + 1)
+
+static struct g2d_cmdlist cmdlists[MAX_CMDLISTS];
+/* command lists set, and done, and the one to fail setting */
+static unsigned int cmdlist_nr, exec_nr, executed_nr;
+static unsigned int fail_cmdlist = ~0u;
+/* the last completion event asked for, and how the last exec was done */
+static struct drm_exynos_g2d_event event;
+static unsigned int event_nr, exec_async;
+
+/* The ioctls libdrm_exynos issues end up here instead of in the kernel. */
+int drmIoctl(int fd, unsigned long request, void *arg)
+{
+	struct drm_exynos_g2d_get_ver *ver = arg;
+	struct drm_exynos_g2d_set_cmdlist *cmdlist = arg;
+	struct drm_exynos_g2d_exec *exec = arg;
+	struct g2d_cmdlist *list;
+
+	switch (request) {
+	case DRM_IOCTL_EXYNOS_G2D_GET_VER:
+		ver->major = 4;
+		ver->minor = 1;
+		return 0;
+	case DRM_IOCTL_EXYNOS_G2D_SET_CMDLIST:
+		if (cmdlist_nr >= MAX_CMDLISTS)
+			errx(1, "too many command lists");
+		if (cmdlist_nr - executed_nr >= G2D_MAX_CMD_LIST_NR)
+			errx(1, "command queue overflow");
+		if (cmdlist_nr == fail_cmdlist) {
+			errno = ENOMEM;
+			return -1;
+		}
+		if (cmdlist->event_type == G2D_EVENT_NONSTOP) {
+			memset(&event, 0, sizeof(event));
+			event.base.type = DRM_EXYNOS_G2D_EVENT;
+			event.base.length = sizeof(event);
+			event.user_data = cmdlist->user_data;
+			event.cmdlist_no = cmdlist_nr;
+			event_nr++;
+		} else if (cmdlist->event_type != G2D_EVENT_NOT) {
+			errx(1, "unexpected event type %llu",
+			     (unsigned long long)cmdlist->event_type);
+		}
+		list = &cmdlists[cmdlist_nr++];
+		list->cmd_nr = cmdlist->cmd_nr;
+		list->cmd_buf_nr = cmdlist->cmd_buf_nr;
+		memcpy(list->cmd, (void *)(unsigned long)cmdlist->cmd,
+		       list->cmd_nr * sizeof(list->cmd[0]));
+		memcpy(list->cmd_buf, (void *)(unsigned long)cmdlist->cmd_buf,
+		       list->cmd_buf_nr * sizeof(list->cmd_buf[0]));
+		return 0;
+	case DRM_IOCTL_EXYNOS_G2D_EXEC:
+		exec_async = exec->async;
+		exec_nr++;
+		/* an async exec is done once its event is handled */
+		if (!exec_async)
+			executed_nr = cmdlist_nr;
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static void check_cmd(struct drm_exynos_g2d_cmd *cmd, unsigned int offset,
+		      unsigned int data)
+{
+	if (cmd->offset != offset || cmd->data != data)
+		errx(1, "wrote 0x%08x to 0x%04x, expected 0x%08x to 0x%04x",
+		     cmd->data, cmd->offset, data, offset);
+}
+
+static void check_solid_fill(struct g2d_context *ctx, struct g2d_image *img)
+{
+	struct g2d_cmdlist *list;
+	union g2d_bitblt_cmd_val bitblt;
+
+	cmdlist_nr = exec_nr = executed_nr = 0;
+
+	if (g2d_solid_fill(ctx, img, 16, 32, 64, 8) || g2d_exec(ctx))
+		errx(1, "solid fill failed");
+	if (cmdlist_nr != 1 || exec_nr != 1)
+		errx(1, "solid fill: %u cmdlists, %u execs", cmdlist_nr, exec_nr);
+
+	bitblt.val = 0;
+	bitblt.data.fast_solid_color_fill_en = 1;
+
+	list = &cmdlists[0];
+	if (list->cmd_nr != 7 || list->cmd_buf_nr != 1)
+		errx(1, "solid fill: %u commands, %u buffer commands",
+		     list->cmd_nr, list->cmd_buf_nr);
+	check_cmd(&list->cmd[0], DST_SELECT_REG, G2D_SELECT_MODE_NORMAL);
+	check_cmd(&list->cmd[1], DST_COLOR_MODE_REG, img->color_mode);
+	check_cmd(&list->cmd[2], DST_STRIDE_REG, img->stride);
+	check_cmd(&list->cmd[3], DST_LEFT_TOP_REG, (32 << 16) | 16);
+	check_cmd(&list->cmd[4], DST_RIGHT_BOTTOM_REG, (40 << 16) | 80);
+	check_cmd(&list->cmd[5], SF_COLOR_REG, img->color);
+	check_cmd(&list->cmd[6], BITBLT_COMMAND_REG, bitblt.val);
+	check_cmd(&list->cmd_buf[0], DST_BASE_ADDR_REG, img->bo[0]);
+}
+
+static void run(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst)
+{
+	unsigned int i, x, y;
+	int ret = 0;
+
+	cmdlist_nr = exec_nr = executed_nr = 0;
+
+	for (i = 0; i < NUM_OPS; i++) {
+		x = (i * 7) % 200;
+		y = (i * 13) % 100;
+
+		/* without deferred mode the queue has to be executed by hand */
+		if (!ctx->deferred && cmdlist_nr - executed_nr ==
+		    G2D_MAX_CMD_LIST_NR)
+			ret |= g2d_exec(ctx);
+
+		switch (i % 4) {
+		case 0:
+			ret |= g2d_solid_fill(ctx, dst, x, y, 16, 16);
+			break;
+		case 1:
+			ret |= g2d_copy_with_scale(ctx, src, dst, x, y, 32, 32,
+						   y, x, 16, 16, i & 4);
+			break;
+		case 2:
+			ret |= g2d_blend(ctx, src, dst, x, y, y, x, 24, 24,
+					 G2D_OP_OVER);
+			break;
+		case 3:
+			ret |= g2d_copy(ctx, src, dst, x, y, y, x, 8, 8);
+			break;
+		}
+	}
+	ret |= g2d_exec(ctx);
+
+	if (ret)
+		errx(1, "operations failed");
+}
+
+/*
+ * Deferred fills to a userptr image, then deferred mode is disabled.  The
+ * kernel reads the userptr buffers when the cmdlist is set, so they have to
+ * point to copies kept with the recorded lists rather than into the image.
+ */
+static void check_switch(struct g2d_context *ctx, struct g2d_image *img)
+{
+	struct g2d_image tmp = *img;
+	struct g2d_cmdlist *list;
+	uint32_t userptr[3];
+	unsigned int i;
+
+	cmdlist_nr = exec_nr = executed_nr = 0;
+
+	if (g2d_config_deferred(ctx, 1))
+		errx(1, "g2d_config_deferred failed");
+	tmp.buf_type = G2D_IMGBUF_USERPTR;
+	for (i = 0; i < 3; i++) {
+		tmp.user_ptr[0].userptr = 0x10000 * (i + 1);
+		tmp.user_ptr[0].size = 0x10000;
+		g2d_solid_fill(ctx, &tmp, i * 8, 0, 8, 8);
+	}
+	for (i = 0; i < 3; i++) {
+		list = &ctx->deferred_list[i];
+		userptr[i] = (unsigned long)&list->userptr[0];
+		if (list->cmd_buf[0].offset !=
+		    (DST_BASE_ADDR_REG | G2D_BUF_USERPTR) ||
+		    list->cmd_buf[0].data != userptr[i] ||
+		    list->userptr[0].userptr != 0x10000 * (i + 1))
+			errx(1, "deferred cmdlist %u doesn't own its userptr",
+			     i);
+	}
+	memset(&tmp, 0, sizeof(tmp));
+
+	if (g2d_config_deferred(ctx, 0) || cmdlist_nr != 3)
+		errx(1, "disabling deferred mode summited %u cmdlists",
+		     cmdlist_nr);
+	if (g2d_solid_fill(ctx, img, 24, 0, 8, 8) || g2d_exec(ctx) ||
+	    cmdlist_nr != 4 || exec_nr != 1)
+		errx(1, "switch: %u cmdlists, %u execs", cmdlist_nr, exec_nr);
+
+	for (i = 0; i < 4; i++)
+		check_cmd(&cmdlists[i].cmd[3], DST_LEFT_TOP_REG, i * 8);
+	for (i = 0; i < 3; i++)
+		check_cmd(&cmdlists[i].cmd_buf[0],
+			  DST_BASE_ADDR_REG | G2D_BUF_USERPTR, userptr[i]);
+}
+
+/*
+ * A deferred batch where setting the fifth command list fails.  The ones
+ * after it have to stay recorded, in order and with their userptr buffers,
+ * and go with the next exec.
+ */
+static void check_partial(struct g2d_context *ctx, struct g2d_image *img)
+{
+	struct g2d_image tmp = *img;
+	struct g2d_cmdlist *list;
+	unsigned int i;
+
+	cmdlist_nr = exec_nr = executed_nr = 0;
+
+	if (g2d_config_deferred(ctx, 1))
+		errx(1, "g2d_config_deferred failed");
+	tmp.buf_type = G2D_IMGBUF_USERPTR;
+	for (i = 0; i < 10; i++) {
+		tmp.user_ptr[0].userptr = 0x10000 * (i + 1);
+		tmp.user_ptr[0].size = 0x10000;
+		g2d_solid_fill(ctx, &tmp, i * 8, 0, 8, 8);
+	}
+
+	fail_cmdlist = 4;
+	if (g2d_exec(ctx) >= 0 || cmdlist_nr != 4 || exec_nr != 0 ||
+	    ctx->deferred_nr != 6)
+		errx(1, "failed summit: %u cmdlists set, %u execs, %u kept",
+		     cmdlist_nr, exec_nr, ctx->deferred_nr);
+	for (i = 0; i < ctx->deferred_nr; i++) {
+		list = &ctx->deferred_list[i];
+		if (list->cmd_buf[0].data !=
+		    (uint32_t)(unsigned long)&list->userptr[0] ||
+		    list->userptr[0].userptr != 0x10000 * (i + 5))
+			errx(1, "kept cmdlist %u lost its userptr", i);
+	}
+
+	fail_cmdlist = ~0u;
+	if (g2d_exec(ctx) || cmdlist_nr != 10 || exec_nr != 1 ||
+	    ctx->deferred_nr != 0)
+		errx(1, "retry: %u cmdlists, %u execs, %u kept", cmdlist_nr,
+		     exec_nr, ctx->deferred_nr);
+	for (i = 0; i < 10; i++)
+		check_cmd(&cmdlists[i].cmd[3], DST_LEFT_TOP_REG, i * 8);
+
+	g2d_config_deferred(ctx, 0);
+}
+
+struct async_done {
+	struct g2d_context *ctx;
+	unsigned int done;
+};
+
+static void g2d_event_handler(int fd, unsigned int cmdlist_no,
+			      unsigned int tv_sec, unsigned int tv_usec,
+			      void *user_data)
+{
+	struct async_done *done = user_data;
+
+	done->done = cmdlist_no + 1;
+	executed_nr = done->done;
+	g2d_async_done(done->ctx);
+}
+
+static void vblank_handler(int fd, unsigned int sequence,
+			   unsigned int tv_sec, unsigned int tv_usec,
+			   void *user_data)
+{
+	unsigned int *vblanks = user_data;
+
+	(*vblanks)++;
+}
+
+/*
+ * Frames of fills executed asynchronously, completed by events.  A second
+ * frame fits next to the first, a third only once the first is done.
+ */
+static void check_async(struct g2d_context *ctx, struct g2d_image *dst)
+{
+	struct exynos_event_context evctx;
+	struct drm_event_vblank vblank;
+	struct drm_exynos_g2d_event first;
+	struct exynos_device *dev;
+	struct async_done done;
+	unsigned int vblanks = 0, i;
+	int fds[2];
+
+	done.ctx = ctx;
+	done.done = 0;
+
+	/* without deferred mode the last cmdlist is already submitted */
+	cmdlist_nr = exec_nr = executed_nr = event_nr = 0;
+	g2d_solid_fill(ctx, dst, 0, 0, 8, 8);
+	if (g2d_exec_async(ctx, &done) != -EINVAL || exec_nr != 0)
+		errx(1, "async exec without deferred mode succeeded");
+	g2d_exec(ctx);
+
+	if (g2d_config_deferred(ctx, 1))
+		errx(1, "g2d_config_deferred failed");
+	cmdlist_nr = exec_nr = executed_nr = event_nr = 0;
+	for (i = 0; i < 10; i++)
+		g2d_solid_fill(ctx, dst, i * 8, 0, 8, 8);
+	if (g2d_exec_async(ctx, &done))
+		errx(1, "async exec failed");
+	if (exec_nr != 1 || !exec_async || event_nr != 1 ||
+	    event.cmdlist_no != cmdlist_nr - 1)
+		errx(1, "async exec: %u execs, %u events, event on cmdlist %u "
+		     "of %u", exec_nr, event_nr, event.cmdlist_no, cmdlist_nr);
+	first = event;
+
+	for (i = 0; i < 20; i++)
+		g2d_solid_fill(ctx, dst, i * 8, 8, 8, 8);
+	if (g2d_exec_async(ctx, &done) || exec_nr != 2 || cmdlist_nr != 30)
+		errx(1, "second async exec: %u execs, %u cmdlists", exec_nr,
+		     cmdlist_nr);
+
+	for (i = 0; i < 40; i++)
+		g2d_solid_fill(ctx, dst, i * 8, 16, 8, 8);
+	if (g2d_exec_async(ctx, &done) != -EBUSY || exec_nr != 2 ||
+	    cmdlist_nr != 30 || ctx->deferred_nr != 40)
+		errx(1, "third async exec: %u execs, %u cmdlists, %u kept",
+		     exec_nr, cmdlist_nr, ctx->deferred_nr);
+
+	/* the kernel's side of the drm fd, with a vblank event in between */
+	if (pipe(fds))
+		err(1, "pipe");
+	memset(&vblank, 0, sizeof(vblank));
+	vblank.base.type = DRM_EVENT_VBLANK;
+	vblank.base.length = sizeof(vblank);
+	vblank.user_data = (unsigned long)&vblanks;
+	if (write(fds[1], &vblank, sizeof(vblank)) != sizeof(vblank) ||
+	    write(fds[1], &first, sizeof(first)) != sizeof(first))
+		err(1, "write");
+
+	dev = exynos_device_create(fds[0]);
+	if (!dev)
+		errx(1, "exynos_device_create failed");
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.base.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.base.vblank_handler = vblank_handler;
+	evctx.version = EXYNOS_EVENT_CONTEXT_VERSION;
+	evctx.g2d_event_handler = g2d_event_handler;
+	if (exynos_handle_event(dev, &evctx))
+		errx(1, "exynos_handle_event failed");
+	if (done.done != 10 || vblanks != 1)
+		errx(1, "events: completion after cmdlist %u, %u vblanks",
+		     done.done, vblanks);
+
+	if (g2d_exec_async(ctx, &done) || exec_nr != 3 || cmdlist_nr != 70)
+		errx(1, "retried async exec: %u execs, %u cmdlists", exec_nr,
+		     cmdlist_nr);
+	for (i = 0; i < 40; i++)
+		check_cmd(&cmdlists[30 + i].cmd[3], DST_LEFT_TOP_REG,
+			  (16 << 16) | (i * 8));
+
+	exynos_device_destroy(dev);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(int argc, char **argv)
+{
+	struct g2d_cmdlist *immediate;
+	struct g2d_context *ctx;
+	struct g2d_image src, dst;
+	unsigned int immediate_nr, i;
+
+	ctx = g2d_init(-1);
+	if (!ctx)
+		errx(1, "g2d_init failed");
+
+	memset(&src, 0, sizeof(src));
+	src.color_mode = G2D_COLOR_FMT_ARGB8888 | G2D_ORDER_AXRGB;
+	src.width = 256;
+	src.height = 256;
+	src.stride = 1024;
+	src.buf_type = G2D_IMGBUF_GEM;
+	src.bo[0] = 1;
+
+	memset(&dst, 0, sizeof(dst));
+	dst.color_mode = G2D_COLOR_FMT_XRGB8888 | G2D_ORDER_AXRGB;
+	dst.width = 320;
+	dst.height = 240;
+	dst.stride = 1280;
+	dst.color = 0xff336699;
+	dst.buf_type = G2D_IMGBUF_GEM;
+	dst.bo[0] = 2;
+
+	check_solid_fill(ctx, &dst);
+
+	run(ctx, &src, &dst);
+	immediate_nr = cmdlist_nr;
+	immediate = malloc(sizeof(cmdlists));
+	if (!immediate)
+		errx(1, "out of memory");
+	memcpy(immediate, cmdlists, sizeof(cmdlists));
+
+	if (g2d_config_deferred(ctx, 1))
+		errx(1, "g2d_config_deferred failed");
+	run(ctx, &src, &dst);
+
+	if (cmdlist_nr != immediate_nr)
+		errx(1, "deferred mode summited %u cmdlists, expected %u",
+		     cmdlist_nr, immediate_nr);
+	for (i = 0; i < cmdlist_nr; i++) {
+		struct g2d_cmdlist *a = &immediate[i], *b = &cmdlists[i];
+
+		if (a->cmd_nr != b->cmd_nr || a->cmd_buf_nr != b->cmd_buf_nr ||
+		    memcmp(a->cmd, b->cmd, a->cmd_nr * sizeof(a->cmd[0])) ||
+		    memcmp(a->cmd_buf, b->cmd_buf,
+			   a->cmd_buf_nr * sizeof(a->cmd_buf[0])))
+			errx(1, "deferred cmdlist %u differs", i);
+	}
+	if (exec_nr != (NUM_OPS + G2D_MAX_CMD_LIST_NR - 1) /
+	    G2D_MAX_CMD_LIST_NR)
+		errx(1, "deferred mode executed %u times", exec_nr);
+
+	printf("%u operations, %u cmdlists in %u execs\n", NUM_OPS,
+	       cmdlist_nr, exec_nr);
+
+	g2d_config_deferred(ctx, 0);
+	check_switch(ctx, &dst);
+	check_partial(ctx, &dst);
+	check_async(ctx, &dst);
+
+	free(immediate);
+	g2d_fini(ctx);
+
+	return 0;
+}
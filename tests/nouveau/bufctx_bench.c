@@ -0,0 +1,279 @@
+/*
+ * Copyright 2013 Red Hat Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Replays Mesa-style draws on a buffer context, with the kernel stubbed
+ * out: every draw resets and rebinds its vertex and texture bins, mostly
+ * with the same buffers, validates, and emits a few commands.  The render
+ * target and a bin of relocated methods are rebound now and then, as is a
+ * second buffer context for blits, which flushes the pushbuf.  After each validate every
+ * bound buffer has to be referenced by the pushbuf with the access it was
+ * bound for, and the draw rate is reported:
+ *
+ *   bufctx_bench [draws]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#include "xf86drm.h"
+#include "nouveau_drm.h"
+#include "nouveau.h"
+
+#define BO_SIZE		(64 * 1024)
+#define MAX_BOS		1024
+#define NUM_VTX		4
+#define NUM_TEX		16
+#define NUM_SPARE	32
+
+#define ARRAY_SIZE(a)	(int)(sizeof(a) / sizeof((a)[0]))
+
+enum { BIN_FB, BIN_VTX, BIN_TEX, BIN_MTHD, NUM_BINS };
+
+/* The kernel interface libdrm_nouveau uses, standing in for the real one
+ * from libdrm.
+ */
+static drmFdInfo fd_info = { .version_major = 1 };
+static uint32_t next_handle = 1;
+static unsigned long submits, relocs;
+
+const drmFdInfo *
+drmGetCachedFdInfo(int fd)
+{
+	return &fd_info;
+}
+
+int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	return 0;
+}
+
+int
+drmCommandWrite(int fd, unsigned long index, void *data, unsigned long size)
+{
+	return 0;
+}
+
+int
+drmCommandWriteRead(int fd, unsigned long index, void *data,
+		    unsigned long size)
+{
+	struct drm_nouveau_getparam *param = data;
+	struct drm_nouveau_channel_alloc *chan = data;
+	struct drm_nouveau_gem_new *gem = data;
+	struct drm_nouveau_gem_pushbuf *req = data;
+
+	switch (index) {
+	case DRM_NOUVEAU_GETPARAM:
+		if (param->param == NOUVEAU_GETPARAM_CHIPSET_ID)
+			param->value = 0x40;
+		else
+			param->value = 256 * 1024 * 1024;
+		return 0;
+	case DRM_NOUVEAU_CHANNEL_ALLOC:
+		chan->channel = 1;
+		chan->pushbuf_domains = NOUVEAU_GEM_DOMAIN_GART;
+		return 0;
+	case DRM_NOUVEAU_GEM_NEW:
+		if (next_handle == MAX_BOS)
+			return -ENOMEM;
+		gem->info.handle = next_handle++;
+		gem->info.map_handle = (uint64_t)gem->info.handle * BO_SIZE;
+		return 0;
+	case DRM_NOUVEAU_GEM_PUSHBUF:
+		req->vram_available = 256 * 1024 * 1024;
+		req->gart_available = 256 * 1024 * 1024;
+		relocs += req->nr_relocs;
+		submits++;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+check(struct nouveau_pushbuf *push, struct nouveau_bo *bo, uint32_t access)
+{
+	if ((nouveau_pushbuf_refd(push, bo) & access) != access)
+		errx(1, "bound buffer %u not on the pushbuf", bo->handle);
+}
+
+static struct nouveau_bo *
+new_bo(struct nouveau_device *dev)
+{
+	struct nouveau_bo *bo = NULL;
+
+	if (nouveau_bo_new(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 0, 4096,
+			   NULL, &bo))
+		errx(1, "couldn't allocate a buffer");
+	return bo;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct nouveau_device *dev;
+	struct nouveau_client *client;
+	struct nouveau_object *chan;
+	struct nouveau_pushbuf *push;
+	struct nouveau_bufctx *bctx, *blit;
+	struct nv04_fifo fifo = {};
+	struct nouveau_bo *bos[2 + NUM_VTX + NUM_TEX + NUM_SPARE];
+	struct nouveau_bo **fb = bos, **vtx = fb + 2, *tex[NUM_TEX];
+	struct nouveau_bo **spare = vtx + NUM_VTX + NUM_TEX;
+	double start, time;
+	int draws = 200000, fd, d, i;
+	FILE *file;
+	void *rand;
+
+	if (argc > 1)
+		draws = atoi(argv[1]);
+
+	/* buffers are mapped from a file standing in for the device */
+	file = tmpfile();
+	if (!file)
+		err(1, "tmpfile");
+	fd = fileno(file);
+	if (ftruncate(fd, (off_t)MAX_BOS * BO_SIZE))
+		err(1, "ftruncate");
+
+	if (nouveau_device_wrap(fd, 0, &dev) ||
+	    nouveau_client_new(dev, &client) ||
+	    nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+			       &fifo, sizeof(fifo), &chan) ||
+	    nouveau_pushbuf_new(client, chan, 4, BO_SIZE, true, &push) ||
+	    nouveau_bufctx_new(client, NUM_BINS, &bctx) ||
+	    nouveau_bufctx_new(client, 1, &blit))
+		errx(1, "couldn't set up the fake device");
+	nouveau_pushbuf_bufctx(push, bctx);
+
+	for (i = 0; i < ARRAY_SIZE(bos); i++)
+		bos[i] = new_bo(dev);
+	for (i = 0; i < NUM_TEX; i++)
+		tex[i] = vtx[NUM_VTX + i];
+
+	rand = drmRandomCreate(1);
+	start = get_time();
+	for (d = 0; d < draws; d++) {
+		/* now and then a texture or the render target changes */
+		if (drmRandom(rand) % 16 == 0)
+			tex[drmRandom(rand) % NUM_TEX] =
+				spare[drmRandom(rand) % NUM_SPARE];
+
+		if (d == 0 || drmRandom(rand) % 64 == 0) {
+			nouveau_bufctx_reset(bctx, BIN_FB);
+			for (i = 0; i < 2; i++)
+				nouveau_bufctx_refn(bctx, BIN_FB, fb[i],
+						    NOUVEAU_BO_GART |
+						    NOUVEAU_BO_RDWR);
+			nouveau_bufctx_reset(bctx, BIN_MTHD);
+			for (i = 0; i < 2; i++)
+				nouveau_bufctx_mthd(bctx, BIN_MTHD,
+						    0x00040000 | (0x200 + i * 4),
+						    fb[i], 0,
+						    NOUVEAU_BO_GART |
+						    NOUVEAU_BO_LOW |
+						    NOUVEAU_BO_RDWR, 0, 0);
+		}
+
+		nouveau_bufctx_reset(bctx, BIN_VTX);
+		for (i = 0; i < NUM_VTX; i++)
+			nouveau_bufctx_refn(bctx, BIN_VTX, vtx[i],
+					    NOUVEAU_BO_GART | NOUVEAU_BO_RD);
+		nouveau_bufctx_reset(bctx, BIN_TEX);
+		for (i = 0; i < NUM_TEX; i++)
+			nouveau_bufctx_refn(bctx, BIN_TEX, tex[i],
+					    NOUVEAU_BO_GART | NOUVEAU_BO_RD);
+
+		if (nouveau_pushbuf_space(push, 64, 0, 0) ||
+		    nouveau_pushbuf_validate(push))
+			errx(1, "validate failed");
+
+		for (i = 0; i < 2; i++)
+			check(push, fb[i], NOUVEAU_BO_RDWR);
+		for (i = 0; i < NUM_VTX; i++)
+			check(push, vtx[i], NOUVEAU_BO_RD);
+		for (i = 0; i < NUM_TEX; i++)
+			check(push, tex[i], NOUVEAU_BO_RD);
+
+		for (i = 0; i < 48; i++)
+			*push->cur++ = 0;
+
+		/* and sometimes there's a blit with its own buffer context,
+		 * flushed before going back to draws
+		 */
+		if (drmRandom(rand) % 256 == 0) {
+			nouveau_pushbuf_bufctx(push, blit);
+			nouveau_bufctx_reset(blit, 0);
+			nouveau_bufctx_refn(blit, 0, fb[0], NOUVEAU_BO_GART |
+					    NOUVEAU_BO_RD);
+			nouveau_bufctx_refn(blit, 0, spare[d % NUM_SPARE],
+					    NOUVEAU_BO_GART | NOUVEAU_BO_WR);
+			if (nouveau_pushbuf_space(push, 16, 0, 0) ||
+			    nouveau_pushbuf_validate(push))
+				errx(1, "validate failed");
+			nouveau_pushbuf_kick(push, chan);
+			nouveau_pushbuf_bufctx(push, bctx);
+		}
+	}
+	nouveau_pushbuf_kick(push, chan);
+	time = get_time() - start;
+	drmRandomDestroy(rand);
+
+	printf("%d draws, %lu submits, %.1f relocs per submit\n", draws,
+	       submits, (double)relocs / submits);
+	printf("%.0f draws/s\n", draws / time);
+
+	nouveau_bufctx_del(&blit);
+	nouveau_bufctx_del(&bctx);
+	nouveau_pushbuf_del(&push);
+	for (i = 0; i < ARRAY_SIZE(bos); i++)
+		nouveau_bo_ref(NULL, &bos[i]);
+	nouveau_object_del(&chan);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	fclose(file);
+
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2013 Red Hat Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs the client kref table through what pushbufs do with it, without a
+ * kernel: each frame references a set of buffers, looks them up over and
+ * over while emitting, and drops them all again when flushing.  Some
+ * buffers are dropped early to check that lookups survive removals.  The
+ * same frames run with handles numbered densely from 1, as a fresh
+ * process gets them, and with sparse handles spread over 32 bits:
+ *
+ *   kref_bench [frames]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "private.h"
+
+#define NUM_BOS		1024
+#define LOOKUPS		16
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct drm_nouveau_gem_pushbuf_bo krefs[NUM_BOS];
+static struct nouveau_pushbuf *fake_push = (void *)&krefs;
+
+static void
+check(struct nouveau_client *client, struct nouveau_bo *bo, int i, bool set)
+{
+	struct drm_nouveau_gem_pushbuf_bo *kref = cli_kref_get(client, bo);
+	struct nouveau_pushbuf *push = cli_push_get(client, bo);
+
+	if (set && (kref != &krefs[i] || push != fake_push))
+		errx(1, "handle %u: lost its kref", bo->handle);
+	if (!set && (kref || push))
+		errx(1, "handle %u: kref left behind", bo->handle);
+}
+
+static double
+run(struct nouveau_bo *bos, int frames, unsigned *table)
+{
+	struct nouveau_client_priv *pcli = calloc(1, sizeof(*pcli));
+	struct nouveau_client *client = &pcli->base;
+	double start, time = 0;
+	int f, i, j;
+
+	if (!pcli)
+		errx(1, "out of memory");
+
+	for (f = 0; f < frames; f++) {
+		start = get_time();
+		for (i = 0; i < NUM_BOS; i++) {
+			if (cli_kref_reserve(client))
+				errx(1, "out of memory");
+			cli_kref_set(client, &bos[i], &krefs[i], fake_push);
+		}
+		for (j = 0; j < LOOKUPS; j++) {
+			for (i = 0; i < NUM_BOS; i++) {
+				if (cli_kref_get(client, &bos[i]) != &krefs[i])
+					errx(1, "handle %u: lost its kref",
+					     bos[i].handle);
+			}
+		}
+		for (i = 0; i < NUM_BOS; i++)
+			cli_kref_set(client, &bos[i], NULL, NULL);
+		time += get_time() - start;
+
+		/* drop every third buffer first, then the rest */
+		for (i = 0; i < NUM_BOS; i++) {
+			cli_kref_reserve(client);
+			cli_kref_set(client, &bos[i], &krefs[i], fake_push);
+		}
+		for (i = f % 3; i < NUM_BOS; i += 3)
+			cli_kref_set(client, &bos[i], NULL, NULL);
+		for (i = 0; i < NUM_BOS; i++)
+			check(client, &bos[i], i, (i - f) % 3 != 0);
+		for (i = 0; i < NUM_BOS; i++)
+			cli_kref_set(client, &bos[i], NULL, NULL);
+		for (i = 0; i < NUM_BOS; i++)
+			check(client, &bos[i], i, false);
+		if (pcli->kref_used)
+			errx(1, "%u krefs left in an empty table",
+			     pcli->kref_used);
+	}
+
+	*table = pcli->kref_nr;
+	free(pcli->kref);
+	free(pcli);
+
+	return time;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct nouveau_bo *bos;
+	double dense, sparse;
+	unsigned dense_nr, sparse_nr, max = 0;
+	int frames = 2000, i, j;
+	void *rand;
+
+	if (argc > 1)
+		frames = atoi(argv[1]);
+
+	bos = calloc(NUM_BOS, sizeof(*bos));
+	if (!bos)
+		errx(1, "out of memory");
+
+	for (i = 0; i < NUM_BOS; i++)
+		bos[i].handle = i + 1;
+	dense = run(bos, frames, &dense_nr);
+
+	rand = drmRandomCreate(1);
+	for (i = 0; i < NUM_BOS; i++) {
+		do {
+			bos[i].handle = drmRandom(rand) | 1;
+			for (j = 0; j < i; j++) {
+				if (bos[j].handle == bos[i].handle)
+					break;
+			}
+		} while (j < i);
+		if (bos[i].handle > max)
+			max = bos[i].handle;
+	}
+	drmRandomDestroy(rand);
+	sparse = run(bos, frames, &sparse_nr);
+
+	if (dense_nr > NUM_BOS * 4 || sparse_nr != dense_nr)
+		errx(1, "table of %u entries for %d buffers",
+		     sparse_nr, NUM_BOS);
+
+	frames *= NUM_BOS * (LOOKUPS + 2);
+	printf("%d buffers, %zu kB table\n", NUM_BOS,
+	       sparse_nr * sizeof(struct nouveau_client_kref) / 1024);
+	printf("dense handles:  %6.1f ns per operation\n", dense * 1e9 / frames);
+	printf("sparse handles: %6.1f ns per operation, up to handle %u\n",
+	       sparse * 1e9 / frames, max);
+
+	free(bos);
+	return 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Copyright 2013 Red Hat Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Runs the buffer ring of an immediate pushbuf against a stubbed kernel
+ * whose GPU is idle, then busy, then idle again.  While idle the ring
+ * has to stay at the buffers it was created with.  While busy it has to
+ * grow up to its limit before stalling on the oldest buffer, and once
+ * the GPU catches up it has to shrink back.  The counters reported by
+ * nouveau_pushbuf_get_stats() are checked at each step.
+ *
+ * Last, relocs are dropped for lack of memory, which has to fail the next
+ * kick without submitting anything.  An immediate pushbuf has to be usable
+ * again after that kick, a deferred one has to stay failed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#include "xf86drm.h"
+#include "nouveau_drm.h"
+#include "nouveau.h"
+
+#define BO_SIZE		4096
+#define MAX_BOS		256
+#define NUM_RING	2
+/* the ring's limit, PUSHBUF_GROW_LIMIT times the buffers it starts with */
+#define MAX_RING	(NUM_RING * 4)
+
+/* The kernel interface libdrm_nouveau uses, standing in for the real one
+ * from libdrm.  Buffers submitted while the GPU is busy stay busy until
+ * they're waited for or retire() is called.
+ */
+static drmFdInfo fd_info = { .version_major = 1 };
+static uint32_t next_handle = 1;
+static bool gpu_busy, busy[MAX_BOS];
+static unsigned long submits;
+static bool fail_realloc;
+
+const drmFdInfo *
+drmGetCachedFdInfo(int fd)
+{
+	return &fd_info;
+}
+
+int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	return 0;
+}
+
+int
+drmCommandWrite(int fd, unsigned long index, void *data, unsigned long size)
+{
+	struct drm_nouveau_gem_cpu_prep *prep = data;
+
+	if (index == DRM_NOUVEAU_GEM_CPU_PREP && busy[prep->handle]) {
+		if (prep->flags & NOUVEAU_GEM_CPU_PREP_NOWAIT)
+			return -EBUSY;
+		busy[prep->handle] = false;
+	}
+	return 0;
+}
+
+int
+drmCommandWriteRead(int fd, unsigned long index, void *data,
+		    unsigned long size)
+{
+	struct drm_nouveau_getparam *param = data;
+	struct drm_nouveau_channel_alloc *chan = data;
+	struct drm_nouveau_gem_new *gem = data;
+	struct drm_nouveau_gem_pushbuf *req = data;
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	uint32_t i;
+
+	switch (index) {
+	case DRM_NOUVEAU_GETPARAM:
+		if (param->param == NOUVEAU_GETPARAM_CHIPSET_ID)
+			param->value = 0x40;
+		else
+			param->value = 256 * 1024 * 1024;
+		return 0;
+	case DRM_NOUVEAU_CHANNEL_ALLOC:
+		chan->channel = 1;
+		chan->pushbuf_domains = NOUVEAU_GEM_DOMAIN_GART;
+		return 0;
+	case DRM_NOUVEAU_GEM_NEW:
+		if (next_handle == MAX_BOS)
+			return -ENOMEM;
+		gem->info.handle = next_handle++;
+		gem->info.map_handle = (uint64_t)gem->info.handle * BO_SIZE;
+		return 0;
+	case DRM_NOUVEAU_GEM_PUSHBUF:
+		req->vram_available = 256 * 1024 * 1024;
+		req->gart_available = 256 * 1024 * 1024;
+		kref = (void *)(unsigned long)req->buffers;
+		for (i = 0; i < req->nr_buffers; i++)
+			busy[kref[i].handle] = gpu_busy;
+		if (req->nr_push)
+			submits++;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* lets the reloc and push arrays of a pushbuf fail to grow */
+void *
+realloc(void *ptr, size_t size)
+{
+	void *new;
+
+	if (fail_realloc)
+		return NULL;
+	new = malloc(size);
+	if (new && ptr) {
+		if (size > malloc_usable_size(ptr))
+			size = malloc_usable_size(ptr);
+		memcpy(new, ptr, size);
+	}
+	if (new || !size)
+		free(ptr);
+	return new;
+}
+
+static void
+retire(void)
+{
+	memset(busy, 0, sizeof(busy));
+}
+
+/* fill most of a buffer, so that every call switches to the next one */
+static void
+fill(struct nouveau_pushbuf *push, int times)
+{
+	int t, i;
+
+	for (t = 0; t < times; t++) {
+		if (nouveau_pushbuf_space(push, BO_SIZE / 4 / 2 + 1, 0, 0))
+			errx(1, "no space on the pushbuf");
+		for (i = 0; i < BO_SIZE / 4 / 2 + 1; i++)
+			*push->cur++ = 0;
+	}
+}
+
+static void
+check(struct nouveau_pushbuf *push, const char *what, uint64_t stalls,
+      uint64_t grows, uint64_t shrinks, uint32_t buffers)
+{
+	struct nouveau_pushbuf_stats stats;
+
+	nouveau_pushbuf_get_stats(push, &stats);
+	printf("%s: %u buffers, %llu stalls, %llu grows, %llu shrinks\n",
+	       what, stats.buffers, (unsigned long long)stats.stalls,
+	       (unsigned long long)stats.grows,
+	       (unsigned long long)stats.shrinks);
+	if (stats.stalls != stalls || stats.grows != grows ||
+	    stats.shrinks != shrinks || stats.buffers != buffers)
+		errx(1, "%s: expected %u buffers, %llu stalls, %llu grows, "
+		     "%llu shrinks", what, buffers, (unsigned long long)stalls,
+		     (unsigned long long)grows, (unsigned long long)shrinks);
+}
+
+/* emits a reloc while the reloc array can't grow, and returns what the
+ * kick after that returned.  No relocs were reserved on the pushbufs, so
+ * the array is still empty and the reloc is dropped.
+ */
+static int
+drop_relocs(struct nouveau_pushbuf *push, struct nouveau_object *chan,
+	    struct nouveau_bo *bo)
+{
+	struct nouveau_pushbuf_refn ref = { bo, NOUVEAU_BO_GART |
+						NOUVEAU_BO_RD };
+	unsigned long start = submits;
+	int ret;
+
+	if (nouveau_pushbuf_space(push, 16, 0, 0) ||
+	    nouveau_pushbuf_refn(push, &ref, 1))
+		errx(1, "no space on the pushbuf");
+	fail_realloc = true;
+	nouveau_pushbuf_reloc(push, bo, 0, NOUVEAU_BO_LOW, 0, 0);
+	fail_realloc = false;
+
+	ret = nouveau_pushbuf_kick(push, chan);
+	if (submits != start)
+		errx(1, "commands with dropped relocs were submitted");
+	return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct nouveau_device *dev;
+	struct nouveau_client *client;
+	struct nouveau_object *chan;
+	struct nouveau_pushbuf *push, *defer;
+	struct nouveau_bo *bo = NULL;
+	struct nv04_fifo fifo = {};
+	unsigned long start;
+	int fd;
+	FILE *file;
+
+	/* buffers are mapped from a file standing in for the device */
+	file = tmpfile();
+	if (!file)
+		err(1, "tmpfile");
+	fd = fileno(file);
+	if (ftruncate(fd, (off_t)MAX_BOS * BO_SIZE))
+		err(1, "ftruncate");
+
+	if (nouveau_device_wrap(fd, 0, &dev) ||
+	    nouveau_client_new(dev, &client) ||
+	    nouveau_object_new(&dev->object, 0, NOUVEAU_FIFO_CHANNEL_CLASS,
+			       &fifo, sizeof(fifo), &chan) ||
+	    nouveau_pushbuf_new(client, chan, NUM_RING, BO_SIZE, true, &push) ||
+	    nouveau_pushbuf_new(client, chan, 1, BO_SIZE, false, &defer) ||
+	    nouveau_bo_new(dev, NOUVEAU_BO_GART | NOUVEAU_BO_MAP, 0, BO_SIZE,
+			   NULL, &bo))
+		errx(1, "couldn't set up the fake device");
+
+	/* the GPU keeps up: the ring's own buffers are reused in turn */
+	start = submits;
+	fill(push, 32);
+	check(push, "idle", 0, 0, 0, NUM_RING);
+	if (submits - start != 31)
+		errx(1, "idle: %lu submits for 32 buffers", submits - start);
+
+	/* the GPU falls behind: after the one buffer it had finished, the
+	 * ring grows to its limit, and then each switch has to wait for the
+	 * oldest buffer
+	 */
+	gpu_busy = true;
+	fill(push, 1 + MAX_RING - NUM_RING + 4);
+	check(push, "busy", 4, MAX_RING - NUM_RING, 0, MAX_RING);
+
+	/* the GPU catches up: every lap that finds only idle buffers
+	 * drops one, down to the buffers the ring started with
+	 */
+	gpu_busy = false;
+	retire();
+	fill(push, MAX_RING * MAX_RING * 2);
+	check(push, "caught up", 4, MAX_RING - NUM_RING, MAX_RING - NUM_RING,
+	      NUM_RING);
+
+	/* an immediate pushbuf reports the dropped relocs once */
+	if (drop_relocs(push, chan, bo) != -ENOMEM)
+		errx(1, "immediate: kick didn't fail on dropped relocs");
+	start = submits;
+	fill(push, 1);
+	if (nouveau_pushbuf_kick(push, chan) || submits != start + 1)
+		errx(1, "immediate: unusable after the failed kick");
+
+	/* a deferred one can't be trusted anymore */
+	if (drop_relocs(defer, chan, bo) != -ENOMEM ||
+	    nouveau_pushbuf_kick(defer, chan) != -ENOMEM ||
+	    submits != start + 1)
+		errx(1, "deferred: kick didn't fail on dropped relocs");
+	printf("dropped relocs: kicks failed\n");
+
+	nouveau_bo_ref(NULL, &bo);
+	nouveau_pushbuf_del(&defer);
+	nouveau_pushbuf_del(&push);
+	nouveau_object_del(&chan);
+	nouveau_client_del(&client);
+	nouveau_device_del(&dev);
+	fclose(file);
+
+	return 0;
+}
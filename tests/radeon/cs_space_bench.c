@@ -0,0 +1,235 @@
+/*
+ * Copyright © 2013 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Runs DDX-style space checking over thousands of fake bos, without a
+ * kernel: every operation adds its bos one at a time, checking space after
+ * each, then checks a few temporary bos.  The same workload runs once on a
+ * cs set up outside libdrm, which the space checker rescans from scratch
+ * on every check, and once on a gem cs, which it checks incrementally.
+ * Both have to come to the same results, and the time of each is reported:
+ *
+ *   cs_space_bench [operations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <err.h>
+#include "xf86drm.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_cs_int.h"
+#include "radeon_bo_int.h"
+
+#define NUM_BOS		4096
+/* bos used as render targets, textures and vertex buffers */
+#define NUM_TARGETS	256
+#define NUM_TEXTURES	3072
+#define MAX_OP_BOS	24
+#define TEMP_BOS	8
+
+struct bench {
+    struct radeon_bo_manager bom;
+    struct radeon_cs_manager *csm;
+    struct radeon_cs *cs;
+    struct radeon_bo_int *bos;
+    int flushes;
+    int checks;
+    uint32_t trace;
+};
+
+static void bo_ref(struct radeon_bo_int *bo)
+{
+}
+
+static struct radeon_bo *bo_unref(struct radeon_bo_int *bo)
+{
+    return (struct radeon_bo *)bo;
+}
+
+static struct radeon_bo_funcs bo_funcs = {
+    .bo_ref = bo_ref,
+    .bo_unref = bo_unref,
+};
+
+static int fake_cs_emit(struct radeon_cs_int *cs)
+{
+    cs->csm->read_used = 0;
+    cs->csm->vram_write_used = 0;
+    cs->csm->gart_write_used = 0;
+    return 0;
+}
+
+static struct radeon_cs_funcs fake_cs_funcs = {
+    .cs_emit = fake_cs_emit,
+};
+
+/* What emitting the cs does to the accounting.  The bos aren't in the cs
+ * as relocs, so the emit doesn't reset theirs: do it here.  The gem cs
+ * has no kernel to go to, it only resets the manager totals.
+ */
+static void flush(void *data)
+{
+    struct bench *b = data;
+    int i;
+
+    for (i = 0; i < NUM_BOS; i++)
+        b->bos[i].space_accounted = 0;
+    radeon_cs_emit(b->cs);
+    b->flushes++;
+}
+
+static double get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void record(struct bench *b, int ret)
+{
+    b->trace = b->trace * 31 + ret;
+    b->trace = b->trace * 31 + b->csm->read_used;
+    b->trace = b->trace * 31 + b->csm->vram_write_used;
+    b->trace = b->trace * 31 + b->csm->gart_write_used;
+    b->checks++;
+}
+
+static double run(struct bench *b, int operations)
+{
+    struct radeon_cs *cs = b->cs;
+    void *rand;
+    double start;
+    int i, j, n;
+
+    radeon_cs_space_set_flush(cs, flush, b);
+    radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, 256 * 1024 * 1024);
+    radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, 512 * 1024 * 1024);
+    flush(b);
+    b->flushes = 0;
+    b->checks = 0;
+    b->trace = 0;
+
+    rand = drmRandomCreate(1);
+    start = get_time();
+    for (i = 0; i < operations; i++) {
+        struct radeon_bo *bo;
+
+        radeon_cs_space_reset_bos(cs);
+
+        /* a render target, then textures, checking after each */
+        bo = (struct radeon_bo *)&b->bos[drmRandom(rand) % NUM_TARGETS];
+        radeon_cs_space_add_persistent_bo(cs, bo, 0, RADEON_GEM_DOMAIN_VRAM);
+        record(b, radeon_cs_space_check(cs));
+
+        n = drmRandom(rand) % MAX_OP_BOS;
+        for (j = 0; j < n; j++) {
+            bo = (struct radeon_bo *)&b->bos[NUM_TARGETS +
+                                             drmRandom(rand) % NUM_TEXTURES];
+            radeon_cs_space_add_persistent_bo(cs, bo,
+                                              RADEON_GEM_DOMAIN_GTT |
+                                              RADEON_GEM_DOMAIN_VRAM, 0);
+            record(b, radeon_cs_space_check(cs));
+        }
+
+        /* vertex buffers */
+        for (j = 0; j < TEMP_BOS; j++) {
+            bo = (struct radeon_bo *)&b->bos[NUM_TARGETS + NUM_TEXTURES +
+                                             drmRandom(rand) %
+                                             (NUM_BOS - NUM_TARGETS -
+                                              NUM_TEXTURES)];
+            record(b, radeon_cs_space_check_with_bo(cs, bo,
+                                                    RADEON_GEM_DOMAIN_GTT, 0));
+        }
+    }
+    radeon_cs_space_reset_bos(cs);
+    drmRandomDestroy(rand);
+
+    return get_time() - start;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b;
+    struct radeon_cs_manager fake_csm;
+    struct radeon_cs_int fake_cs;
+    uint32_t trace;
+    double t_full, t_incr;
+    int operations = 20000, flushes, checks;
+    void *rand;
+    int i;
+
+    if (argc > 1)
+        operations = atoi(argv[1]);
+
+    memset(&b, 0, sizeof(b));
+    b.bom.funcs = &bo_funcs;
+    b.bos = calloc(NUM_BOS, sizeof(*b.bos));
+    if (b.bos == NULL)
+        errx(1, "out of memory");
+    rand = drmRandomCreate(2);
+    for (i = 0; i < NUM_BOS; i++) {
+        b.bos[i].bom = &b.bom;
+        b.bos[i].handle = i + 1;
+        b.bos[i].size = (1 + drmRandom(rand) % 256) * 4096;
+        b.bos[i].cref = 1;
+    }
+    drmRandomDestroy(rand);
+
+    /* a cs the way one made outside libdrm looks */
+    memset(&fake_csm, 0, sizeof(fake_csm));
+    fake_csm.funcs = &fake_cs_funcs;
+    memset(&fake_cs, 0, sizeof(fake_cs));
+    fake_cs.csm = &fake_csm;
+    b.csm = &fake_csm;
+    b.cs = (struct radeon_cs *)&fake_cs;
+
+    t_full = run(&b, operations);
+    trace = b.trace;
+    flushes = b.flushes;
+    checks = b.checks;
+
+    /* a gem cs, which never gets to the kernel */
+    b.csm = radeon_cs_manager_gem_ctor(-1);
+    if (b.csm == NULL)
+        errx(1, "out of memory");
+    b.cs = radeon_cs_create(b.csm, 1024);
+    if (b.cs == NULL)
+        errx(1, "out of memory");
+
+    t_incr = run(&b, operations);
+    if (b.trace != trace || b.flushes != flushes)
+        errx(1, "incremental checks differ: %d flushes, expected %d",
+             b.flushes, flushes);
+
+    printf("%d checks, %d flushes\n", checks, flushes);
+    printf("full rescan:  %8.0f checks/s\n", checks / t_full);
+    printf("incremental:  %8.0f checks/s\n", checks / t_incr);
+
+    radeon_cs_destroy(b.cs);
+    radeon_cs_manager_gem_dtor(b.csm);
+    free(b.bos);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+
+# Checks the surface layouts on the bundled hardware descriptions against
+# the reference.
+
+TEST_DIR=`dirname "$0"`
+REF_FILENAME="$TEST_DIR/surface-layout-ref.txt"
+NEW_FILENAME="$TEST_DIR/surface-layout-new.txt"
+
+./surface_layout > $NEW_FILENAME
+
+ret=$?
+if test $ret = 0; then
+    diff -u $REF_FILENAME $NEW_FILENAME
+    ret=$?
+fi
+
+if test $ret = 0; then
+    rm -f $NEW_FILENAME
+fi
+
+exit $ret
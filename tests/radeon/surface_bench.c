@@ -0,0 +1,256 @@
+/*
+ * Copyright © 2013 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Replays a trace of surface allocations the way a GL driver makes them:
+ * mipmapped textures of a few common sizes and formats, cube maps and
+ * volumes, plus window-sized color and depth/stencil buffers, with the
+ * popular ones allocated again and again.  Each allocation picks its tiling
+ * parameters with radeon_surface_best() and then lays the surface out with
+ * radeon_surface_init().  For each bundled hardware description, the trace
+ * runs once without the surface manager's layout cache and once with it;
+ * both have to compute the same layouts, and the time of each is reported:
+ *
+ *   surface_bench [allocations [cache entries]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include "xf86drm.h"
+#include "radeon_surface.h"
+
+#define NUM_DESCS	2048
+
+struct desc {
+    uint32_t npix_x, npix_y, npix_z;
+    uint32_t array_size, last_level;
+    uint32_t bpe, nsamples, flags;
+};
+
+static unsigned log2_of(unsigned x)
+{
+    unsigned l = 0;
+
+    while (x >>= 1)
+        l++;
+    return l;
+}
+
+static void make_desc(void *rand, struct desc *d)
+{
+    static const uint32_t bpes[] = { 1, 2, 4, 4, 4, 8, 16 };
+    static const uint32_t windows[][2] = {
+        { 1024, 768 }, { 1280, 1024 }, { 1366, 768 }, { 1920, 1080 },
+    };
+    unsigned r = drmRandom(rand) % 16, w;
+
+    memset(d, 0, sizeof(*d));
+    d->npix_z = 1;
+    d->array_size = 1;
+    d->nsamples = 1;
+    d->bpe = bpes[drmRandom(rand) % (sizeof(bpes) / sizeof(bpes[0]))];
+
+    if (r < 10) {
+        /* mipmapped 2D texture */
+        d->npix_x = 1 << (2 + drmRandom(rand) % 10);
+        d->npix_y = 1 << (2 + drmRandom(rand) % 10);
+        d->last_level = log2_of(d->npix_x > d->npix_y ? d->npix_x : d->npix_y);
+        d->flags = RADEON_SURF_SET(RADEON_SURF_TYPE_2D, TYPE) |
+                   RADEON_SURF_SET(RADEON_SURF_MODE_2D, MODE);
+    } else if (r < 11) {
+        /* cube map */
+        d->npix_x = d->npix_y = 1 << (4 + drmRandom(rand) % 6);
+        d->array_size = 6;
+        d->last_level = log2_of(d->npix_x);
+        d->flags = RADEON_SURF_SET(RADEON_SURF_TYPE_CUBEMAP, TYPE) |
+                   RADEON_SURF_SET(RADEON_SURF_MODE_2D, MODE);
+    } else if (r < 12) {
+        /* volume */
+        d->npix_x = d->npix_y = d->npix_z = 1 << (3 + drmRandom(rand) % 4);
+        d->flags = RADEON_SURF_SET(RADEON_SURF_TYPE_3D, TYPE) |
+                   RADEON_SURF_SET(RADEON_SURF_MODE_1D, MODE);
+    } else if (r < 13) {
+        /* linear streaming texture */
+        d->npix_x = 16 + drmRandom(rand) % 1024;
+        d->npix_y = 16 + drmRandom(rand) % 1024;
+        d->flags = RADEON_SURF_SET(RADEON_SURF_TYPE_2D, TYPE) |
+                   RADEON_SURF_SET(RADEON_SURF_MODE_LINEAR_ALIGNED, MODE);
+    } else {
+        /* window-sized color or depth/stencil buffer */
+        w = drmRandom(rand) % (sizeof(windows) / sizeof(windows[0]));
+        d->npix_x = windows[w][0];
+        d->npix_y = windows[w][1];
+        d->nsamples = 1 << (drmRandom(rand) % 3);
+        d->flags = RADEON_SURF_SET(RADEON_SURF_TYPE_2D, TYPE) |
+                   RADEON_SURF_SET(RADEON_SURF_MODE_2D, MODE);
+        if (r < 15) {
+            d->bpe = 4;
+            d->flags |= RADEON_SURF_SCANOUT;
+        } else {
+            d->bpe = 4;
+            d->flags |= RADEON_SURF_ZBUFFER | RADEON_SURF_SBUFFER;
+        }
+    }
+}
+
+static void fill_surface(const struct desc *d, struct radeon_surface *surf)
+{
+    memset(surf, 0, sizeof(*surf));
+    surf->npix_x = d->npix_x;
+    surf->npix_y = d->npix_y;
+    surf->npix_z = d->npix_z;
+    surf->blk_w = 1;
+    surf->blk_h = 1;
+    surf->blk_d = 1;
+    surf->array_size = d->array_size;
+    surf->last_level = d->last_level;
+    surf->bpe = d->bpe;
+    surf->nsamples = d->nsamples;
+    /* what mesa passes on SI, the other families ignore it */
+    surf->flags = d->flags | RADEON_SURF_HAS_TILE_MODE_INDEX;
+}
+
+static double get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int allocate(struct radeon_surface_manager *surf_man,
+                    const struct desc *d, struct radeon_surface *surf)
+{
+    int r;
+
+    fill_surface(d, surf);
+    r = radeon_surface_best(surf_man, surf);
+    if (r)
+        return r;
+    return radeon_surface_init(surf_man, surf);
+}
+
+static double run(struct radeon_surface_manager *surf_man,
+                  const struct desc *descs, const unsigned *trace,
+                  int allocations)
+{
+    struct radeon_surface surf;
+    double start;
+    int i;
+
+    start = get_time();
+    for (i = 0; i < allocations; i++)
+        allocate(surf_man, &descs[trace[i]], &surf);
+    return get_time() - start;
+}
+
+/* Check that every allocation gets the layout it gets without the cache. */
+static void verify(struct radeon_surface_manager *surf_man,
+                   struct radeon_surface_manager *cached,
+                   const struct desc *descs, const unsigned *trace,
+                   int allocations)
+{
+    struct radeon_surface a, b;
+    int i, r;
+
+    for (i = 0; i < allocations; i++) {
+        r = allocate(surf_man, &descs[trace[i]], &a);
+        if (allocate(cached, &descs[trace[i]], &b) != r ||
+            memcmp(&a, &b, sizeof(a)))
+            errx(1, "allocation %d: cached layout differs", i);
+    }
+}
+
+static void bench(const char *name, const struct desc *descs,
+                  const unsigned *trace, int allocations, int entries)
+{
+    const struct radeon_surface_hw_desc *hw = radeon_surface_hw_preset(name);
+    struct radeon_surface_manager *surf_man, *cached;
+    struct radeon_surface_cache_stats stats;
+    double t_uncached, t_cached;
+
+    surf_man = radeon_surface_manager_new_from_desc(hw);
+    cached = radeon_surface_manager_new_from_desc(hw);
+    if (surf_man == NULL || cached == NULL)
+        errx(1, "%s: failed to create the surface managers", name);
+    if (radeon_surface_manager_set_cache_size(cached, entries))
+        errx(1, "failed to enable the layout cache");
+
+    verify(surf_man, cached, descs, trace, allocations);
+    radeon_surface_manager_get_cache_stats(cached, &stats);
+
+    t_uncached = run(surf_man, descs, trace, allocations);
+    /* start the timed run from an empty cache too */
+    radeon_surface_manager_set_cache_size(cached, entries);
+    t_cached = run(cached, descs, trace, allocations);
+
+    printf("%-8s %llu hits, %llu misses, %llu evictions\n", name,
+           (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+           (unsigned long long)stats.evictions);
+    printf("%-8s uncached: %9.0f allocations/s, cached: %9.0f allocations/s\n",
+           name, allocations / t_uncached, allocations / t_cached);
+
+    radeon_surface_manager_free(cached);
+    radeon_surface_manager_free(surf_man);
+}
+
+int main(int argc, char **argv)
+{
+    struct desc *descs;
+    unsigned *trace;
+    const char *name;
+    int allocations = 100000, entries = 1024;
+    void *rand;
+    double x;
+    int i;
+
+    if (argc > 1)
+        allocations = atoi(argv[1]);
+    if (argc > 2)
+        entries = atoi(argv[2]);
+
+    descs = calloc(NUM_DESCS, sizeof(*descs));
+    trace = calloc(allocations, sizeof(*trace));
+    if (descs == NULL || trace == NULL)
+        errx(1, "out of memory");
+    rand = drmRandomCreate(1);
+    for (i = 0; i < NUM_DESCS; i++)
+        make_desc(rand, &descs[i]);
+    /* a few descriptors make up most of the allocations */
+    for (i = 0; i < allocations; i++) {
+        x = (double)drmRandom(rand) / 2147483647.0;
+        trace[i] = (unsigned)(x * x * x * NUM_DESCS) % NUM_DESCS;
+    }
+    drmRandomDestroy(rand);
+
+    printf("%d allocations, %d cache entries\n", allocations, entries);
+    for (i = 0; (name = radeon_surface_hw_preset_name(i)); i++)
+        bench(name, descs, trace, allocations, entries);
+
+    free(trace);
+    free(descs);
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright © 2013 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Lays out a fixed set of surfaces on each bundled hardware description and
+ * prints the results, for tests/radeon/surface-layout.sh to compare with the
+ * reference.  Along the way, checks that radeon_surface_init_array() and the
+ * layout cache come to the same layouts as one surface at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include "xf86drm.h"
+#include "radeon_surface.h"
+
+#define TYPE(t)		RADEON_SURF_SET(RADEON_SURF_TYPE_##t, TYPE)
+#define MODE(m)		RADEON_SURF_SET(RADEON_SURF_MODE_##m, MODE)
+#define ZS		(RADEON_SURF_ZBUFFER | RADEON_SURF_SBUFFER)
+
+static const struct {
+    uint32_t npix_x, npix_y, npix_z;
+    uint32_t array_size, last_level, bpe, nsamples, flags;
+} descs[] = {
+    /* mipmapped textures */
+    { 256, 256, 1, 1, 8, 4, 1, TYPE(2D) | MODE(2D) },
+    { 1024, 1024, 1, 1, 10, 4, 1, TYPE(2D) | MODE(2D) },
+    { 64, 64, 1, 1, 6, 8, 1, TYPE(2D) | MODE(2D) },
+    { 2048, 2048, 1, 1, 3, 16, 1, TYPE(2D) | MODE(2D) },
+    { 512, 128, 1, 1, 9, 2, 1, TYPE(2D) | MODE(2D) },
+    { 100, 70, 1, 1, 0, 1, 1, TYPE(2D) | MODE(1D) },
+    { 640, 480, 1, 1, 0, 2, 1, TYPE(2D) | MODE(LINEAR_ALIGNED) },
+    { 1024, 1, 1, 1, 0, 4, 1, TYPE(1D) | MODE(LINEAR_ALIGNED) },
+    { 128, 128, 1, 6, 7, 4, 1, TYPE(CUBEMAP) | MODE(2D) },
+    { 32, 32, 32, 1, 5, 4, 1, TYPE(3D) | MODE(1D) },
+    { 256, 256, 1, 8, 0, 4, 1, TYPE(2D_ARRAY) | MODE(2D) },
+    /* window system buffers */
+    { 1920, 1080, 1, 1, 0, 4, 1, TYPE(2D) | MODE(2D) | RADEON_SURF_SCANOUT },
+    { 1366, 768, 1, 1, 0, 2, 1, TYPE(2D) | MODE(2D) | RADEON_SURF_SCANOUT },
+    { 1920, 1080, 1, 1, 0, 4, 1, TYPE(2D) | MODE(2D) | ZS },
+    { 1024, 768, 1, 1, 0, 2, 1, TYPE(2D) | MODE(2D) | RADEON_SURF_ZBUFFER },
+    { 1280, 720, 1, 1, 0, 4, 4, TYPE(2D) | MODE(2D) },
+    { 1280, 720, 1, 1, 0, 4, 4, TYPE(2D) | MODE(2D) | ZS },
+    /* invalid */
+    { 0, 16, 1, 1, 0, 4, 1, TYPE(2D) | MODE(2D) },
+    { 20000, 16, 1, 1, 0, 4, 1, TYPE(2D) | MODE(2D) },
+};
+
+#define NUM_DESCS	(sizeof(descs) / sizeof(descs[0]))
+
+static void fill(unsigned i, struct radeon_surface *surf)
+{
+    memset(surf, 0, sizeof(*surf));
+    surf->npix_x = descs[i].npix_x;
+    surf->npix_y = descs[i].npix_y;
+    surf->npix_z = descs[i].npix_z;
+    surf->blk_w = 1;
+    surf->blk_h = 1;
+    surf->blk_d = 1;
+    surf->array_size = descs[i].array_size;
+    surf->last_level = descs[i].last_level;
+    surf->bpe = descs[i].bpe;
+    surf->nsamples = descs[i].nsamples;
+    surf->flags = descs[i].flags | RADEON_SURF_HAS_TILE_MODE_INDEX;
+}
+
+static int layout(struct radeon_surface_manager *surf_man,
+                  struct radeon_surface *surf)
+{
+    int r;
+
+    r = radeon_surface_best(surf_man, surf);
+    if (r)
+        return r;
+    return radeon_surface_init(surf_man, surf);
+}
+
+static void print(const char *name, const struct radeon_surface *surf, int r)
+{
+    unsigned i;
+
+    printf("%s %ux%ux%u[%u] bpe %u x%u flags 0x%x: ", name,
+           surf->npix_x, surf->npix_y, surf->npix_z, surf->array_size,
+           surf->bpe, surf->nsamples, surf->flags);
+    if (r) {
+        printf("error %d\n", r);
+        return;
+    }
+    printf("size %llu align %llu", (unsigned long long)surf->bo_size,
+           (unsigned long long)surf->bo_alignment);
+    if (surf->flags & RADEON_SURF_SBUFFER)
+        printf(" stencil %llu", (unsigned long long)surf->stencil_offset);
+    for (i = 0; i <= surf->last_level; i++)
+        printf(" %llu/%u/%u", (unsigned long long)surf->level[i].offset,
+               surf->level[i].pitch_bytes, surf->level[i].mode);
+    printf("\n");
+}
+
+static void check(const char *name)
+{
+    const struct radeon_surface_hw_desc *hw = radeon_surface_hw_preset(name);
+    struct radeon_surface_manager *surf_man, *cached;
+    struct radeon_surface_cache_stats stats;
+    struct radeon_surface surfs[NUM_DESCS], surf;
+    int results[NUM_DESCS], first_error = 0, r, pass;
+    unsigned i, valid = 0;
+
+    surf_man = radeon_surface_manager_new_from_desc(hw);
+    cached = radeon_surface_manager_new_from_desc(hw);
+    if (surf_man == NULL || cached == NULL)
+        errx(1, "%s: failed to create the surface managers", name);
+    if (radeon_surface_manager_set_cache_size(cached, 8))
+        errx(1, "failed to enable the layout cache");
+
+    for (i = 0; i < NUM_DESCS; i++)
+        fill(i, &surfs[i]);
+    r = radeon_surface_init_array(surf_man, surfs, NUM_DESCS, results);
+
+    for (i = 0; i < NUM_DESCS; i++) {
+        if (results[i] && first_error == 0)
+            first_error = results[i];
+        if (results[i] == 0)
+            valid++;
+
+        fill(i, &surf);
+        if (layout(surf_man, &surf) != results[i] ||
+            (results[i] == 0 && memcmp(&surf, &surfs[i], sizeof(surf))))
+            errx(1, "%s: surface %u differs from the array layout", name, i);
+
+        /* twice, for a cache miss and then a hit */
+        for (pass = 0; pass < 2; pass++) {
+            fill(i, &surf);
+            if (layout(cached, &surf) != results[i] ||
+                (results[i] == 0 && memcmp(&surf, &surfs[i], sizeof(surf))))
+                errx(1, "%s: surface %u differs with the cache", name, i);
+        }
+    }
+    if (r != first_error)
+        errx(1, "%s: array layout returned %d, expected %d", name, r,
+             first_error);
+    radeon_surface_manager_get_cache_stats(cached, &stats);
+    if (stats.hits != valid)
+        errx(1, "%s: %llu cache hits, expected %u", name,
+             (unsigned long long)stats.hits, valid);
+
+    for (i = 0; i < NUM_DESCS; i++)
+        print(name, &surfs[i], results[i]);
+
+    radeon_surface_manager_free(cached);
+    radeon_surface_manager_free(surf_man);
+}
+
+int main(int argc, char **argv)
+{
+    const char *name;
+    int i;
+
+    if (radeon_surface_hw_preset("none") ||
+        radeon_surface_manager_new_from_desc(NULL))
+        errx(1, "found a surface manager for no hardware");
+
+    for (i = 0; (name = radeon_surface_hw_preset_name(i)); i++)
+        check(name);
+
+    return 0;
+}
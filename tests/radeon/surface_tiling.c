@@ -0,0 +1,367 @@
+/*
+ * Copyright © 2013 Red Hat
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Copies every level and slice of a set of surfaces on each bundled
+ * hardware description to its tiled layout and back, with the fast and the
+ * per pixel reference routines.  Both have to write the same bytes, inside
+ * the buffer, and get the pixels back.  As both follow the same model, a few
+ * addresses are also checked against values worked out by hand.  Then
+ * reports the speed of each on a large texture:
+ *
+ *   surface_tiling [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+#include "xf86drm.h"
+#include "radeon_surface.h"
+
+#define TYPE(t)		RADEON_SURF_SET(RADEON_SURF_TYPE_##t, TYPE)
+#define MODE(m)		RADEON_SURF_SET(RADEON_SURF_MODE_##m, MODE)
+#define GUARD		4096
+
+static const struct {
+    uint32_t npix_x, npix_y, npix_z;
+    uint32_t array_size, last_level, bpe, flags;
+} descs[] = {
+    { 256, 256, 1, 1, 8, 1, TYPE(2D) | MODE(2D) },
+    { 256, 256, 1, 1, 8, 2, TYPE(2D) | MODE(2D) },
+    { 512, 512, 1, 1, 9, 4, TYPE(2D) | MODE(2D) },
+    { 256, 128, 1, 1, 8, 8, TYPE(2D) | MODE(2D) },
+    { 128, 256, 1, 1, 8, 16, TYPE(2D) | MODE(2D) },
+    { 300, 200, 1, 1, 0, 4, TYPE(2D) | MODE(2D) },
+    { 1366, 768, 1, 1, 0, 2, TYPE(2D) | MODE(2D) | RADEON_SURF_SCANOUT },
+    { 1920, 1080, 1, 1, 0, 4, TYPE(2D) | MODE(2D) | RADEON_SURF_SCANOUT },
+    { 1024, 768, 1, 1, 0, 4, TYPE(2D) | MODE(2D) | RADEON_SURF_ZBUFFER },
+    { 100, 70, 1, 1, 6, 1, TYPE(2D) | MODE(1D) },
+    { 77, 33, 1, 1, 6, 4, TYPE(2D) | MODE(1D) },
+    { 64, 64, 1, 1, 6, 8, TYPE(2D) | MODE(1D) | RADEON_SURF_SCANOUT },
+    { 40, 40, 1, 1, 0, 16, TYPE(2D) | MODE(1D) },
+    { 32, 32, 8, 1, 3, 4, TYPE(3D) | MODE(1D) },
+    { 128, 128, 1, 6, 7, 4, TYPE(CUBEMAP) | MODE(2D) },
+    { 256, 256, 1, 4, 0, 4, TYPE(2D_ARRAY) | MODE(2D) },
+    { 640, 480, 1, 1, 0, 2, TYPE(2D) | MODE(LINEAR_ALIGNED) },
+};
+
+#define NUM_DESCS	(sizeof(descs) / sizeof(descs[0]))
+
+/*
+ * Where pixels of a 256x256 32bpp 2D texture end up, from the evergreen and
+ * SI pipe and bank equations.  palm has 2 pipes and 4 banks and gets bank
+ * width 1, bank height 2 and macro tile aspect 2; tahiti has the P8_32x32_8x16
+ * pipe configuration and 16 banks and gets 1, 1 and 2.
+ */
+static const struct {
+    const char *preset;
+    unsigned x, y;
+    uint32_t address;
+} addresses[] = {
+    { "palm", 0, 0, 0x0 },
+    { "palm", 1, 0, 0x4 },
+    { "palm", 0, 1, 0x8 },
+    { "palm", 8, 0, 0x100 },      /* pipe 1 */
+    { "palm", 0, 8, 0x900 },      /* pipe 1, second row of the bank */
+    { "palm", 32, 0, 0x1400 },    /* bank 2, second macro tile */
+    { "palm", 100, 37, 0xb6c8 },  /* bank 3, macro tile 11 */
+    { "tahiti", 8, 0, 0x200 },    /* pipe 2 */
+    { "tahiti", 16, 0, 0x100 },   /* pipe 1 */
+    { "tahiti", 0, 8, 0x4100 },   /* pipe 1, bank 8 */
+};
+
+#define NUM_ADDRESSES	(sizeof(addresses) / sizeof(addresses[0]))
+
+static void fill(unsigned i, struct radeon_surface *surf)
+{
+    memset(surf, 0, sizeof(*surf));
+    surf->npix_x = descs[i].npix_x;
+    surf->npix_y = descs[i].npix_y;
+    surf->npix_z = descs[i].npix_z;
+    surf->blk_w = 1;
+    surf->blk_h = 1;
+    surf->blk_d = 1;
+    surf->array_size = descs[i].array_size;
+    surf->last_level = descs[i].last_level;
+    surf->bpe = descs[i].bpe;
+    surf->nsamples = 1;
+    surf->flags = descs[i].flags | RADEON_SURF_HAS_TILE_MODE_INDEX;
+}
+
+static double get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check_guard(const uint8_t *p, const char *what)
+{
+    unsigned i;
+
+    for (i = 0; i < GUARD; i++) {
+        if (p[i] != 0xcd)
+            errx(1, "%s: write past the end of the buffer", what);
+    }
+}
+
+/* Round trips one level and slice, returns 0 if it can't be addressed. */
+static int round_trip(struct radeon_surface_manager *surf_man,
+                      const struct radeon_surface *surf, unsigned level,
+                      unsigned slice, uint8_t *fast, uint8_t *scalar,
+                      uint8_t *linear, uint8_t *back, const char *what)
+{
+    const struct radeon_surface_level *lvl = &surf->level[level];
+    unsigned pitch = lvl->npix_x * surf->bpe + 12;
+    size_t size = (size_t)pitch * lvl->npix_y;
+    size_t i;
+    int r;
+
+    for (i = 0; i < size; i++)
+        linear[i] = (i * 2654435761u) >> 13;
+
+    r = radeon_surface_copy_to_tiled(surf_man, surf, level, slice, fast,
+                                     linear, pitch, 0);
+    if (r == -ENOSYS)
+        return 0;
+    if (r)
+        errx(1, "%s: copy failed: %d", what, r);
+    radeon_surface_copy_to_tiled(surf_man, surf, level, slice, scalar,
+                                 linear, pitch, RADEON_SURF_COPY_SCALAR);
+    if (memcmp(fast, scalar, surf->bo_size + GUARD))
+        errx(1, "%s: tiled copies differ", what);
+    check_guard(fast + surf->bo_size, what);
+
+    memcpy(back, linear, size);
+    radeon_surface_copy_from_tiled(surf_man, surf, level, slice, back, pitch,
+                                   fast, 0);
+    if (memcmp(back, linear, size))
+        errx(1, "%s: round trip differs", what);
+    memset(back, 0, size);
+    radeon_surface_copy_from_tiled(surf_man, surf, level, slice, back, pitch,
+                                   fast, RADEON_SURF_COPY_SCALAR);
+    for (i = 0; i < size; i++) {
+        /* the padding at the end of each row isn't copied */
+        if (i % pitch < pitch - 12 && back[i] != linear[i])
+            errx(1, "%s: reference round trip differs", what);
+    }
+    return 1;
+}
+
+static void check(const char *name)
+{
+    struct radeon_surface_manager *surf_man;
+    struct radeon_surface surf;
+    uint8_t *fast, *scalar, *linear, *back;
+    unsigned i, level, slice, slices, copies = 0, skipped = 0;
+    char what[128];
+
+    surf_man = radeon_surface_manager_new_from_desc(radeon_surface_hw_preset(name));
+    if (surf_man == NULL)
+        errx(1, "%s: failed to create the surface manager", name);
+
+    for (i = 0; i < NUM_DESCS; i++) {
+        fill(i, &surf);
+        if (radeon_surface_best(surf_man, &surf) ||
+            radeon_surface_init(surf_man, &surf))
+            errx(1, "%s: surface %u: layout failed", name, i);
+
+        fast = malloc(surf.bo_size + GUARD);
+        scalar = malloc(surf.bo_size + GUARD);
+        linear = malloc(surf.level[0].npix_x * (size_t)surf.bpe *
+                        surf.level[0].npix_y + 12 * surf.level[0].npix_y);
+        back = malloc(surf.level[0].npix_x * (size_t)surf.bpe *
+                      surf.level[0].npix_y + 12 * surf.level[0].npix_y);
+        if (!fast || !scalar || !linear || !back)
+            errx(1, "out of memory");
+        memset(fast, 0xcd, surf.bo_size + GUARD);
+        memset(scalar, 0xcd, surf.bo_size + GUARD);
+
+        for (level = 0; level <= surf.last_level; level++) {
+            slices = surf.level[level].nblk_z * surf.array_size;
+            for (slice = 0; slice < slices; slice++) {
+                snprintf(what, sizeof(what), "%s: surface %u level %u slice %u",
+                         name, i, level, slice);
+                if (round_trip(surf_man, &surf, level, slice, fast, scalar,
+                               linear, back, what))
+                    copies++;
+                else
+                    skipped++;
+            }
+        }
+
+        free(back);
+        free(linear);
+        free(scalar);
+        free(fast);
+    }
+    printf("%-8s %u levels and slices round tripped, %u not addressable\n",
+           name, copies, skipped);
+
+    radeon_surface_manager_free(surf_man);
+}
+
+static void check_addresses(void)
+{
+    struct radeon_surface_manager *surf_man;
+    struct radeon_surface surf;
+    uint32_t *tiled, *linear, pixel;
+    unsigned i, flags;
+
+    linear = malloc(256 * 256 * 4);
+    if (!linear)
+        errx(1, "out of memory");
+    for (i = 0; i < 256 * 256; i++)
+        linear[i] = i;
+
+    for (i = 0; i < NUM_ADDRESSES; i++) {
+        surf_man = radeon_surface_manager_new_from_desc(
+            radeon_surface_hw_preset(addresses[i].preset));
+        if (surf_man == NULL)
+            errx(1, "%s: failed to create the surface manager",
+                 addresses[i].preset);
+
+        memset(&surf, 0, sizeof(surf));
+        surf.npix_x = surf.npix_y = 256;
+        surf.npix_z = surf.array_size = 1;
+        surf.blk_w = surf.blk_h = surf.blk_d = 1;
+        surf.bpe = 4;
+        surf.nsamples = 1;
+        surf.flags = TYPE(2D) | MODE(2D) | RADEON_SURF_HAS_TILE_MODE_INDEX;
+        if (radeon_surface_best(surf_man, &surf) ||
+            radeon_surface_init(surf_man, &surf) ||
+            surf.level[0].mode != RADEON_SURF_MODE_2D)
+            errx(1, "%s: layout failed", addresses[i].preset);
+
+        tiled = calloc(1, surf.bo_size);
+        if (!tiled)
+            errx(1, "out of memory");
+        for (flags = 0; flags <= RADEON_SURF_COPY_SCALAR; flags++) {
+            if (radeon_surface_copy_to_tiled(surf_man, &surf, 0, 0, tiled,
+                                             linear, 256 * 4, flags))
+                errx(1, "%s: copy failed", addresses[i].preset);
+            pixel = tiled[addresses[i].address / 4];
+            if (pixel != addresses[i].y * 256 + addresses[i].x)
+                errx(1, "%s: pixel %u,%u at 0x%x is %u,%u", addresses[i].preset,
+                     addresses[i].x, addresses[i].y, addresses[i].address,
+                     pixel % 256, pixel / 256);
+        }
+
+        free(tiled);
+        radeon_surface_manager_free(surf_man);
+    }
+    free(linear);
+}
+
+static int layout_2048(struct radeon_surface_manager *surf_man,
+                       struct radeon_surface *surf, unsigned mode)
+{
+    memset(surf, 0, sizeof(*surf));
+    surf->npix_x = surf->npix_y = 2048;
+    surf->npix_z = surf->array_size = 1;
+    surf->blk_w = surf->blk_h = surf->blk_d = 1;
+    surf->bpe = 4;
+    surf->nsamples = 1;
+    surf->flags = TYPE(2D) | RADEON_SURF_SET(mode, MODE) |
+                  RADEON_SURF_HAS_TILE_MODE_INDEX;
+    if (radeon_surface_best(surf_man, surf))
+        return -1;
+    return radeon_surface_init(surf_man, surf);
+}
+
+static void bench(const char *name, unsigned megabytes)
+{
+    struct radeon_surface_manager *surf_man;
+    struct radeon_surface surf;
+    uint8_t *tiled, *linear;
+    double t_scalar, t_fast, start, bytes;
+    unsigned pitch, n, i;
+
+    surf_man = radeon_surface_manager_new_from_desc(radeon_surface_hw_preset(name));
+    if (surf_man == NULL)
+        errx(1, "%s: failed to create the surface manager", name);
+    if (layout_2048(surf_man, &surf, RADEON_SURF_MODE_2D))
+        errx(1, "%s: layout failed", name);
+
+    pitch = surf.npix_x * surf.bpe;
+    tiled = malloc(surf.bo_size);
+    linear = malloc((size_t)pitch * surf.npix_y);
+    if (!tiled || !linear)
+        errx(1, "out of memory");
+    memset(linear, 0x5a, (size_t)pitch * surf.npix_y);
+    bytes = (double)pitch * surf.npix_y;
+    n = megabytes * 1024.0 * 1024.0 / bytes;
+    if (n == 0)
+        n = 1;
+
+    /* r6xx 2D tiles can't be addressed, use 1D */
+    if (radeon_surface_copy_to_tiled(surf_man, &surf, 0, 0, tiled, linear,
+                                     pitch, 0) == -ENOSYS &&
+        layout_2048(surf_man, &surf, RADEON_SURF_MODE_1D))
+        errx(1, "%s: layout failed", name);
+
+    /* the reference is slow, once is enough */
+    start = get_time();
+    radeon_surface_copy_to_tiled(surf_man, &surf, 0, 0, tiled, linear,
+                                 pitch, RADEON_SURF_COPY_SCALAR);
+    t_scalar = get_time() - start;
+
+    start = get_time();
+    for (i = 0; i < n; i++) {
+        radeon_surface_copy_to_tiled(surf_man, &surf, 0, 0, tiled, linear,
+                                     pitch, 0);
+        radeon_surface_copy_from_tiled(surf_man, &surf, 0, 0, linear, pitch,
+                                       tiled, 0);
+    }
+    t_fast = (get_time() - start) / 2;
+
+    printf("%-8s 2048x2048 32bpp %s: reference %.2f GB/s, fast %.2f GB/s\n",
+           name, surf.level[0].mode == RADEON_SURF_MODE_2D ? "2D" : "1D",
+           bytes / t_scalar / 1e9, n * bytes / t_fast / 1e9);
+
+    free(linear);
+    free(tiled);
+    radeon_surface_manager_free(surf_man);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned megabytes = 256;
+    const char *name;
+    int i;
+
+    if (argc > 1)
+        megabytes = atoi(argv[1]);
+
+    for (i = 0; (name = radeon_surface_hw_preset_name(i)); i++)
+        check(name);
+    check_addresses();
+    for (i = 0; (name = radeon_surface_hw_preset_name(i)); i++)
+        bench(name, megabytes);
+
+    return 0;
+}
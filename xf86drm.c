@@ -44,13 +44,18 @@
 #include <errno.h>
 #include <signal.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
 #define stat_t struct stat
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 /* Not all systems have MAP_FAILED defined */
 #ifndef MAP_FAILED
@@ -85,9 +90,6 @@
 
 #define DRM_MSG_VERBOSITY 3
 
-#define DRM_NODE_CONTROL 0
-#define DRM_NODE_RENDER 1
-
 static drmServerInfoPtr drm_server_info;
 
 void drmSetServerInfo(drmServerInfoPtr info)
@@ -169,12 +171,223 @@ drmIoctl(int fd, unsigned long request, void *arg)
     return ret;
 }
 
+#define DRM_FD_INFO_MAX_CAPS 32
+
+typedef struct _drmParamCache {
+    int count;
+    int size;
+    struct {
+	unsigned int domain;
+	uint64_t     param;
+	uint64_t     value;
+	int          ret;
+    } entries[];
+} drmParamCache;
+
+/* The query caches are kept behind the public part of the information. */
+typedef struct _drmFdInfoPriv {
+    drmFdInfo     info;
+    uint32_t      caps_valid;       /* Bit n set if caps[n] is cached */
+    uint32_t      caps_failed;      /* Bit n set if cap n is unsupported */
+    uint64_t      caps[DRM_FD_INFO_MAX_CAPS];
+    drmParamCache *params;
+} drmFdInfoPriv;
+
+/* Per-fd device information, protected by drmFdInfoLock */
+static void *drmFdInfoTable = NULL;
+/* Also protects the device list, drm_devices and drm_num_devices */
+static pthread_mutex_t drmFdInfoLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void drmFdInfoDestroy(drmFdInfoPriv *priv)
+{
+    free(priv->params);
+    drmFree(priv);
+}
+
+/* Must be called with drmFdInfoLock held. */
+static drmFdInfoPriv *drmLookupFdInfo(int fd)
+{
+    void *value;
+
+    if (!drmFdInfoTable || drmHashLookup(drmFdInfoTable, fd, &value))
+	return NULL;
+    return value;
+}
+
+#ifdef __linux__
+static int drmReadSysfsHex(const char *path, unsigned int *value)
+{
+    FILE *f;
+    int  ret;
+
+    if (!(f = fopen(path, "r")))
+	return -errno;
+    ret = fscanf(f, "%x", value);
+    fclose(f);
+    return ret == 1 ? 0 : -EINVAL;
+}
+#endif
+
+static drmFdInfoPriv *drmCreateFdInfo(int fd, const stat_t *st)
+{
+    drmFdInfoPriv *priv;
+    drmFdInfo     *info;
+    drmVersionPtr version;
+#ifdef __linux__
+    char          path[128];
+    unsigned int  id;
+#endif
+
+    priv = drmMalloc(sizeof(*priv));
+    if (!priv)
+	return NULL;
+    info       = &priv->info;
+    info->fd   = fd;
+    info->rdev = st->st_rdev;
+
+#ifdef __linux__
+    if (minor(st->st_rdev) >= 128)
+	info->node_type = DRM_NODE_RENDER;
+    else if (minor(st->st_rdev) >= 64)
+	info->node_type = DRM_NODE_CONTROL;
+    else
+	info->node_type = DRM_NODE_PRIMARY;
+
+    snprintf(path, sizeof(path), "/sys/dev/char/%d:%d/device/vendor",
+	     major(st->st_rdev), minor(st->st_rdev));
+    if (drmReadSysfsHex(path, &id) == 0)
+	info->pci_vendor_id = id;
+    snprintf(path, sizeof(path), "/sys/dev/char/%d:%d/device/device",
+	     major(st->st_rdev), minor(st->st_rdev));
+    if (drmReadSysfsHex(path, &id) == 0)
+	info->pci_device_id = id;
+#endif
+
+    if ((version = drmGetVersion(fd))) {
+	strncpy(info->driver, version->name, sizeof(info->driver) - 1);
+	info->version_major      = version->version_major;
+	info->version_minor      = version->version_minor;
+	info->version_patchlevel = version->version_patchlevel;
+	drmFreeVersion(version);
+    }
+
+    return priv;
+}
+
+/**
+ * Get the cached device information for a file descriptor.
+ *
+ * \param fd file descriptor.
+ *
+ * \return the device information, or NULL if \p fd isn't a device node or
+ * on allocation failure.
+ *
+ * \internal
+ * The information is gathered on the first call for \p fd and kept until
+ * drmClose() or drmFreeFdInfo(); the returned pointer is valid until then.
+ * Once it exists, drmGetCap(), drmGetCaps() and drmGetParams() cache their
+ * results in it, and drmGetEntry() takes the device number from it, so that
+ * none of them needs a syscall for \p fd any more.  The information is keyed
+ * by the descriptor number alone and isn't checked against the device again:
+ * callers that close \p fd with close(2) rather than drmClose() must call
+ * drmFreeFdInfo() first, or a reused descriptor number would get the
+ * information of the closed device.
+ */
+const drmFdInfo *drmGetFdInfo(int fd)
+{
+    drmFdInfoPriv *priv, *other;
+    stat_t        st;
+
+    pthread_mutex_lock(&drmFdInfoLock);
+    priv = drmLookupFdInfo(fd);
+    pthread_mutex_unlock(&drmFdInfoLock);
+    if (priv)
+	return &priv->info;
+
+    if (fstat(fd, &st) || !S_ISCHR(st.st_mode))
+	return NULL;
+
+    /* Gather the information without the lock, it needs several syscalls. */
+    if (!(priv = drmCreateFdInfo(fd, &st)))
+	return NULL;
+
+    pthread_mutex_lock(&drmFdInfoLock);
+    if (!drmFdInfoTable)
+	drmFdInfoTable = drmHashCreate();
+    if (!drmFdInfoTable) {
+	pthread_mutex_unlock(&drmFdInfoLock);
+	drmFdInfoDestroy(priv);
+	return NULL;
+    }
+    if ((other = drmLookupFdInfo(fd))) {
+	/* Another thread was first. */
+	drmFdInfoDestroy(priv);
+	priv = other;
+    } else if (drmHashInsert(drmFdInfoTable, fd, priv)) {
+	drmFdInfoDestroy(priv);
+	priv = NULL;
+    }
+    pthread_mutex_unlock(&drmFdInfoLock);
+
+    return priv ? &priv->info : NULL;
+}
+
+/**
+ * Get the device information for a file descriptor if it's cached already.
+ *
+ * \param fd file descriptor.
+ *
+ * \return the device information, or NULL if nobody called drmGetFdInfo()
+ * for \p fd yet.
+ *
+ * \internal
+ * Unlike drmGetFdInfo() this never gathers the information, so it costs no
+ * syscalls; for libraries that would otherwise do a single query themselves.
+ */
+const drmFdInfo *drmGetCachedFdInfo(int fd)
+{
+    drmFdInfoPriv *priv;
+
+    pthread_mutex_lock(&drmFdInfoLock);
+    priv = drmLookupFdInfo(fd);
+    pthread_mutex_unlock(&drmFdInfoLock);
+
+    return priv ? &priv->info : NULL;
+}
+
+/**
+ * Drop the cached device information for a file descriptor.
+ *
+ * \param fd file descriptor.
+ *
+ * \internal
+ * Invalidates the pointer returned by drmGetFdInfo() for \p fd, so this is
+ * only for whoever owns \p fd, right before closing it.
+ */
+void drmFreeFdInfo(int fd)
+{
+    drmFdInfoPriv *priv;
+
+    pthread_mutex_lock(&drmFdInfoLock);
+    if ((priv = drmLookupFdInfo(fd))) {
+	drmHashDelete(drmFdInfoTable, fd);
+	drmFdInfoDestroy(priv);
+    }
+    pthread_mutex_unlock(&drmFdInfoLock);
+}
+
 static unsigned long drmGetKeyFromFd(int fd)
 {
+    drmFdInfoPriv *priv;
     stat_t     st;
 
     st.st_rdev = 0;
-    fstat(fd, &st);
+    pthread_mutex_lock(&drmFdInfoLock);
+    if ((priv = drmLookupFdInfo(fd)))
+	st.st_rdev = priv->info.rdev;
+    pthread_mutex_unlock(&drmFdInfoLock);
+    if (!priv)
+	fstat(fd, &st);
     return st.st_rdev;
 }
 
@@ -308,7 +521,8 @@ static int drmOpenDevice(long dev, int minor, int type)
     uid_t           user    = DRM_DEV_UID;
     gid_t           group   = DRM_DEV_GID, serv_group;
     
-    sprintf(buf, type ? DRM_DEV_NAME : DRM_CONTROL_DEV_NAME, DRM_DIR_NAME, minor);
+    sprintf(buf, type == DRM_NODE_CONTROL ? DRM_CONTROL_DEV_NAME : DRM_DEV_NAME,
+	    DRM_DIR_NAME, minor);
     drmMsg("drmOpenDevice: node name is %s\n", buf);
 
     if (drm_server_info) {
@@ -417,7 +631,8 @@ static int drmOpenMinor(int minor, int create, int type)
     if (create)
 	return drmOpenDevice(makedev(DRM_MAJOR, minor), minor, type);
     
-    sprintf(buf, type ? DRM_DEV_NAME : DRM_CONTROL_DEV_NAME, DRM_DIR_NAME, minor);
+    sprintf(buf, type == DRM_NODE_CONTROL ? DRM_CONTROL_DEV_NAME : DRM_DEV_NAME,
+	    DRM_DIR_NAME, minor);
     if ((fd = open(buf, O_RDWR, 0)) >= 0)
 	return fd;
     return -errno;
@@ -440,7 +655,7 @@ int drmAvailable(void)
     int           retval = 0;
     int           fd;
 
-    if ((fd = drmOpenMinor(0, 1, DRM_NODE_RENDER)) < 0) {
+    if ((fd = drmOpenMinor(0, 1, DRM_NODE_PRIMARY)) < 0) {
 #ifdef __linux__
 	/* Try proc for backward Linux compatibility */
 	if (!access("/proc/dri/0", R_OK))
@@ -459,6 +674,229 @@ int drmAvailable(void)
 }
 
 
+/* The device list from sysfs, protected by drmFdInfoLock */
+static drmDeviceInfo *drm_devices;
+static int drm_num_devices = -1;
+
+#ifdef __linux__
+/**
+ * Read the last path component of a sysfs symlink.
+ *
+ * \return zero on success, or a negative value on error.
+ */
+static int drmReadSysfsLink(const char *path, char *buf, int size)
+{
+    char link[256], *base;
+    ssize_t len;
+
+    len = readlink(path, link, sizeof(link) - 1);
+    if (len < 0)
+	return -errno;
+    link[len] = '\0';
+
+    base = strrchr(link, '/');
+    base = base ? base + 1 : link;
+    if ((int)strlen(base) >= size)
+	return -ENAMETOOLONG;
+    strcpy(buf, base);
+    return 0;
+}
+
+/**
+ * Fill in \p info for the sysfs node \p name.
+ *
+ * \return zero on success, or a negative value if \p name is not a DRM
+ * device node (connectors also live in /sys/class/drm).
+ */
+static int drmParseSysfsNode(const char *name, drmDeviceInfo *info)
+{
+    char path[256], subsystem[16], slot[32];
+    char trailing;
+
+    memset(info, 0, sizeof(*info));
+    if (sscanf(name, "card%d%c", &info->minor, &trailing) == 1)
+	info->node_type = DRM_NODE_PRIMARY;
+    else if (sscanf(name, "controlD%d%c", &info->minor, &trailing) == 1)
+	info->node_type = DRM_NODE_CONTROL;
+    else if (sscanf(name, "renderD%d%c", &info->minor, &trailing) == 1)
+	info->node_type = DRM_NODE_RENDER;
+    else
+	return -EINVAL;
+
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/device/driver", name);
+    if (drmReadSysfsLink(path, info->driver, sizeof(info->driver)))
+	info->driver[0] = '\0';
+
+    snprintf(path, sizeof(path), "/sys/class/drm/%s/device/subsystem", name);
+    if (drmReadSysfsLink(path, subsystem, sizeof(subsystem)) == 0 &&
+	strcmp(subsystem, "pci") == 0) {
+	snprintf(path, sizeof(path), "/sys/class/drm/%s/device", name);
+	if (drmReadSysfsLink(path, slot, sizeof(slot)) == 0)
+	    snprintf(info->busid, sizeof(info->busid), "pci:%s", slot);
+    }
+
+    return 0;
+}
+
+static int drmCompareDeviceInfo(const void *a, const void *b)
+{
+    const drmDeviceInfo *da = a, *db = b;
+
+    if (da->node_type != db->node_type)
+	return da->node_type - db->node_type;
+    return da->minor - db->minor;
+}
+#endif
+
+/* Build the device list if needed. Must be called with drmFdInfoLock held. */
+static int drmScanDeviceList(void)
+{
+#ifdef __linux__
+    DIR           *sysdir;
+    struct dirent *dent;
+    drmDeviceInfo info, *list = NULL, *tmp;
+    int           count = 0, size = 0;
+
+    if (drm_num_devices >= 0)
+	return drm_num_devices;
+
+    sysdir = opendir("/sys/class/drm");
+    if (!sysdir)
+	return -errno;
+
+    while ((dent = readdir(sysdir))) {
+	if (drmParseSysfsNode(dent->d_name, &info))
+	    continue;
+
+	if (count == size) {
+	    size = size ? size * 2 : 8;
+	    tmp = realloc(list, size * sizeof(*list));
+	    if (!tmp) {
+		free(list);
+		closedir(sysdir);
+		return -ENOMEM;
+	    }
+	    list = tmp;
+	}
+	list[count++] = info;
+    }
+    closedir(sysdir);
+
+    qsort(list, count, sizeof(*list), drmCompareDeviceInfo);
+
+    drm_devices = list;
+    drm_num_devices = count;
+    return drm_num_devices;
+#else
+    return -ENOSYS;
+#endif
+}
+
+/**
+ * Enumerate the DRM device nodes present in the system.
+ *
+ * \param devices will point to the device list, sorted by node type and
+ * minor. The list is owned by the library and stays valid until the next
+ * drmRescanDeviceList() call.
+ *
+ * \return the number of devices, or a negative value on error.
+ *
+ * \internal
+ * The list is built once per process from /sys/class/drm, without opening
+ * any device node, and cached for subsequent calls.
+ */
+int drmGetDeviceList(const drmDeviceInfo **devices)
+{
+    int count;
+
+    pthread_mutex_lock(&drmFdInfoLock);
+    count = drmScanDeviceList();
+    if (count >= 0)
+	*devices = drm_devices;
+    pthread_mutex_unlock(&drmFdInfoLock);
+    return count;
+}
+
+/*
+ * Copy the device list for use inside the library, where another thread
+ * may call drmRescanDeviceList() meanwhile. Free the copy with free().
+ */
+static int drmCopyDeviceList(drmDeviceInfo **devices)
+{
+    int count;
+
+    *devices = NULL;
+    pthread_mutex_lock(&drmFdInfoLock);
+    count = drmScanDeviceList();
+    if (count > 0) {
+	*devices = malloc(count * sizeof(**devices));
+	if (*devices)
+	    memcpy(*devices, drm_devices, count * sizeof(**devices));
+	else
+	    count = -ENOMEM;
+    }
+    pthread_mutex_unlock(&drmFdInfoLock);
+    return count;
+}
+
+/**
+ * Drop the cached device list, so that the next drmGetDeviceList() call
+ * picks up hotplugged devices.
+ */
+void drmRescanDeviceList(void)
+{
+    pthread_mutex_lock(&drmFdInfoLock);
+    free(drm_devices);
+    drm_devices = NULL;
+    drm_num_devices = -1;
+    pthread_mutex_unlock(&drmFdInfoLock);
+}
+
+/**
+ * Check whether an open device has the given bus ID.
+ *
+ * \param fd file descriptor.
+ * \param busid bus ID.
+ *
+ * \return 1 if matched.
+ *
+ * \internal
+ * Negotiates the interface version first, since the kernel only reports the
+ * PCI domain in the bus ID for interface 1.4 and later.
+ */
+static int drmCheckBusid(int fd, const char *busid)
+{
+    int        pci_domain_ok = 1;
+    int        ret;
+    const char *buf;
+    drmSetVersion sv;
+
+    /* We need to try for 1.4 first for proper PCI domain support
+     * and if that fails, we know the kernel is busted
+     */
+    sv.drm_di_major = 1;
+    sv.drm_di_minor = 4;
+    sv.drm_dd_major = -1;	/* Don't care */
+    sv.drm_dd_minor = -1;	/* Don't care */
+    if (drmSetInterfaceVersion(fd, &sv)) {
+#ifndef __alpha__
+	pci_domain_ok = 0;
+#endif
+	sv.drm_di_major = 1;
+	sv.drm_di_minor = 1;
+	sv.drm_dd_major = -1;       /* Don't care */
+	sv.drm_dd_minor = -1;       /* Don't care */
+	drmMsg("drmOpenByBusid: Interface 1.4 failed, trying 1.1\n",fd);
+	drmSetInterfaceVersion(fd, &sv);
+    }
+    buf = drmGetBusid(fd);
+    drmMsg("drmOpenByBusid: drmGetBusid reports %s\n", buf);
+    ret = buf && drmMatchBusID(buf, busid, pci_domain_ok);
+    if (buf)
+	drmFreeBusid(buf);
+    return ret;
+}
+
 /**
  * Open the device by bus ID.
  *
@@ -467,49 +905,47 @@ int drmAvailable(void)
  * \return a file descriptor on success, or a negative value on error.
  *
  * \internal
- * This function attempts to open every possible minor (up to DRM_MAX_MINOR),
- * comparing the device bus ID with the one supplied.
+ * This function first looks the bus ID up in the sysfs device list and only
+ * opens the matching minor. If that doesn't turn up the device, which may
+ * also have appeared since the list was built, it attempts to open every
+ * possible minor (up to DRM_MAX_MINOR), comparing the device bus ID with the
+ * one supplied.
  *
- * \sa drmOpenMinor() and drmGetBusid().
+ * \sa drmGetDeviceList(), drmOpenMinor() and drmGetBusid().
  */
 static int drmOpenByBusid(const char *busid)
 {
-    int        i, pci_domain_ok = 1;
+    drmDeviceInfo *devices;
+    int        i, count;
     int        fd;
-    const char *buf;
-    drmSetVersion sv;
 
     drmMsg("drmOpenByBusid: Searching for BusID %s\n", busid);
-    for (i = 0; i < DRM_MAX_MINOR; i++) {
-	fd = drmOpenMinor(i, 1, DRM_NODE_RENDER);
+
+    count = drmCopyDeviceList(&devices);
+    for (i = 0; i < count; i++) {
+	if (devices[i].node_type != DRM_NODE_PRIMARY ||
+	    !devices[i].busid[0] ||
+	    !drmMatchBusID(devices[i].busid, busid, 1))
+	    continue;
+
+	fd = drmOpenMinor(devices[i].minor, 1, DRM_NODE_PRIMARY);
 	drmMsg("drmOpenByBusid: drmOpenMinor returns %d\n", fd);
 	if (fd >= 0) {
-	    /* We need to try for 1.4 first for proper PCI domain support
-	     * and if that fails, we know the kernel is busted
-	     */
-	    sv.drm_di_major = 1;
-	    sv.drm_di_minor = 4;
-	    sv.drm_dd_major = -1;	/* Don't care */
-	    sv.drm_dd_minor = -1;	/* Don't care */
-	    if (drmSetInterfaceVersion(fd, &sv)) {
-#ifndef __alpha__
-		pci_domain_ok = 0;
-#endif
-		sv.drm_di_major = 1;
-		sv.drm_di_minor = 1;
-		sv.drm_dd_major = -1;       /* Don't care */
-		sv.drm_dd_minor = -1;       /* Don't care */
-		drmMsg("drmOpenByBusid: Interface 1.4 failed, trying 1.1\n",fd);
-		drmSetInterfaceVersion(fd, &sv);
-	    }
-	    buf = drmGetBusid(fd);
-	    drmMsg("drmOpenByBusid: drmGetBusid reports %s\n", buf);
-	    if (buf && drmMatchBusID(buf, busid, pci_domain_ok)) {
-		drmFreeBusid(buf);
+	    if (drmCheckBusid(fd, busid)) {
+		free(devices);
 		return fd;
 	    }
-	    if (buf)
-		drmFreeBusid(buf);
+	    close(fd);
+	}
+    }
+    free(devices);
+
+    for (i = 0; i < DRM_MAX_MINOR; i++) {
+	fd = drmOpenMinor(i, 1, DRM_NODE_PRIMARY);
+	drmMsg("drmOpenByBusid: drmOpenMinor returns %d\n", fd);
+	if (fd >= 0) {
+	    if (drmCheckBusid(fd, busid))
+		return fd;
 	    close(fd);
 	}
     }
@@ -517,6 +953,40 @@ static int drmOpenByBusid(const char *busid)
 }
 
 
+/**
+ * Open \p minor if it is driven by \p name and isn't already in use.
+ *
+ * \return a file descriptor on success, or a negative value on error.
+ */
+static int drmOpenMinorByName(int minor, const char *name)
+{
+    int           fd;
+    drmVersionPtr version;
+    char *        id;
+
+    if ((fd = drmOpenMinor(minor, 1, DRM_NODE_PRIMARY)) < 0)
+	return -1;
+
+    if ((version = drmGetVersion(fd))) {
+	if (!strcmp(version->name, name)) {
+	    drmFreeVersion(version);
+	    id = drmGetBusid(fd);
+	    drmMsg("drmGetBusid returned '%s'\n", id ? id : "NULL");
+	    if (!id || !*id) {
+		if (id)
+		    drmFreeBusid(id);
+		return fd;
+	    } else {
+		drmFreeBusid(id);
+	    }
+	} else {
+	    drmFreeVersion(version);
+	}
+    }
+    close(fd);
+    return -1;
+}
+
 /**
  * Open the device by name.
  *
@@ -529,14 +999,13 @@ static int drmOpenByBusid(const char *busid)
  * isn't already in use.  If it's in use it then it will already have a bus ID
  * assigned.
  * 
- * \sa drmOpenMinor(), drmGetVersion() and drmGetBusid().
+ * \sa drmGetDeviceList(), drmOpenMinor(), drmGetVersion() and drmGetBusid().
  */
 static int drmOpenByName(const char *name)
 {
-    int           i;
+    drmDeviceInfo *devices;
+    int           i, count;
     int           fd;
-    drmVersionPtr version;
-    char *        id;
     
     if (!drmAvailable()) {
 	if (!drm_server_info) {
@@ -554,28 +1023,26 @@ static int drmOpenByName(const char *name)
     /*
      * Open the first minor number that matches the driver name and isn't
      * already in use.  If it's in use it will have a busid assigned already.
+     *
+     * Try the minors that sysfs attributes to the driver first.  Kernel module
+     * names don't always match the DRM driver name, so fall back to probing
+     * every minor if that turns up nothing.
      */
-    for (i = 0; i < DRM_MAX_MINOR; i++) {
-	if ((fd = drmOpenMinor(i, 1, DRM_NODE_RENDER)) >= 0) {
-	    if ((version = drmGetVersion(fd))) {
-		if (!strcmp(version->name, name)) {
-		    drmFreeVersion(version);
-		    id = drmGetBusid(fd);
-		    drmMsg("drmGetBusid returned '%s'\n", id ? id : "NULL");
-		    if (!id || !*id) {
-			if (id)
-			    drmFreeBusid(id);
-			return fd;
-		    } else {
-			drmFreeBusid(id);
-		    }
-		} else {
-		    drmFreeVersion(version);
-		}
-	    }
-	    close(fd);
+    count = drmCopyDeviceList(&devices);
+    for (i = 0; i < count; i++) {
+	if (devices[i].node_type == DRM_NODE_PRIMARY &&
+	    !strcmp(devices[i].driver, name) &&
+	    (fd = drmOpenMinorByName(devices[i].minor, name)) >= 0) {
+	    free(devices);
+	    return fd;
 	}
     }
+    free(devices);
+
+    for (i = 0; i < DRM_MAX_MINOR; i++) {
+	if ((fd = drmOpenMinorByName(i, name)) >= 0)
+	    return fd;
+    }
 
 #ifdef __linux__
     /* Backward-compatibility /proc support */
@@ -600,7 +1067,7 @@ static int drmOpenByName(const char *name)
 			if (*pt) { /* Found busid */
 			    return drmOpenByBusid(++pt);
 			} else { /* No busid */
-			    return drmOpenDevice(strtol(devstring, NULL, 0),i, DRM_NODE_RENDER);
+			    return drmOpenDevice(strtol(devstring, NULL, 0),i, DRM_NODE_PRIMARY);
 			}
 		    }
 		}
@@ -810,12 +1277,60 @@ drmVersionPtr drmGetLibVersion(int fd)
     return (drmVersionPtr)version;
 }
 
+/**
+ * Get a driver capability.
+ *
+ * \param fd file descriptor.
+ * \param capability one of DRM_CAP_*.
+ * \param value will contain the capability value.
+ *
+ * \return zero on success, or a negative value on failure.
+ *
+ * \internal
+ * Capabilities don't change over the lifetime of a device, so if \p fd has
+ * cached device information (see drmGetFdInfo()) the result is kept there
+ * and later calls are answered without an ioctl.
+ */
 int drmGetCap(int fd, uint64_t capability, uint64_t *value)
 {
 	struct drm_get_cap cap = { capability, 0 };
+	drmFdInfoPriv *priv;
+	uint32_t bit = 0;
 	int ret;
 
+	if (capability < DRM_FD_INFO_MAX_CAPS)
+		bit = 1u << capability;
+
+	pthread_mutex_lock(&drmFdInfoLock);
+	priv = bit ? drmLookupFdInfo(fd) : NULL;
+	if (priv && (priv->caps_failed & bit)) {
+		pthread_mutex_unlock(&drmFdInfoLock);
+		errno = EINVAL;
+		return -1;
+	}
+	if (priv && (priv->caps_valid & bit)) {
+		*value = priv->caps[capability];
+		pthread_mutex_unlock(&drmFdInfoLock);
+		return 0;
+	}
+	pthread_mutex_unlock(&drmFdInfoLock);
+
 	ret = drmIoctl(fd, DRM_IOCTL_GET_CAP, &cap);
+	/* Only unknown capabilities are a property of the device. */
+	if (priv && (ret == 0 || errno == EINVAL)) {
+		pthread_mutex_lock(&drmFdInfoLock);
+		if (drmLookupFdInfo(fd) == priv) {
+			if (ret) {
+				priv->caps_failed |= bit;
+			} else {
+				priv->caps[capability] = cap.value;
+				priv->caps_valid |= bit;
+			}
+		}
+		pthread_mutex_unlock(&drmFdInfoLock);
+		if (ret)
+			errno = EINVAL;
+	}
 	if (ret)
 		return ret;
 
@@ -823,6 +1338,136 @@ int drmGetCap(int fd, uint64_t capability, uint64_t *value)
 	return 0;
 }
 
+/**
+ * Get several driver capabilities at once.
+ *
+ * \param fd file descriptor.
+ * \param caps capabilities to query; the value and ret fields are filled in.
+ * \param count number of entries in \p caps.
+ *
+ * \return the number of capabilities successfully queried.
+ *
+ * \internal
+ * If \p fd has cached device information (see drmGetFdInfo()), only
+ * capabilities that haven't been queried before on \p fd result in an ioctl.
+ */
+int drmGetCaps(int fd, drmParamPtr caps, int count)
+{
+	int i, n = 0;
+
+	for (i = 0; i < count; i++) {
+		caps[i].value = 0;
+		caps[i].ret = drmGetCap(fd, caps[i].param, &caps[i].value) ?
+			-errno : 0;
+		if (caps[i].ret == 0)
+			n++;
+	}
+	return n;
+}
+
+static void drmCacheParam(drmFdInfoPriv *priv, unsigned int domain,
+			  const drmParam *param)
+{
+	drmParamCache *cache = priv->params, *tmp;
+	int i, size;
+
+	/* Another thread may have cached it meanwhile. */
+	for (i = 0; cache && i < cache->count; i++) {
+		if (cache->entries[i].domain == domain &&
+		    cache->entries[i].param == param->param)
+			return;
+	}
+
+	if (!cache || cache->count == cache->size) {
+		size = cache ? cache->size * 2 : 16;
+		tmp = realloc(cache, sizeof(*cache) +
+			      size * sizeof(cache->entries[0]));
+		if (!tmp)
+			return;
+		if (!cache)
+			tmp->count = 0;
+		tmp->size = size;
+		cache = priv->params = tmp;
+	}
+
+	cache->entries[cache->count].domain = domain;
+	cache->entries[cache->count].param = param->param;
+	cache->entries[cache->count].value = param->value;
+	cache->entries[cache->count].ret = param->ret;
+	cache->count++;
+}
+
+/**
+ * Get several driver specific parameters at once.
+ *
+ * \param fd file descriptor.
+ * \param domain identifies the parameter space, typically the driver command
+ * index of the query ioctl.
+ * \param query function used to query parameters that aren't cached yet.
+ * \param params parameters to query; the value and ret fields are filled in.
+ * \param count number of entries in \p params.
+ *
+ * \return the number of parameters successfully queried.
+ *
+ * \internal
+ * If \p fd has cached device information (see drmGetFdInfo()), results,
+ * including unknown parameters, are cached there, so this must only be used
+ * for parameters that don't change over the lifetime of the device.  Without
+ * it every parameter is simply queried; the information isn't created here,
+ * as that would cost more syscalls than a single set of queries saves.
+ */
+int drmGetParams(int fd, unsigned int domain, drmParamQueryFunc query,
+		 drmParamPtr params, int count)
+{
+	drmFdInfoPriv *priv;
+	drmParamCache *cache;
+	int i, j, n = 0, misses = 0;
+
+	pthread_mutex_lock(&drmFdInfoLock);
+	priv = drmLookupFdInfo(fd);
+	cache = priv ? priv->params : NULL;
+	for (i = 0; i < count; i++) {
+		params[i].value = 0;
+		params[i].ret = 1;	/* not cached */
+
+		for (j = 0; cache && j < cache->count; j++) {
+			if (cache->entries[j].domain == domain &&
+			    cache->entries[j].param == params[i].param) {
+				params[i].value = cache->entries[j].value;
+				params[i].ret = cache->entries[j].ret;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&drmFdInfoLock);
+
+	/* Query what isn't cached without holding the lock. */
+	for (i = 0; i < count; i++) {
+		if (params[i].ret > 0) {
+			params[i].ret = query(fd, params[i].param,
+					      &params[i].value);
+			misses++;
+		}
+		if (params[i].ret == 0)
+			n++;
+	}
+
+	if (priv && misses) {
+		pthread_mutex_lock(&drmFdInfoLock);
+		if (drmLookupFdInfo(fd) == priv) {
+			/* Don't cache transient failures. */
+			for (i = 0; i < count; i++) {
+				if (params[i].ret == 0 ||
+				    params[i].ret == -EINVAL)
+					drmCacheParam(priv, domain,
+						      &params[i]);
+			}
+		}
+		pthread_mutex_unlock(&drmFdInfoLock);
+	}
+	return n;
+}
+
 /**
  * Free the bus ID information.
  *
@@ -1109,6 +1754,8 @@ int drmClose(int fd)
     drmHashDelete(drmHashTable, key);
     drmFree(entry);
 
+    drmFreeFdInfo(fd);
+
     return close(fd);
 }
 
@@ -2529,8 +3176,7 @@ char *drmGetDeviceNameFromFd(int fd)
 	 * things worse with even more ad hoc directory walking code to
 	 * discover the device file name. */
 
-	fstat(fd, &sbuf);
-	d = sbuf.st_rdev;
+	d = drmGetKeyFromFd(fd);
 
 	for (i = 0; i < DRM_MAX_MINOR; i++) {
 		snprintf(name, sizeof name, DRM_DEV_NAME, DRM_DIR_NAME, i);
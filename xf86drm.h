@@ -125,6 +125,55 @@ typedef struct _drmVersion {
     char    *desc;                /**< User-space buffer to hold desc */
 } drmVersion, *drmVersionPtr;
 
+#define DRM_NODE_PRIMARY 0        /**< card%d */
+#define DRM_NODE_CONTROL 1        /**< controlD%d */
+#define DRM_NODE_RENDER  2        /**< renderD%d */
+
+/**
+ * DRM device node, as found during sysfs enumeration.
+ *
+ * \sa drmGetDeviceList().
+ */
+typedef struct _drmDeviceInfo {
+    int     minor;                /**< Device minor number */
+    int     node_type;            /**< One of DRM_NODE_* */
+    char    busid[64];            /**< Bus ID, "pci:oooo:bb:dd.f", or empty */
+    char    driver[32];           /**< Kernel driver name, or empty */
+} drmDeviceInfo, *drmDeviceInfoPtr;
+
+/**
+ * Per file descriptor device information.
+ *
+ * \sa drmGetFdInfo().
+ */
+typedef struct _drmFdInfo {
+    int      fd;                  /**< File descriptor */
+    dev_t    rdev;                /**< Device number */
+    int      node_type;           /**< One of DRM_NODE_* */
+    char     driver[32];          /**< DRM driver name, or empty */
+    uint16_t pci_vendor_id;       /**< PCI vendor ID, or zero */
+    uint16_t pci_device_id;       /**< PCI device ID, or zero */
+    int      version_major;       /**< Driver major version */
+    int      version_minor;       /**< Driver minor version */
+    int      version_patchlevel;  /**< Driver patch level */
+} drmFdInfo, *drmFdInfoPtr;
+
+/**
+ * One entry of a batched capability or parameter query.
+ *
+ * \sa drmGetCaps() and drmGetParams().
+ */
+typedef struct _drmParam {
+    uint64_t param;               /**< Capability or parameter to query */
+    uint64_t value;               /**< Returned value */
+    int      ret;                 /**< Zero, or a negative errno */
+} drmParam, *drmParamPtr;
+
+/**
+ * Driver specific single parameter query, returning zero or a negative errno.
+ */
+typedef int (*drmParamQueryFunc)(int fd, uint64_t param, uint64_t *value);
+
 typedef struct _drmStats {
     unsigned long count;	     /**< Number of data */
     struct {
@@ -547,9 +596,18 @@ extern int           drmAvailable(void);
 extern int           drmOpen(const char *name, const char *busid);
 extern int drmOpenControl(int minor);
 extern int           drmClose(int fd);
+extern int           drmGetDeviceList(const drmDeviceInfo **devices);
+extern void          drmRescanDeviceList(void);
 extern drmVersionPtr drmGetVersion(int fd);
 extern drmVersionPtr drmGetLibVersion(int fd);
 extern int           drmGetCap(int fd, uint64_t capability, uint64_t *value);
+extern const drmFdInfo *drmGetFdInfo(int fd);
+extern const drmFdInfo *drmGetCachedFdInfo(int fd);
+extern void          drmFreeFdInfo(int fd);
+extern int           drmGetCaps(int fd, drmParamPtr caps, int count);
+extern int           drmGetParams(int fd, unsigned int domain,
+				  drmParamQueryFunc query,
+				  drmParamPtr params, int count);
 extern void          drmFreeVersion(drmVersionPtr);
 extern int           drmGetMagic(int fd, drm_magic_t * magic);
 extern char          *drmGetBusid(int fd);